@@ -0,0 +1,388 @@
+//
+// Created by 刘文景 on 2021/4/15.
+//
+// Drives a Cache from several threads with a configurable key popularity
+// skew, operation mix and periodic scans, and reports throughput, hit
+// ratio and latency percentiles.
+//
+// Example:
+//   cache_bench --threads=8 --zipf=0.99 --lookup_percent=90
+//               --insert_percent=8 --scan_every=10000
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lsmdb/cache.h"
+#include "lsmdb/env.h"
+#include "lsmdb/secondary_cache.h"
+#include "util/coding.h"
+#include "util/histogram.h"
+#include "util/random.h"
+
+// Number of threads issuing operations.
+static int FLAGS_threads = 4;
+
+// Number of operations issued by every thread.
+static int FLAGS_ops_per_thread = 1000000;
+
+// Number of distinct keys.
+static int FLAGS_num_keys = 1000000;
+
+// Size of the keys, at least 8 bytes.
+static int FLAGS_key_size = 16;
+
+// Charge of every value. Values are allocated for real, so memory use
+// follows the cache capacity.
+static int FLAGS_value_size = 4096;
+
+// Capacity of the cache in bytes.
+static long FLAGS_cache_size = 1L << 30;
+
+// Zipfian skew of the key popularity, in [0, 1). 0 means uniform.
+static double FLAGS_zipf = 0.99;
+
+// Operation mix in percent. The rest of the operations are erases.
+static int FLAGS_lookup_percent = 90;
+static int FLAGS_insert_percent = 9;
+
+// Every thread runs a scan of --scan_length consecutive keys after this
+// many operations, 0 disables scans.
+static int FLAGS_scan_every = 0;
+static int FLAGS_scan_length = 10000;
+
+// Insert on lookup misses, like a block cache in front of storage.
+static bool FLAGS_insert_on_miss = true;
+
+// Size in bytes of a compressed secondary cache, 0 disables it.
+static long FLAGS_secondary_cache_size = 0;
+
+// Print the whole latency histogram instead of the percentiles only.
+static bool FLAGS_histogram = false;
+
+static int FLAGS_seed = 301;
+
+namespace lsmdb {
+
+namespace {
+
+// Generates integers in [0, n) following a Zipfian distribution, using
+// the method of "Quickly Generating Billion-Record Synthetic Databases"
+// (Gray et al.) that YCSB uses as well. The most popular item is 0.
+// The method needs 0 <= theta < 1.
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t n, double theta) : n_(n), theta_(theta) {
+    if (theta_ > 0) {
+      zetan_ = Zeta(n_, theta_);
+      const double zeta2 = Zeta(2, theta_);
+      alpha_ = 1.0 / (1.0 - theta_);
+      eta_ = (1 - std::pow(2.0 / n_, 1 - theta_)) / (1 - zeta2 / zetan_);
+    }
+  }
+
+  // "u" must be uniformly distributed in [0, 1).
+  uint64_t Next(double u) const {
+    if (theta_ <= 0) {
+      return static_cast<uint64_t>(u * n_);
+    }
+    const double uz = u * zetan_;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + std::pow(0.5, theta_)) return 1;
+    uint64_t v = static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    return v >= n_ ? n_ - 1 : v;
+  }
+
+ private:
+  static double Zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i) {
+      sum += 1.0 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+  }
+
+  const uint64_t n_;
+  const double theta_;
+  double zetan_ = 0;
+  double alpha_ = 0;
+  double eta_ = 0;
+};
+
+// Cache operations take well under a microsecond, so they are timed with
+// a monotonic clock in nanoseconds rather than with Env::NowMicros().
+uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void DeleteValue(const Slice& key, void* value) {
+  delete[] reinterpret_cast<char*>(value);
+}
+
+void* NewValue() {
+  char* value = new char[FLAGS_value_size];
+  std::memset(value, 'v', FLAGS_value_size);
+  return value;
+}
+
+void SaveValue(void* value, std::string* dst) {
+  dst->append(reinterpret_cast<char*>(value), FLAGS_value_size);
+}
+
+void* CreateValue(const Slice& data, size_t* charge) {
+  char* value = new char[data.size()];
+  std::memcpy(value, data.data(), data.size());
+  *charge = data.size();
+  return value;
+}
+
+struct ThreadStats {
+  ThreadStats() : lookups(0), hits(0), inserts(0), erases(0), scanned(0) {}
+
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t inserts;
+  uint64_t erases;
+  uint64_t scanned;
+  Histogram lookup_latency;
+  Histogram insert_latency;
+  Histogram erase_latency;
+};
+
+class CacheBench {
+ public:
+  CacheBench() : env_(Env::Default()), zipf_(FLAGS_num_keys, FLAGS_zipf) {
+    helper_.save = SaveValue;
+    helper_.create = CreateValue;
+    helper_.deleter = DeleteValue;
+    if (FLAGS_secondary_cache_size > 0) {
+      cache_ = NewLRUCache(FLAGS_cache_size,
+                           NewCompressedSecondaryCache(
+                               FLAGS_secondary_cache_size));
+    } else {
+      cache_ = NewLRUCache(FLAGS_cache_size);
+    }
+  }
+
+  void Run() {
+    PrintHeader();
+
+    // Fill the cache with the most popular keys first.
+    std::string key;
+    for (int i = 0; i < FLAGS_num_keys; ++i) {
+      EncodeKey(i, &key);
+      if (static_cast<long>(i) * FLAGS_value_size >= FLAGS_cache_size) break;
+      cache_->Release(
+          cache_->Insert(key, NewValue(), FLAGS_value_size, &helper_));
+    }
+
+    std::vector<ThreadStats> stats(FLAGS_threads);
+    std::vector<std::thread> threads;
+    const uint64_t start = env_->NowMicros();
+    for (int i = 0; i < FLAGS_threads; ++i) {
+      threads.emplace_back(&CacheBench::ThreadMain, this, i, &stats[i]);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    const uint64_t elapsed = env_->NowMicros() - start;
+
+    ThreadStats total;
+    for (const ThreadStats& s : stats) {
+      total.lookups += s.lookups;
+      total.hits += s.hits;
+      total.inserts += s.inserts;
+      total.erases += s.erases;
+      total.scanned += s.scanned;
+      total.lookup_latency.Merge(s.lookup_latency);
+      total.insert_latency.Merge(s.insert_latency);
+      total.erase_latency.Merge(s.erase_latency);
+    }
+    Report(total, elapsed);
+  }
+
+ private:
+  void EncodeKey(uint64_t k, std::string* key) const {
+    key->clear();
+    PutFixed64(key, k);
+    key->resize(FLAGS_key_size, 'k');
+  }
+
+  void ThreadMain(int thread_id, ThreadStats* stats) {
+    Random rnd(FLAGS_seed + thread_id);
+    std::string key;
+    for (int i = 0; i < FLAGS_ops_per_thread; ++i) {
+      if (FLAGS_scan_every > 0 && i > 0 && i % FLAGS_scan_every == 0) {
+        Scan(&rnd, stats);
+      }
+      const double u = rnd.Next() / 2147483647.0;
+      EncodeKey(zipf_.Next(u), &key);
+      const int op = rnd.Uniform(100);
+      const uint64_t start = NowNanos();
+      if (op < FLAGS_lookup_percent) {
+        stats->lookups++;
+        if (LookupOrInsert(key)) stats->hits++;
+        stats->lookup_latency.Add(NowNanos() - start);
+      } else if (op < FLAGS_lookup_percent + FLAGS_insert_percent) {
+        stats->inserts++;
+        cache_->Release(
+            cache_->Insert(key, NewValue(), FLAGS_value_size, &helper_));
+        stats->insert_latency.Add(NowNanos() - start);
+      } else {
+        stats->erases++;
+        cache_->Erase(key);
+        stats->erase_latency.Add(NowNanos() - start);
+      }
+    }
+  }
+
+  // Returns true on a hit.
+  bool LookupOrInsert(const Slice& key) {
+    Cache::Handle* handle = cache_->Lookup(key, &helper_);
+    if (handle != nullptr) {
+      cache_->Release(handle);
+      return true;
+    }
+    if (FLAGS_insert_on_miss) {
+      cache_->Release(
+          cache_->Insert(key, NewValue(), FLAGS_value_size, &helper_));
+    }
+    return false;
+  }
+
+  // Touches a run of keys once, like a full table scan would.
+  void Scan(Random* rnd, ThreadStats* stats) {
+    std::string key;
+    const uint64_t first = rnd->Uniform(FLAGS_num_keys);
+    for (int i = 0; i < FLAGS_scan_length; ++i) {
+      EncodeKey((first + i) % FLAGS_num_keys, &key);
+      LookupOrInsert(key);
+      stats->scanned++;
+    }
+  }
+
+  void PrintHeader() const {
+    std::fprintf(stdout, "Threads:      %d\n", FLAGS_threads);
+    std::fprintf(stdout, "Keys:         %d (%d bytes each)\n", FLAGS_num_keys,
+                 FLAGS_key_size);
+    std::fprintf(stdout, "Values:       %d bytes each\n", FLAGS_value_size);
+    std::fprintf(stdout, "Cache:        %ld bytes (%ld entries)\n",
+                 FLAGS_cache_size, FLAGS_cache_size / FLAGS_value_size);
+    std::fprintf(stdout, "Secondary:    %ld bytes\n",
+                 FLAGS_secondary_cache_size);
+    std::fprintf(stdout, "Zipf theta:   %.2f\n", FLAGS_zipf);
+    std::fprintf(stdout, "Mix:          %d%% lookup, %d%% insert, %d%% erase\n",
+                 FLAGS_lookup_percent, FLAGS_insert_percent,
+                 100 - FLAGS_lookup_percent - FLAGS_insert_percent);
+    if (FLAGS_scan_every > 0) {
+      std::fprintf(stdout, "Scans:        %d keys every %d ops\n",
+                   FLAGS_scan_length, FLAGS_scan_every);
+    }
+    std::fprintf(stdout,
+                 "------------------------------------------------\n");
+  }
+
+  static void PrintLatency(const char* name, const Histogram& latency) {
+    if (latency.Num() == 0) return;
+    if (FLAGS_histogram) {
+      std::fprintf(stdout, "%s latency (nanos):\n%s\n", name,
+                   latency.ToString().c_str());
+      return;
+    }
+    std::fprintf(stdout,
+                 "%-7s nanos/op avg %.1f  P50 %.0f  P99 %.0f  P99.9 %.0f  "
+                 "max %.0f\n",
+                 name, latency.Average(), latency.Percentile(50),
+                 latency.Percentile(99), latency.Percentile(99.9),
+                 latency.Max());
+  }
+
+  void Report(const ThreadStats& total, uint64_t elapsed_micros) const {
+    const uint64_t ops = total.lookups + total.inserts + total.erases;
+    const double seconds = elapsed_micros * 1e-6;
+    std::fprintf(stdout, "ops/sec:      %.0f (%llu ops in %.3f secs)\n",
+                 ops / seconds, static_cast<unsigned long long>(ops), seconds);
+    std::fprintf(stdout, "hit ratio:    %.2f%% of %llu lookups\n",
+                 total.lookups == 0 ? 0.0 : 100.0 * total.hits / total.lookups,
+                 static_cast<unsigned long long>(total.lookups));
+    if (total.scanned > 0) {
+      std::fprintf(stdout, "scanned:      %llu keys\n",
+                   static_cast<unsigned long long>(total.scanned));
+    }
+    PrintLatency("lookup", total.lookup_latency);
+    PrintLatency("insert", total.insert_latency);
+    PrintLatency("erase", total.erase_latency);
+  }
+
+  Env* const env_;
+  const ZipfianGenerator zipf_;
+  Cache::ItemHelper helper_;
+  std::shared_ptr<Cache> cache_;
+};
+
+}  // namespace
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    double d;
+    int n;
+    long l;
+    char junk;
+    if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--ops_per_thread=%d%c", &n, &junk) == 1) {
+      FLAGS_ops_per_thread = n;
+    } else if (sscanf(argv[i], "--num_keys=%d%c", &n, &junk) == 1) {
+      FLAGS_num_keys = n;
+    } else if (sscanf(argv[i], "--key_size=%d%c", &n, &junk) == 1 && n >= 8) {
+      FLAGS_key_size = n;
+    } else if (sscanf(argv[i], "--value_size=%d%c", &n, &junk) == 1) {
+      FLAGS_value_size = n;
+    } else if (sscanf(argv[i], "--cache_size=%ld%c", &l, &junk) == 1) {
+      FLAGS_cache_size = l;
+    } else if (sscanf(argv[i], "--zipf=%lf%c", &d, &junk) == 1 && d >= 0 &&
+               d < 1) {
+      FLAGS_zipf = d;
+    } else if (sscanf(argv[i], "--lookup_percent=%d%c", &n, &junk) == 1) {
+      FLAGS_lookup_percent = n;
+    } else if (sscanf(argv[i], "--insert_percent=%d%c", &n, &junk) == 1) {
+      FLAGS_insert_percent = n;
+    } else if (sscanf(argv[i], "--scan_every=%d%c", &n, &junk) == 1) {
+      FLAGS_scan_every = n;
+    } else if (sscanf(argv[i], "--scan_length=%d%c", &n, &junk) == 1) {
+      FLAGS_scan_length = n;
+    } else if (sscanf(argv[i], "--insert_on_miss=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_insert_on_miss = n;
+    } else if (sscanf(argv[i], "--secondary_cache_size=%ld%c", &l, &junk) ==
+               1) {
+      FLAGS_secondary_cache_size = l;
+    } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_histogram = n;
+    } else if (sscanf(argv[i], "--seed=%d%c", &n, &junk) == 1) {
+      FLAGS_seed = n;
+    } else {
+      std::fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      std::exit(1);
+    }
+  }
+  if (FLAGS_lookup_percent + FLAGS_insert_percent > 100) {
+    std::fprintf(stderr, "lookup_percent + insert_percent exceeds 100\n");
+    std::exit(1);
+  }
+
+  lsmdb::CacheBench bench;
+  bench.Run();
+  return 0;
+}
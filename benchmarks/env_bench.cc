@@ -0,0 +1,667 @@
+//
+// Created by 刘文景 on 2021/4/16.
+//
+// Benchmarks of the I/O paths of an Env.
+//
+// Example:
+//   env_bench --benchmarks=randread,asyncread --file_size=4294967296
+//             --threads=4 --queue_depth=32
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "helpers/instrumented_env/instrumented_env.h"
+#include "helpers/shaping_env/shaping_env.h"
+#include "lsmdb/env.h"
+#include "lsmdb/rate_limiter.h"
+#include "port/port.h"
+#include "util/histogram.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+
+// Comma-separated list of operations to run in the specified order.
+//   randread   -- blocking Read() of random blocks
+//   asyncread  -- ReadAsync() of random blocks, --queue_depth per thread
+//   seqread    -- SequentialFile reads of --block_size through the file
+//   fillsync   -- Append() of --block_size to a new file of --file_size
+//                 per thread, with a Sync() every --sync_every bytes
+//   fillsmall  -- like fillsync, but with Append() and Flush() of
+//                 --append_size, as a log writer does for every record
+static const char* FLAGS_benchmarks = "randread,asyncread";
+
+// Number of threads running every benchmark.
+static int FLAGS_threads = 1;
+
+// Size of the file read by the read benchmarks. It is created on first
+// use and kept around so that later runs can reuse it.
+static long FLAGS_file_size = 1L << 30;
+
+// Size of every read.
+static int FLAGS_block_size = 4096;
+
+// Number of reads issued by every thread.
+static int FLAGS_reads = 100000;
+
+// Number of reads every thread keeps in flight in asyncread.
+static int FLAGS_queue_depth = 32;
+
+// Readahead buffer size of the sequential file in seqread.
+static int FLAGS_readahead_size = 0;
+
+// Drop the pages read by seqread from the page cache.
+static bool FLAGS_drop_consumed_pages = false;
+
+// Bytes written between the Sync() calls of fillsync.
+static int FLAGS_sync_every = 1 << 20;
+
+// Sync fillsync and fillsmall with SyncAsync(), waiting for a sync only
+// when the next one is due, so that the appends overlap the sync.
+static bool FLAGS_sync_async = false;
+
+// Size of the appends of fillsmall.
+static int FLAGS_append_size = 100;
+
+// FileOptions::use_mmap_writes of the files written by fillsync and
+// fillsmall.
+static bool FLAGS_use_mmap_writes = false;
+
+// FileOptions::writable_file_buffer_size of the files written by
+// fillsync and fillsmall.
+static long FLAGS_writable_file_buffer_size = 65536;
+
+// FileOptions::bytes_per_sync of the files written by fillsync.
+static long FLAGS_bytes_per_sync = 0;
+
+// FileOptions::preallocation_block_size of the files written by fillsync.
+static long FLAGS_preallocation_block_size = 0;
+
+// Rate limit of the writes of fillsync in bytes per second, 0 for none.
+static long FLAGS_rate_limit = 0;
+
+// Auto-tune the rate limiter of fillsync.
+static bool FLAGS_rate_limit_auto_tune = false;
+
+// Drop the pages of the file from the page cache before every read
+// benchmark, which makes any file behave like one larger than the page
+// cache.
+static bool FLAGS_drop_cache = true;
+
+// Run the benchmarks through a ShapingEnv that delays every read, write
+// and sync by a fixed time plus an exponentially distributed jitter, and
+// occasionally by a spike. Bandwidths are in bytes per second. A sync
+// stall of --shape_sync_stall_micros happens every
+// --shape_sync_stall_period_micros. All 0 by default, which runs the
+// benchmarks on the Env itself.
+static long FLAGS_shape_read_micros = 0;
+static long FLAGS_shape_write_micros = 0;
+static long FLAGS_shape_sync_micros = 0;
+static long FLAGS_shape_jitter_micros = 0;
+static double FLAGS_shape_spike_probability = 0;
+static long FLAGS_shape_spike_micros = 0;
+static long FLAGS_shape_read_bandwidth = 0;
+static long FLAGS_shape_write_bandwidth = 0;
+static long FLAGS_shape_sync_stall_period_micros = 0;
+static long FLAGS_shape_sync_stall_micros = 0;
+
+// Run the benchmarks through an InstrumentedEnv and print its statistics
+// at the end.
+static bool FLAGS_io_stats = false;
+
+// Print the whole latency histogram instead of the percentiles only.
+static bool FLAGS_histogram = false;
+
+// Directory of the benchmark files, the Env's test directory by default.
+static const char* FLAGS_dir = nullptr;
+
+namespace lsmdb {
+
+namespace {
+
+struct ThreadStats {
+  ThreadStats() : ops(0), bytes(0) {}
+
+  void Merge(const ThreadStats& other) {
+    ops += other.ops;
+    bytes += other.bytes;
+    latency.Merge(other.latency);
+  }
+
+  uint64_t ops;
+  uint64_t bytes;
+  Histogram latency;
+};
+
+// Returns a ShapingEnv over the default Env as configured by the
+// --shape_* flags, or nullptr if they are all 0.
+Env* NewShapingEnvFromFlags() {
+  ShapingEnvOptions options;
+  LatencyDistribution* latencies[] = {&options.read_latency,
+                                      &options.write_latency,
+                                      &options.sync_latency};
+  for (LatencyDistribution* latency : latencies) {
+    latency->mean_jitter_micros = FLAGS_shape_jitter_micros;
+    latency->spike_probability = FLAGS_shape_spike_probability;
+    latency->spike_micros = FLAGS_shape_spike_micros;
+  }
+  options.read_latency.fixed_micros = FLAGS_shape_read_micros;
+  options.write_latency.fixed_micros = FLAGS_shape_write_micros;
+  options.sync_latency.fixed_micros = FLAGS_shape_sync_micros;
+  options.read_bytes_per_second = FLAGS_shape_read_bandwidth;
+  options.write_bytes_per_second = FLAGS_shape_write_bandwidth;
+  options.sync_stall_period_micros = FLAGS_shape_sync_stall_period_micros;
+  options.sync_stall_micros = FLAGS_shape_sync_stall_micros;
+  const bool shaped =
+      FLAGS_shape_read_micros > 0 || FLAGS_shape_write_micros > 0 ||
+      FLAGS_shape_sync_micros > 0 || FLAGS_shape_jitter_micros > 0 ||
+      (FLAGS_shape_spike_probability > 0 && FLAGS_shape_spike_micros > 0) ||
+      FLAGS_shape_read_bandwidth > 0 || FLAGS_shape_write_bandwidth > 0 ||
+      (FLAGS_shape_sync_stall_period_micros > 0 &&
+       FLAGS_shape_sync_stall_micros > 0);
+  return shaped ? NewShapingEnv(Env::Default(), options) : nullptr;
+}
+
+class Benchmark {
+ public:
+  Benchmark()
+      : shaping_env_(NewShapingEnvFromFlags()),
+        instrumented_env_(FLAGS_io_stats ? NewInstrumentedEnv(BaseEnv())
+                                         : nullptr),
+        env_(FLAGS_io_stats ? instrumented_env_.get() : BaseEnv()) {
+    if (FLAGS_rate_limit > 0) {
+      RateLimiterOptions options;
+      options.bytes_per_second = FLAGS_rate_limit;
+      options.auto_tuned = FLAGS_rate_limit_auto_tune;
+      rate_limiter_ = NewRateLimiter(options);
+    }
+    if (FLAGS_dir != nullptr) {
+      dir_ = FLAGS_dir;
+    } else {
+      env_->GetTestDirectory(&dir_);
+    }
+  }
+
+  void Run() {
+    std::fprintf(stdout, "Threads:     %d\n", FLAGS_threads);
+    std::fprintf(stdout, "Directory:   %s\n", dir_.c_str());
+    std::fprintf(stdout,
+                 "------------------------------------------------\n");
+
+    const char* benchmarks = FLAGS_benchmarks;
+    while (benchmarks != nullptr) {
+      const char* sep = std::strchr(benchmarks, ',');
+      Slice name;
+      if (sep == nullptr) {
+        name = benchmarks;
+        benchmarks = nullptr;
+      } else {
+        name = Slice(benchmarks, sep - benchmarks);
+        benchmarks = sep + 1;
+      }
+
+      void (Benchmark::*method)(int, ThreadStats*) = nullptr;
+      Status status;
+      if (name == Slice("randread")) {
+        status = PrepareReadFile();
+        method = &Benchmark::RandRead;
+      } else if (name == Slice("asyncread")) {
+        status = PrepareReadFile();
+        method = &Benchmark::AsyncRead;
+      } else if (name == Slice("seqread")) {
+        status = PrepareReadFile();
+        method = &Benchmark::SeqRead;
+      } else if (name == Slice("fillsync")) {
+        method = &Benchmark::FillSync;
+      } else if (name == Slice("fillsmall")) {
+        method = &Benchmark::FillSmall;
+      } else if (!name.empty()) {
+        std::fprintf(stderr, "unknown benchmark '%s'\n",
+                     name.ToString().c_str());
+      }
+      if (!status.ok()) {
+        std::fprintf(stderr, "%s: %s\n", name.ToString().c_str(),
+                     status.ToString().c_str());
+        std::exit(1);
+      }
+      if (method != nullptr) {
+        RunBenchmark(name, method);
+      }
+    }
+    PrintRateLimiterStats();
+    delete read_file_;
+    if (instrumented_env_ != nullptr) {
+      std::fprintf(stdout, "I/O statistics:\n%s",
+                   instrumented_env_->GetStats().ToString().c_str());
+    }
+  }
+
+ private:
+  void RunBenchmark(const Slice& name,
+                    void (Benchmark::*method)(int, ThreadStats*)) {
+    std::vector<ThreadStats> stats(FLAGS_threads);
+    std::vector<std::thread> threads;
+    const uint64_t start = env_->NowMicros();
+    for (int i = 0; i < FLAGS_threads; ++i) {
+      threads.emplace_back(method, this, i, &stats[i]);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    const double seconds = (env_->NowMicros() - start) * 1e-6;
+
+    ThreadStats total;
+    for (const ThreadStats& s : stats) {
+      total.Merge(s);
+    }
+    std::fprintf(stdout,
+                 "%-12s : %11.0f ops/sec %9.1f MB/s; micros/op P50 %.1f "
+                 "P99 %.1f P99.9 %.1f\n",
+                 name.ToString().c_str(), total.ops / seconds,
+                 total.bytes / 1048576.0 / seconds,
+                 total.latency.Percentile(50), total.latency.Percentile(99),
+                 total.latency.Percentile(99.9));
+    if (FLAGS_histogram) {
+      std::fprintf(stdout, "Microseconds per op:\n%s\n",
+                   total.latency.ToString().c_str());
+    }
+  }
+
+  // Creates the file of the read benchmarks if needed and opens it.
+  Status PrepareReadFile() {
+    const std::string fname = dir_ + "/env_bench_read";
+    uint64_t size = 0;
+    Status status;
+    if (!env_->GetFileSize(fname, &size).ok() ||
+        size != static_cast<uint64_t>(FLAGS_file_size)) {
+      std::fprintf(stdout, "Creating %s (%ld bytes)...\n", fname.c_str(),
+                   FLAGS_file_size);
+      WritableFile* file;
+      status = env_->NewWritableFile(fname, &file);
+      if (!status.ok()) {
+        return status;
+      }
+      Random rnd(301);
+      std::string block(1 << 20, '\0');
+      for (long written = 0; status.ok() && written < FLAGS_file_size;
+           written += block.size()) {
+        for (char& c : block) {
+          c = static_cast<char>(rnd.Next());
+        }
+        status = file->Append(Slice(
+            block.data(), std::min<long>(block.size(),
+                                         FLAGS_file_size - written)));
+      }
+      if (status.ok()) {
+        status = file->Sync();
+      }
+      if (status.ok()) {
+        status = file->Close();
+      }
+      delete file;
+      if (!status.ok()) {
+        return status;
+      }
+    }
+
+    if (FLAGS_drop_cache) {
+      const int fd = ::open(fname.c_str(), O_RDONLY);
+      if (fd >= 0) {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+      }
+    }
+
+    if (read_file_ == nullptr) {
+      // Reads of a mmap-ed file would not exercise the read paths.
+      FileOptions options;
+      options.allow_mmap_reads = false;
+      status = env_->NewRandomAccessFile(fname, options, &read_file_);
+    }
+    return status;
+  }
+
+  uint64_t RandomBlockOffset(Random* rnd) const {
+    const uint64_t blocks = FLAGS_file_size / FLAGS_block_size;
+    const uint64_t block = (static_cast<uint64_t>(rnd->Next()) << 31 |
+                            rnd->Next()) % blocks;
+    return block * FLAGS_block_size;
+  }
+
+  void RandRead(int thread, ThreadStats* stats) {
+    Random rnd(1000 + thread);
+    std::string scratch(FLAGS_block_size, '\0');
+    for (int i = 0; i < FLAGS_reads; ++i) {
+      const uint64_t start = env_->NowMicros();
+      Slice result;
+      Status status = read_file_->Read(RandomBlockOffset(&rnd),
+                                       FLAGS_block_size, &result, &scratch[0]);
+      if (!status.ok()) {
+        std::fprintf(stderr, "read error: %s\n", status.ToString().c_str());
+        std::exit(1);
+      }
+      stats->latency.Add(env_->NowMicros() - start);
+      stats->ops++;
+      stats->bytes += result.size();
+    }
+  }
+
+  void AsyncRead(int thread, ThreadStats* stats) {
+    Random rnd(1000 + thread);
+    std::vector<ReadRequest> requests(FLAGS_queue_depth);
+    std::vector<std::string> scratch(FLAGS_queue_depth,
+                                     std::string(FLAGS_block_size, '\0'));
+    std::vector<uint64_t> start_micros(FLAGS_queue_depth);
+    std::vector<ReadRequest*> idle;
+    for (int i = 0; i < FLAGS_queue_depth; ++i) {
+      requests[i].scratch = &scratch[i][0];
+      requests[i].n = FLAGS_block_size;
+      idle.push_back(&requests[i]);
+    }
+
+    std::vector<ReadRequest*> completed;
+    int submitted = 0;
+    while (stats->ops < static_cast<uint64_t>(FLAGS_reads)) {
+      while (!idle.empty() && submitted < FLAGS_reads) {
+        ReadRequest* req = idle.back();
+        idle.pop_back();
+        req->offset = RandomBlockOffset(&rnd);
+        start_micros[req - &requests[0]] = env_->NowMicros();
+        Status status = read_file_->ReadAsync(req);
+        if (!status.ok()) {
+          std::fprintf(stderr, "read error: %s\n", status.ToString().c_str());
+          std::exit(1);
+        }
+        ++submitted;
+      }
+      completed.clear();
+      Status status = env_->PollReads(1, &completed);
+      const uint64_t now = env_->NowMicros();
+      for (ReadRequest* req : completed) {
+        if (status.ok()) {
+          status = req->status;
+        }
+        stats->latency.Add(now - start_micros[req - &requests[0]]);
+        stats->ops++;
+        stats->bytes += req->result.size();
+        idle.push_back(req);
+      }
+      if (!status.ok()) {
+        std::fprintf(stderr, "read error: %s\n", status.ToString().c_str());
+        std::exit(1);
+      }
+    }
+  }
+
+  // Every thread reads the whole file.
+  void SeqRead(int thread, ThreadStats* stats) {
+    FileOptions options;
+    options.readahead_size = FLAGS_readahead_size;
+    options.drop_consumed_pages = FLAGS_drop_consumed_pages;
+    SequentialFile* file;
+    Status status =
+        env_->NewSequentialFile(dir_ + "/env_bench_read", options, &file);
+    std::string scratch(FLAGS_block_size, '\0');
+    while (status.ok()) {
+      const uint64_t start = env_->NowMicros();
+      Slice result;
+      status = file->Read(FLAGS_block_size, &result, &scratch[0]);
+      if (!status.ok() || result.empty()) {
+        break;
+      }
+      stats->latency.Add(env_->NowMicros() - start);
+      stats->ops++;
+      stats->bytes += result.size();
+    }
+    if (!status.ok()) {
+      std::fprintf(stderr, "read error: %s\n", status.ToString().c_str());
+      std::exit(1);
+    }
+    delete file;
+  }
+
+  void FillSync(int thread, ThreadStats* stats) {
+    Fill(thread, FLAGS_block_size, false, stats);
+  }
+
+  void FillSmall(int thread, ThreadStats* stats) {
+    Fill(thread, FLAGS_append_size, true, stats);
+  }
+
+  // Writes a file of --file_size in appends of "append_size", followed by
+  // a Flush() if "flush" is true.
+  void Fill(int thread, int append_size, bool flush, ThreadStats* stats) {
+    FileOptions options;
+    options.use_mmap_writes = FLAGS_use_mmap_writes;
+    options.writable_file_buffer_size = FLAGS_writable_file_buffer_size;
+    options.bytes_per_sync = FLAGS_bytes_per_sync;
+    options.preallocation_block_size = FLAGS_preallocation_block_size;
+    options.rate_limiter = rate_limiter_.get();
+    const std::string fname =
+        dir_ + "/env_bench_write_" + std::to_string(thread);
+    WritableFile* file;
+    Status status = env_->NewWritableFile(fname, options, &file);
+    Random rnd(1000 + thread);
+    std::string block(append_size, '\0');
+    for (char& c : block) {
+      c = static_cast<char>(rnd.Next());
+    }
+    // The outcome of the SyncAsync() in flight, if any.
+    struct AsyncSync {
+      AsyncSync() : cv(&mu), pending(false) {}
+
+      Status Wait() {
+        MutexLock l(&mu);
+        while (pending) {
+          cv.Wait();
+        }
+        return status;
+      }
+
+      port::Mutex mu;
+      port::CondVar cv;
+      bool pending;
+      Status status;
+    } async_sync;
+    auto sync = [&]() {
+      if (!FLAGS_sync_async) {
+        return file->Sync();
+      }
+      Status status = async_sync.Wait();
+      if (status.ok()) {
+        {
+          MutexLock l(&async_sync.mu);
+          async_sync.pending = true;
+        }
+        file->SyncAsync([&async_sync](const Status& status) {
+          MutexLock l(&async_sync.mu);
+          async_sync.status = status;
+          async_sync.pending = false;
+          async_sync.cv.Signal();
+        });
+      }
+      return status;
+    };
+    long unsynced = 0;
+    for (long written = 0; status.ok() && written < FLAGS_file_size;
+         written += block.size()) {
+      const uint64_t start = env_->NowMicros();
+      status = file->Append(block);
+      if (status.ok() && flush) {
+        status = file->Flush();
+      }
+      unsynced += block.size();
+      if (status.ok() && unsynced >= FLAGS_sync_every) {
+        status = sync();
+        unsynced = 0;
+      }
+      stats->latency.Add(env_->NowMicros() - start);
+      stats->ops++;
+      stats->bytes += block.size();
+    }
+    if (status.ok()) {
+      status = file->Sync();
+    }
+    if (status.ok()) {
+      status = async_sync.Wait();
+    }
+    if (status.ok()) {
+      status = file->Close();
+    }
+    if (!status.ok()) {
+      std::fprintf(stderr, "write error: %s\n", status.ToString().c_str());
+      std::exit(1);
+    }
+    delete file;
+    env_->RemoveFile(fname);
+  }
+
+  void PrintRateLimiterStats() {
+    if (rate_limiter_ == nullptr) {
+      return;
+    }
+    const RateLimiterStats stats = rate_limiter_->GetStats();
+    std::fprintf(stdout,
+                 "Rate limiter: %.1f MB/s now, %llu of %llu requests "
+                 "throttled for %.3f seconds\n",
+                 rate_limiter_->GetBytesPerSecond() / 1048576.0,
+                 static_cast<unsigned long long>(
+                     stats.throttled_requests[RateLimiter::kLow]),
+                 static_cast<unsigned long long>(
+                     stats.requests[RateLimiter::kLow]),
+                 stats.throttled_micros[RateLimiter::kLow] * 1e-6);
+  }
+
+  // The Env below the instrumentation, if any.
+  Env* BaseEnv() const {
+    return shaping_env_ != nullptr ? shaping_env_.get() : Env::Default();
+  }
+
+  const std::unique_ptr<Env> shaping_env_;  // nullptr if not shaped.
+  const std::unique_ptr<InstrumentedEnv> instrumented_env_;
+  Env* const env_;
+  std::string dir_;
+  std::shared_ptr<RateLimiter> rate_limiter_;
+  RandomAccessFile* read_file_ = nullptr;
+};
+
+}  // namespace
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    int n;
+    long l;
+    double d;
+    char junk;
+    if (lsmdb::Slice(argv[i]).starts_with("--benchmarks=")) {
+      FLAGS_benchmarks = argv[i] + std::strlen("--benchmarks=");
+    } else if (lsmdb::Slice(argv[i]).starts_with("--dir=")) {
+      FLAGS_dir = argv[i] + std::strlen("--dir=");
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--file_size=%ld%c", &l, &junk) == 1) {
+      FLAGS_file_size = l;
+    } else if (sscanf(argv[i], "--block_size=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_block_size = n;
+    } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
+      FLAGS_reads = n;
+    } else if (sscanf(argv[i], "--queue_depth=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_queue_depth = n;
+    } else if (sscanf(argv[i], "--readahead_size=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_readahead_size = n;
+    } else if (sscanf(argv[i], "--drop_consumed_pages=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_drop_consumed_pages = n;
+    } else if (sscanf(argv[i], "--sync_every=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_sync_every = n;
+    } else if (sscanf(argv[i], "--append_size=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_append_size = n;
+    } else if (sscanf(argv[i], "--use_mmap_writes=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_use_mmap_writes = n;
+    } else if (sscanf(argv[i], "--sync_async=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_sync_async = n;
+    } else if (sscanf(argv[i], "--writable_file_buffer_size=%ld%c", &l,
+                      &junk) == 1 &&
+               l > 0) {
+      FLAGS_writable_file_buffer_size = l;
+    } else if (sscanf(argv[i], "--bytes_per_sync=%ld%c", &l, &junk) == 1) {
+      FLAGS_bytes_per_sync = l;
+    } else if (sscanf(argv[i], "--preallocation_block_size=%ld%c", &l,
+                      &junk) == 1) {
+      FLAGS_preallocation_block_size = l;
+    } else if (sscanf(argv[i], "--rate_limit=%ld%c", &l, &junk) == 1) {
+      FLAGS_rate_limit = l;
+    } else if (sscanf(argv[i], "--rate_limit_auto_tune=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_rate_limit_auto_tune = n;
+    } else if (sscanf(argv[i], "--drop_cache=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_drop_cache = n;
+    } else if (sscanf(argv[i], "--shape_read_micros=%ld%c", &l, &junk) ==
+               1) {
+      FLAGS_shape_read_micros = l;
+    } else if (sscanf(argv[i], "--shape_write_micros=%ld%c", &l, &junk) ==
+               1) {
+      FLAGS_shape_write_micros = l;
+    } else if (sscanf(argv[i], "--shape_sync_micros=%ld%c", &l, &junk) ==
+               1) {
+      FLAGS_shape_sync_micros = l;
+    } else if (sscanf(argv[i], "--shape_jitter_micros=%ld%c", &l, &junk) ==
+               1) {
+      FLAGS_shape_jitter_micros = l;
+    } else if (sscanf(argv[i], "--shape_spike_probability=%lf%c", &d,
+                      &junk) == 1) {
+      FLAGS_shape_spike_probability = d;
+    } else if (sscanf(argv[i], "--shape_spike_micros=%ld%c", &l, &junk) ==
+               1) {
+      FLAGS_shape_spike_micros = l;
+    } else if (sscanf(argv[i], "--shape_read_bandwidth=%ld%c", &l, &junk) ==
+               1) {
+      FLAGS_shape_read_bandwidth = l;
+    } else if (sscanf(argv[i], "--shape_write_bandwidth=%ld%c", &l, &junk) ==
+               1) {
+      FLAGS_shape_write_bandwidth = l;
+    } else if (sscanf(argv[i], "--shape_sync_stall_period_micros=%ld%c", &l,
+                      &junk) == 1) {
+      FLAGS_shape_sync_stall_period_micros = l;
+    } else if (sscanf(argv[i], "--shape_sync_stall_micros=%ld%c", &l,
+                      &junk) == 1) {
+      FLAGS_shape_sync_stall_micros = l;
+    } else if (sscanf(argv[i], "--io_stats=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_io_stats = n;
+    } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_histogram = n;
+    } else {
+      std::fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      std::exit(1);
+    }
+  }
+  if (FLAGS_file_size < FLAGS_block_size) {
+    std::fprintf(stderr, "--file_size must be at least --block_size\n");
+    std::exit(1);
+  }
+
+  lsmdb::Benchmark benchmark;
+  benchmark.Run();
+  return 0;
+}
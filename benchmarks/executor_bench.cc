@@ -0,0 +1,201 @@
+//
+// Created by 刘文景 on 2021/4/18.
+//
+// Fans many short tasks out over threads, through the Executor and
+// through the thread pool behind Env::Schedule(), and reports the
+// throughput and the overhead per task.
+//
+// Example:
+//   executor_bench --threads=8 --tasks=1000000 --task_size=1024
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "lsmdb/env.h"
+#include "lsmdb/slice.h"
+#include "port/port.h"
+#include "util/executor.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+// Comma-separated list of operations to run in the specified order.
+//   envschedule  -- one Env::Schedule() per task on the kLow pool
+//   submit       -- one Executor::Submit() per task in a TaskGroup
+//   parallelfor  -- Executor::ParallelFor() over all tasks
+//   nested       -- every task of a ParallelFor() starts --fanout more
+static const char* FLAGS_benchmarks = "envschedule,submit,parallelfor,nested";
+
+// Number of threads of the executor and of the Env's kLow pool.
+static int FLAGS_threads = 4;
+
+// Number of tasks of every benchmark.
+static int FLAGS_tasks = 1000000;
+
+// Bytes hashed by every task, 0 for empty tasks.
+static int FLAGS_task_size = 1024;
+
+// Tasks started by every outer task of the nested benchmark.
+static int FLAGS_fanout = 16;
+
+namespace lsmdb {
+
+namespace {
+
+class Benchmark {
+ public:
+  Benchmark()
+      : env_(Env::Default()),
+        executor_(FLAGS_threads),
+        data_(std::max(FLAGS_task_size, 1), 'x'),
+        checksum_(0) {
+    ThreadPoolOptions options;
+    options.threads = FLAGS_threads;
+    env_->SetThreadPoolOptions(Env::kLow, options);
+  }
+
+  void Run() {
+    std::fprintf(stdout, "Threads:     %d\n", FLAGS_threads);
+    std::fprintf(stdout, "Tasks:       %d\n", FLAGS_tasks);
+    std::fprintf(stdout, "Task size:   %d bytes\n", FLAGS_task_size);
+    std::fprintf(stdout,
+                 "------------------------------------------------\n");
+
+    const char* benchmarks = FLAGS_benchmarks;
+    while (benchmarks != nullptr) {
+      const char* sep = std::strchr(benchmarks, ',');
+      Slice name;
+      if (sep == nullptr) {
+        name = benchmarks;
+        benchmarks = nullptr;
+      } else {
+        name = Slice(benchmarks, sep - benchmarks);
+        benchmarks = sep + 1;
+      }
+
+      void (Benchmark::*method)() = nullptr;
+      if (name == Slice("envschedule")) {
+        method = &Benchmark::EnvSchedule;
+      } else if (name == Slice("submit")) {
+        method = &Benchmark::Submit;
+      } else if (name == Slice("parallelfor")) {
+        method = &Benchmark::ParallelFor;
+      } else if (name == Slice("nested")) {
+        method = &Benchmark::Nested;
+      } else if (!name.empty()) {
+        std::fprintf(stderr, "unknown benchmark '%s'\n",
+                     name.ToString().c_str());
+      }
+      if (method != nullptr) {
+        tasks_run_.store(0);
+        const uint64_t start = env_->NowMicros();
+        (this->*method)();
+        const double micros = env_->NowMicros() - start;
+        const int tasks = tasks_run_.load();
+        std::fprintf(stdout, "%-12s : %11.0f tasks/sec %8.3f micros/task\n",
+                     name.ToString().c_str(), tasks / (micros * 1e-6),
+                     micros * FLAGS_threads / tasks);
+      }
+    }
+  }
+
+ private:
+  void Task() {
+    if (FLAGS_task_size > 0) {
+      checksum_.fetch_add(Hash(data_.data(), FLAGS_task_size, 0),
+                          std::memory_order_relaxed);
+    }
+    tasks_run_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void EnvSchedule() {
+    struct State {
+      State() : cv(&mu), remaining(FLAGS_tasks) {}
+
+      Benchmark* benchmark;
+      port::Mutex mu;
+      port::CondVar cv;
+      std::atomic<int> remaining;
+    } state;
+    state.benchmark = this;
+    for (int i = 0; i < FLAGS_tasks; ++i) {
+      env_->Schedule(
+          [](void* arg) {
+            State* state = static_cast<State*>(arg);
+            state->benchmark->Task();
+            if (state->remaining.fetch_sub(1) == 1) {
+              MutexLock l(&state->mu);
+              state->cv.Signal();
+            }
+          },
+          &state, Env::kLow);
+    }
+    MutexLock l(&state.mu);
+    while (state.remaining.load() > 0) {
+      state.cv.Wait();
+    }
+  }
+
+  void Submit() {
+    TaskGroup group(&executor_);
+    for (int i = 0; i < FLAGS_tasks; ++i) {
+      group.Run([this]() { Task(); });
+    }
+    group.Wait();
+  }
+
+  void ParallelFor() {
+    executor_.ParallelFor(0, FLAGS_tasks, 1, [this](size_t) { Task(); });
+  }
+
+  void Nested() {
+    const int outer = FLAGS_tasks / FLAGS_fanout;
+    executor_.ParallelFor(0, outer, 1, [this](size_t) {
+      TaskGroup group(&executor_);
+      for (int i = 0; i < FLAGS_fanout; ++i) {
+        group.Run([this]() { Task(); });
+      }
+      group.Wait();
+    });
+  }
+
+  Env* const env_;
+  Executor executor_;
+  const std::string data_;
+  std::atomic<uint32_t> checksum_;
+  std::atomic<int> tasks_run_;
+};
+
+}  // namespace
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    int n;
+    char junk;
+    if (lsmdb::Slice(argv[i]).starts_with("--benchmarks=")) {
+      FLAGS_benchmarks = argv[i] + std::strlen("--benchmarks=");
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--tasks=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_tasks = n;
+    } else if (sscanf(argv[i], "--task_size=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_task_size = n;
+    } else if (sscanf(argv[i], "--fanout=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_fanout = n;
+    } else {
+      std::fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      std::exit(1);
+    }
+  }
+
+  lsmdb::Benchmark benchmark;
+  benchmark.Run();
+  return 0;
+}
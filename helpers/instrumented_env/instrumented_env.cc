@@ -0,0 +1,551 @@
+//
+// Created by 刘文景 on 2021/4/19.
+//
+
+#include "helpers/instrumented_env/instrumented_env.h"
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lsmdb/slice.h"
+#include "lsmdb/status.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/mutexlock.h"
+
+namespace lsmdb {
+
+void IoOpStats::Merge(const IoOpStats& other) {
+  count += other.count;
+  errors += other.errors;
+  bytes += other.bytes;
+  latency.Merge(other.latency);
+}
+
+const char* IoStats::OpName(Op op) {
+  switch (op) {
+    case kOpen:
+      return "open";
+    case kRead:
+      return "read";
+    case kWrite:
+      return "write";
+    case kFlush:
+      return "flush";
+    case kSync:
+      return "sync";
+    case kClose:
+      return "close";
+    default:
+      return "unknown";
+  }
+}
+
+const char* IoStats::FileClassName(FileClass file_class) {
+  switch (file_class) {
+    case kLog:
+      return "log";
+    case kTable:
+      return "table";
+    case kManifest:
+      return "manifest";
+    case kOther:
+      return "other";
+    default:
+      return "unknown";
+  }
+}
+
+IoStats::FileClass IoStats::ClassifyFile(const std::string& filename) {
+  const size_t separator_pos = filename.rfind('/');
+  const Slice basename =
+      separator_pos == std::string::npos
+          ? Slice(filename)
+          : Slice(filename.data() + separator_pos + 1,
+                  filename.size() - separator_pos - 1);
+  auto ends_with = [&basename](const char* suffix) {
+    const Slice s(suffix);
+    return basename.size() >= s.size() &&
+           Slice(basename.data() + basename.size() - s.size(), s.size()) == s;
+  };
+  if (basename.starts_with("MANIFEST")) {
+    return kManifest;
+  } else if (ends_with(".log")) {
+    return kLog;
+  } else if (ends_with(".ldb") || ends_with(".sst")) {
+    return kTable;
+  }
+  return kOther;
+}
+
+IoOpStats IoStats::Total(Op op) const {
+  IoOpStats total;
+  for (int c = 0; c < kNumFileClasses; ++c) {
+    total.Merge(ops[op][c]);
+  }
+  return total;
+}
+
+std::string IoStats::ToString() const {
+  std::string result;
+  char buf[200];
+  std::snprintf(buf, sizeof(buf), "%-6s %-9s %10s %8s %14s %10s %10s %10s\n",
+                "op", "class", "count", "errors", "bytes", "avg us",
+                "p99 us", "max us");
+  result.append(buf);
+  for (int o = 0; o < kNumOps; ++o) {
+    for (int c = 0; c < kNumFileClasses; ++c) {
+      const IoOpStats& stats = ops[o][c];
+      if (stats.count == 0) {
+        continue;
+      }
+      std::snprintf(buf, sizeof(buf),
+                    "%-6s %-9s %10" PRIu64 " %8" PRIu64 " %14" PRIu64
+                    " %10.1f %10.1f %10.0f\n",
+                    OpName(static_cast<Op>(o)),
+                    FileClassName(static_cast<FileClass>(c)), stats.count,
+                    stats.errors, stats.bytes, stats.latency.Average(),
+                    stats.latency.Percentile(99), stats.latency.Max());
+      result.append(buf);
+    }
+  }
+  return result;
+}
+
+namespace {
+
+class InstrumentedEnvImpl;
+
+// What the files need to know to report their operations.
+struct FileInfo {
+  FileInfo(InstrumentedEnvImpl* env, const std::string& filename)
+      : env(env),
+        filename(filename),
+        file_class(IoStats::ClassifyFile(filename)) {}
+
+  InstrumentedEnvImpl* const env;
+  const std::string filename;
+  const IoStats::FileClass file_class;
+};
+
+class InstrumentedEnvImpl final : public InstrumentedEnv {
+ public:
+  explicit InstrumentedEnvImpl(Env* base_env)
+      : InstrumentedEnv(base_env), tracing_(false), trace_file_(nullptr) {}
+
+  ~InstrumentedEnvImpl() override { EndTrace(); }
+
+  IoStats GetStats() override {
+    IoStats stats;
+    for (int o = 0; o < IoStats::kNumOps; ++o) {
+      for (int c = 0; c < IoStats::kNumFileClasses; ++c) {
+        MutexLock l(&cells_[o][c].mutex);
+        stats.ops[o][c] = cells_[o][c].stats;
+      }
+    }
+    return stats;
+  }
+
+  void ResetStats() override {
+    for (int o = 0; o < IoStats::kNumOps; ++o) {
+      for (int c = 0; c < IoStats::kNumFileClasses; ++c) {
+        MutexLock l(&cells_[o][c].mutex);
+        cells_[o][c].stats = IoOpStats();
+      }
+    }
+  }
+
+  Status StartTrace(const std::string& filename) override {
+    WritableFile* file;
+    Status status = target()->NewWritableFile(filename, &file);
+    if (!status.ok()) {
+      return status;
+    }
+    WritableFile* old_file;
+    {
+      MutexLock l(&trace_mutex_);
+      old_file = trace_file_;
+      trace_file_ = file;
+      trace_start_micros_ = NowMicros();
+      tracing_.store(true, std::memory_order_release);
+    }
+    return CloseTraceFile(old_file);
+  }
+
+  Status EndTrace() override {
+    WritableFile* file;
+    {
+      MutexLock l(&trace_mutex_);
+      file = trace_file_;
+      trace_file_ = nullptr;
+      tracing_.store(false, std::memory_order_release);
+    }
+    return CloseTraceFile(file);
+  }
+
+  Status NewSequentialFile(const std::string& filename,
+                           SequentialFile** result) override;
+  Status NewSequentialFile(const std::string& filename,
+                           const FileOptions& options,
+                           SequentialFile** result) override;
+  Status NewRandomAccessFile(const std::string& filename,
+                             RandomAccessFile** result) override;
+  Status NewRandomAccessFile(const std::string& filename,
+                             const FileOptions& options,
+                             RandomAccessFile** result) override;
+  Status NewWritableFile(const std::string& filename,
+                         WritableFile** result) override;
+  Status NewWritableFile(const std::string& filename,
+                         const FileOptions& options,
+                         WritableFile** result) override;
+  Status NewAppendableFile(const std::string& filename,
+                           WritableFile** result) override;
+  Status NewAppendableFile(const std::string& filename,
+                           const FileOptions& options,
+                           WritableFile** result) override;
+
+  Status PollReads(size_t min_completions,
+                   std::vector<ReadRequest*>* completed) override {
+    const size_t before = completed->size();
+    Status status = target()->PollReads(min_completions, completed);
+    if (completed->size() == before) {
+      return status;
+    }
+    MutexLock l(&pending_mutex_);
+    for (size_t i = before; i < completed->size(); ++i) {
+      ReadRequest* req = (*completed)[i];
+      auto iter = pending_reads_.find(req);
+      if (iter == pending_reads_.end()) {
+        continue;  // Not read through this Env.
+      }
+      const PendingRead pending = iter->second;
+      pending_reads_.erase(iter);
+      Record(IoStats::kRead, *pending.info, req->offset, req->result.size(),
+             pending.start_micros, req->status);
+    }
+    return status;
+  }
+
+  // Start measuring the asynchronous read "req" of the file "info".
+  void StartAsyncRead(const FileInfo* info, ReadRequest* req,
+                      uint64_t start_micros) {
+    MutexLock l(&pending_mutex_);
+    pending_reads_[req] = PendingRead{info, start_micros};
+  }
+
+  // Stop measuring "req", which failed to start.
+  void CancelAsyncRead(ReadRequest* req) {
+    MutexLock l(&pending_mutex_);
+    pending_reads_.erase(req);
+  }
+
+  // Account for an operation "op" on the file "info" that started at
+  // "start_micros" and transferred "bytes" at "offset".
+  void Record(IoStats::Op op, const FileInfo& info, uint64_t offset,
+              uint64_t bytes, uint64_t start_micros, const Status& status) {
+    const uint64_t now = NowMicros();
+    const uint64_t micros = now > start_micros ? now - start_micros : 0;
+    Cell& cell = cells_[op][info.file_class];
+    {
+      MutexLock l(&cell.mutex);
+      cell.stats.count++;
+      if (!status.ok()) {
+        cell.stats.errors++;
+      }
+      cell.stats.bytes += bytes;
+      cell.stats.latency.Add(static_cast<double>(micros));
+    }
+    if (tracing_.load(std::memory_order_acquire)) {
+      Trace(op, info, offset, bytes, micros, status);
+    }
+  }
+
+ private:
+  struct Cell {
+    port::Mutex mutex;
+    IoOpStats stats GUARDED_BY(mutex);
+  };
+
+  struct PendingRead {
+    const FileInfo* info;
+    uint64_t start_micros;
+  };
+
+  // Wraps the file opened by the wrapped Env, if "status" is OK.
+  template <typename Instrumented, typename File>
+  Status Wrap(const std::string& filename, uint64_t start_micros,
+              const Status& status, File** result) {
+    FileInfo info(this, filename);
+    Record(IoStats::kOpen, info, 0, 0, start_micros, status);
+    if (status.ok()) {
+      *result = new Instrumented(info, *result);
+    }
+    return status;
+  }
+
+  Status OpenAppendable(const std::string& filename, uint64_t start_micros,
+                        const Status& status, WritableFile** result);
+
+  void Trace(IoStats::Op op, const FileInfo& info, uint64_t offset,
+             uint64_t bytes, uint64_t micros, const Status& status) {
+    MutexLock l(&trace_mutex_);
+    if (trace_file_ == nullptr) {
+      return;
+    }
+    char buf[100];
+    std::snprintf(buf, sizeof(buf), "%" PRIu64 " %s %s ",
+                  NowMicros() - trace_start_micros_, IoStats::OpName(op),
+                  IoStats::FileClassName(info.file_class));
+    std::string line(buf);
+    line.append(info.filename);
+    std::snprintf(buf, sizeof(buf),
+                  " %" PRIu64 " %" PRIu64 " %" PRIu64 " %s\n", offset, bytes,
+                  micros, status.ok() ? "OK" : "error");
+    line.append(buf);
+    // Tracing is best effort.
+    trace_file_->Append(line);
+  }
+
+  static Status CloseTraceFile(WritableFile* file) {
+    if (file == nullptr) {
+      return Status::OK();
+    }
+    Status status = file->Close();
+    delete file;
+    return status;
+  }
+
+  Cell cells_[IoStats::kNumOps][IoStats::kNumFileClasses];
+
+  port::Mutex pending_mutex_;
+  std::unordered_map<ReadRequest*, PendingRead> pending_reads_
+      GUARDED_BY(pending_mutex_);
+
+  std::atomic<bool> tracing_;  // True if trace_file_ is set.
+  port::Mutex trace_mutex_;
+  WritableFile* trace_file_ GUARDED_BY(trace_mutex_);
+  uint64_t trace_start_micros_ GUARDED_BY(trace_mutex_);
+};
+
+class InstrumentedSequentialFile final : public SequentialFile {
+ public:
+  InstrumentedSequentialFile(const FileInfo& info, SequentialFile* file)
+      : info_(info), file_(file), offset_(0) {}
+
+  Status Read(size_t n, Slice* result, char* scratch) override {
+    const uint64_t start = info_.env->NowMicros();
+    Status status = file_->Read(n, result, scratch);
+    const uint64_t bytes = status.ok() ? result->size() : 0;
+    info_.env->Record(IoStats::kRead, info_, offset_, bytes, start, status);
+    offset_ += bytes;
+    return status;
+  }
+
+  Status Skip(uint64_t n) override {
+    Status status = file_->Skip(n);
+    if (status.ok()) {
+      offset_ += n;
+    }
+    return status;
+  }
+
+ private:
+  const FileInfo info_;
+  const std::unique_ptr<SequentialFile> file_;
+  uint64_t offset_;
+};
+
+class InstrumentedRandomAccessFile final : public RandomAccessFile {
+ public:
+  InstrumentedRandomAccessFile(const FileInfo& info, RandomAccessFile* file)
+      : info_(info), file_(file) {}
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override {
+    const uint64_t start = info_.env->NowMicros();
+    Status status = file_->Read(offset, n, result, scratch);
+    info_.env->Record(IoStats::kRead, info_, offset,
+                      status.ok() ? result->size() : 0, start, status);
+    return status;
+  }
+
+  Status ReadAsync(ReadRequest* req) const override {
+    // The read may finish before ReadAsync() returns.
+    info_.env->StartAsyncRead(&info_, req, info_.env->NowMicros());
+    Status status = file_->ReadAsync(req);
+    if (!status.ok()) {
+      info_.env->CancelAsyncRead(req);
+    }
+    return status;
+  }
+
+  // Every request counts as a read that took as long as the whole call.
+  Status MultiRead(ReadRequest* reqs, size_t n) const override {
+    const uint64_t start = info_.env->NowMicros();
+    Status status = file_->MultiRead(reqs, n);
+    for (size_t i = 0; status.ok() && i < n; ++i) {
+      info_.env->Record(IoStats::kRead, info_, reqs[i].offset,
+                        reqs[i].status.ok() ? reqs[i].result.size() : 0,
+                        start, reqs[i].status);
+    }
+    return status;
+  }
+
+ private:
+  const FileInfo info_;
+  const std::unique_ptr<RandomAccessFile> file_;
+};
+
+class InstrumentedWritableFile final : public WritableFile {
+ public:
+  // The file holds "size" bytes already.
+  InstrumentedWritableFile(const FileInfo& info, WritableFile* file,
+                           uint64_t size = 0)
+      : info_(info), file_(file), offset_(size) {}
+
+  Status Append(const Slice& data) override {
+    const uint64_t start = info_.env->NowMicros();
+    Status status = file_->Append(data);
+    RecordWrite(data.size(), start, status);
+    return status;
+  }
+
+  Status Append(const Slice* parts, size_t n) override {
+    const uint64_t start = info_.env->NowMicros();
+    Status status = file_->Append(parts, n);
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+      bytes += parts[i].size();
+    }
+    RecordWrite(bytes, start, status);
+    return status;
+  }
+
+  Status Close() override {
+    return Timed(IoStats::kClose, &WritableFile::Close);
+  }
+
+  Status Flush() override {
+    return Timed(IoStats::kFlush, &WritableFile::Flush);
+  }
+
+  Status Sync() override {
+    return Timed(IoStats::kSync, &WritableFile::Sync);
+  }
+
+  // The sync is timed until its callback.
+  void SyncAsync(std::function<void(const Status&)> callback) override {
+    const FileInfo info = info_;
+    const uint64_t offset = offset_;
+    const uint64_t start = info_.env->NowMicros();
+    file_->SyncAsync([info, offset, start, callback](const Status& status) {
+      info.env->Record(IoStats::kSync, info, offset, 0, start, status);
+      callback(status);
+    });
+  }
+
+ private:
+  void RecordWrite(uint64_t bytes, uint64_t start, const Status& status) {
+    info_.env->Record(IoStats::kWrite, info_, offset_, bytes, start, status);
+    offset_ += bytes;
+  }
+
+  Status Timed(IoStats::Op op, Status (WritableFile::*method)()) {
+    const uint64_t start = info_.env->NowMicros();
+    Status status = (file_.get()->*method)();
+    info_.env->Record(op, info_, offset_, 0, start, status);
+    return status;
+  }
+
+  const FileInfo info_;
+  const std::unique_ptr<WritableFile> file_;
+  uint64_t offset_;  // Bytes in the file, as far as appends are concerned.
+};
+
+Status InstrumentedEnvImpl::NewSequentialFile(const std::string& filename,
+                                              SequentialFile** result) {
+  const uint64_t start = NowMicros();
+  Status status = target()->NewSequentialFile(filename, result);
+  return Wrap<InstrumentedSequentialFile>(filename, start, status, result);
+}
+
+Status InstrumentedEnvImpl::NewSequentialFile(const std::string& filename,
+                                              const FileOptions& options,
+                                              SequentialFile** result) {
+  const uint64_t start = NowMicros();
+  Status status = target()->NewSequentialFile(filename, options, result);
+  return Wrap<InstrumentedSequentialFile>(filename, start, status, result);
+}
+
+Status InstrumentedEnvImpl::NewRandomAccessFile(const std::string& filename,
+                                                RandomAccessFile** result) {
+  const uint64_t start = NowMicros();
+  Status status = target()->NewRandomAccessFile(filename, result);
+  return Wrap<InstrumentedRandomAccessFile>(filename, start, status, result);
+}
+
+Status InstrumentedEnvImpl::NewRandomAccessFile(const std::string& filename,
+                                                const FileOptions& options,
+                                                RandomAccessFile** result) {
+  const uint64_t start = NowMicros();
+  Status status = target()->NewRandomAccessFile(filename, options, result);
+  return Wrap<InstrumentedRandomAccessFile>(filename, start, status, result);
+}
+
+Status InstrumentedEnvImpl::NewWritableFile(const std::string& filename,
+                                            WritableFile** result) {
+  const uint64_t start = NowMicros();
+  Status status = target()->NewWritableFile(filename, result);
+  return Wrap<InstrumentedWritableFile>(filename, start, status, result);
+}
+
+Status InstrumentedEnvImpl::NewWritableFile(const std::string& filename,
+                                            const FileOptions& options,
+                                            WritableFile** result) {
+  const uint64_t start = NowMicros();
+  Status status = target()->NewWritableFile(filename, options, result);
+  return Wrap<InstrumentedWritableFile>(filename, start, status, result);
+}
+
+Status InstrumentedEnvImpl::NewAppendableFile(const std::string& filename,
+                                              WritableFile** result) {
+  const uint64_t start = NowMicros();
+  Status status = target()->NewAppendableFile(filename, result);
+  return OpenAppendable(filename, start, status, result);
+}
+
+Status InstrumentedEnvImpl::NewAppendableFile(const std::string& filename,
+                                              const FileOptions& options,
+                                              WritableFile** result) {
+  const uint64_t start = NowMicros();
+  Status status = target()->NewAppendableFile(filename, options, result);
+  return OpenAppendable(filename, start, status, result);
+}
+
+Status InstrumentedEnvImpl::OpenAppendable(const std::string& filename,
+                                           uint64_t start_micros,
+                                           const Status& status,
+                                           WritableFile** result) {
+  FileInfo info(this, filename);
+  Record(IoStats::kOpen, info, 0, 0, start_micros, status);
+  if (status.ok()) {
+    // Appends continue at the end of the file.
+    uint64_t size = 0;
+    target()->GetFileSize(filename, &size);
+    *result = new InstrumentedWritableFile(info, *result, size);
+  }
+  return status;
+}
+
+}  // namespace
+
+InstrumentedEnv* NewInstrumentedEnv(Env* base_env) {
+  return new InstrumentedEnvImpl(base_env);
+}
+
+}  // namespace lsmdb
@@ -0,0 +1,99 @@
+//
+// Created by 刘文景 on 2021/4/19.
+//
+
+#ifndef STORAGE_LSMDB_HELPERS_INSTRUMENTED_ENV_INSTRUMENTED_ENV_H_
+#define STORAGE_LSMDB_HELPERS_INSTRUMENTED_ENV_INSTRUMENTED_ENV_H_
+
+#include <cstdint>
+#include <string>
+
+#include "lsmdb/env.h"
+#include "lsmdb/export.h"
+#include "util/histogram.h"
+
+namespace lsmdb {
+
+// Statistics of one kind of operation on one class of files.
+struct LSMDB_EXPORT IoOpStats {
+  void Merge(const IoOpStats& other);
+
+  uint64_t count = 0;
+  uint64_t errors = 0;  // Operations that returned a non-OK status.
+  uint64_t bytes = 0;   // Bytes read or written.
+  Histogram latency;    // Microseconds per operation.
+};
+
+// The statistics of an InstrumentedEnv, by operation and file class.
+struct LSMDB_EXPORT IoStats {
+  enum Op : int {
+    kOpen = 0,  // Opening a file, through any of the Env's New*File().
+    kRead,      // Every read of a file, including those of MultiRead().
+    kWrite,     // Every Append().
+    kFlush,
+    kSync,
+    kClose,
+    kNumOps
+  };
+
+  // Files are classified by their names: "*.log" files are logs, "*.ldb"
+  // and "*.sst" files are tables, and "MANIFEST*" files are manifests.
+  enum FileClass : int {
+    kLog = 0,
+    kTable,
+    kManifest,
+    kOther,
+    kNumFileClasses
+  };
+
+  static const char* OpName(Op op);
+  static const char* FileClassName(FileClass file_class);
+  static FileClass ClassifyFile(const std::string& filename);
+
+  // Sum of "op" over all file classes.
+  IoOpStats Total(Op op) const;
+
+  // One line per operation and file class that was used.
+  std::string ToString() const;
+
+  IoOpStats ops[kNumOps][kNumFileClasses];
+};
+
+// An Env that forwards to another Env and measures every operation on the
+// files it opens. Operations on files that were opened by other means,
+// e.g. directly on the wrapped Env, are not measured.
+//
+// Reads started with RandomAccessFile::ReadAsync() are measured until
+// PollReads() hands them back. The time spent in Sync() includes the
+// writes it flushes.
+class LSMDB_EXPORT InstrumentedEnv : public EnvWapper {
+ public:
+  explicit InstrumentedEnv(Env* target) : EnvWapper(target) {}
+
+  // Return a copy of the statistics since creation or the last
+  // ResetStats().
+  virtual IoStats GetStats() = 0;
+
+  virtual void ResetStats() = 0;
+
+  // Write a line per operation to "filename" until EndTrace(), replacing
+  // an earlier trace. Every line holds space-separated fields:
+  //   <micros since StartTrace()> <op> <file class> <file name>
+  //   <offset> <bytes> <latency micros> <OK or error>
+  // The trace file is written through the wrapped Env and is not
+  // measured itself.
+  virtual Status StartTrace(const std::string& filename) = 0;
+
+  // Stop tracing and close the trace file, if any.
+  virtual Status EndTrace() = 0;
+};
+
+// Returns a new InstrumentedEnv wrapping base_env. The caller must delete
+// the result when it is no longer needed, after deleting the files
+// opened through it. *base_env must remain live while the result is in
+// use.
+LSMDB_EXPORT InstrumentedEnv* NewInstrumentedEnv(Env* base_env);
+
+}  // namespace lsmdb
+
+#endif  // STORAGE_LSMDB_HELPERS_INSTRUMENTED_ENV_INSTRUMENTED_ENV_H_
@@ -0,0 +1,191 @@
+//
+// Created by 刘文景 on 2021/4/19.
+//
+
+#include "helpers/instrumented_env/instrumented_env.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "helpers/memenv/memenv.h"
+#include "lsmdb/env.h"
+#include "util/test_util.h"
+
+namespace lsmdb {
+
+class InstrumentedEnvTest : public testing::Test {
+ public:
+  InstrumentedEnvTest()
+      : base_env_(NewMemEnv(Env::Default())),
+        env_(NewInstrumentedEnv(base_env_.get())) {}
+
+  // Write "contents" to "filename" through env_ in appends of "chunk"
+  // bytes, with a Sync() at the end.
+  void WriteFile(const std::string& filename, const std::string& contents,
+                 size_t chunk) {
+    WritableFile* file;
+    ASSERT_LSMDB_OK(env_->NewWritableFile(filename, &file));
+    for (size_t offset = 0; offset < contents.size(); offset += chunk) {
+      ASSERT_LSMDB_OK(file->Append(contents.substr(offset, chunk)));
+    }
+    ASSERT_LSMDB_OK(file->Sync());
+    ASSERT_LSMDB_OK(file->Close());
+    delete file;
+  }
+
+  const std::unique_ptr<Env> base_env_;
+  const std::unique_ptr<InstrumentedEnv> env_;
+};
+
+TEST_F(InstrumentedEnvTest, ClassifyFile) {
+  ASSERT_EQ(IoStats::kLog, IoStats::ClassifyFile("/db/000012.log"));
+  ASSERT_EQ(IoStats::kTable, IoStats::ClassifyFile("/db/000013.ldb"));
+  ASSERT_EQ(IoStats::kTable, IoStats::ClassifyFile("000014.sst"));
+  ASSERT_EQ(IoStats::kManifest, IoStats::ClassifyFile("/db/MANIFEST-000002"));
+  ASSERT_EQ(IoStats::kOther, IoStats::ClassifyFile("/db/CURRENT"));
+  ASSERT_EQ(IoStats::kOther, IoStats::ClassifyFile("/db.log/LOG"));
+}
+
+TEST_F(InstrumentedEnvTest, Stats) {
+  ASSERT_LSMDB_OK(env_->CreateDir("/db"));
+  WriteFile("/db/000005.log", std::string(1000, 'l'), 100);
+  WriteFile("/db/000006.ldb", std::string(5000, 't'), 1000);
+
+  // Sequential and random reads of the table, and a failed open.
+  SequentialFile* seq_file;
+  ASSERT_LSMDB_OK(env_->NewSequentialFile("/db/000006.ldb", &seq_file));
+  std::string scratch(4096, '\0');
+  Slice result;
+  ASSERT_LSMDB_OK(seq_file->Read(4096, &result, &scratch[0]));
+  ASSERT_LSMDB_OK(seq_file->Read(4096, &result, &scratch[0]));
+  delete seq_file;
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile("/db/000006.ldb", &file));
+  ASSERT_LSMDB_OK(file->Read(100, 200, &result, &scratch[0]));
+  ReadRequest reqs[2];
+  reqs[0].offset = 0;
+  reqs[0].n = 10;
+  reqs[0].scratch = &scratch[0];
+  reqs[1].offset = 4990;
+  reqs[1].n = 100;
+  reqs[1].scratch = &scratch[100];
+  ASSERT_LSMDB_OK(file->MultiRead(reqs, 2));
+  ASSERT_LSMDB_OK(file->ReadAsync(&reqs[0]));
+  std::vector<ReadRequest*> completed;
+  ASSERT_LSMDB_OK(env_->PollReads(1, &completed));
+  ASSERT_EQ(1, completed.size());
+  delete file;
+  ASSERT_TRUE(!env_->NewRandomAccessFile("/db/000007.ldb", &file).ok());
+
+  IoStats stats = env_->GetStats();
+  const IoOpStats& log_writes = stats.ops[IoStats::kWrite][IoStats::kLog];
+  ASSERT_EQ(10, log_writes.count);
+  ASSERT_EQ(1000, log_writes.bytes);
+  ASSERT_EQ(10, log_writes.latency.Num());
+  ASSERT_EQ(1, stats.ops[IoStats::kSync][IoStats::kLog].count);
+  ASSERT_EQ(1, stats.ops[IoStats::kClose][IoStats::kLog].count);
+  ASSERT_EQ(1, stats.ops[IoStats::kOpen][IoStats::kLog].count);
+  ASSERT_EQ(5000, stats.ops[IoStats::kWrite][IoStats::kTable].bytes);
+
+  const IoOpStats& table_reads = stats.ops[IoStats::kRead][IoStats::kTable];
+  ASSERT_EQ(6, table_reads.count);
+  ASSERT_EQ(5000 + 200 + 10 + 10 + 10, table_reads.bytes);
+  const IoOpStats& table_opens = stats.ops[IoStats::kOpen][IoStats::kTable];
+  ASSERT_EQ(4, table_opens.count);
+  ASSERT_EQ(1, table_opens.errors);
+  ASSERT_EQ(0, stats.Total(IoStats::kRead).errors);
+  ASSERT_EQ(6, stats.Total(IoStats::kRead).count);
+  ASSERT_NE(std::string::npos, stats.ToString().find("table"));
+
+  env_->ResetStats();
+  stats = env_->GetStats();
+  for (int op = 0; op < IoStats::kNumOps; ++op) {
+    ASSERT_EQ(0, stats.Total(static_cast<IoStats::Op>(op)).count);
+  }
+}
+
+TEST_F(InstrumentedEnvTest, AppendableFile) {
+  WriteFile("/000001.log", "abc", 3);
+  WritableFile* file;
+  ASSERT_LSMDB_OK(env_->NewAppendableFile("/000001.log", &file));
+  const Slice parts[] = {"de", "fgh"};
+  ASSERT_LSMDB_OK(file->Append(parts, 2));
+  ASSERT_LSMDB_OK(file->Flush());
+  ASSERT_LSMDB_OK(file->Close());
+  delete file;
+
+  std::string contents;
+  ASSERT_LSMDB_OK(ReadFileToString(env_.get(), "/000001.log", &contents));
+  ASSERT_EQ("abcdefgh", contents);
+  const IoStats stats = env_->GetStats();
+  ASSERT_EQ(2, stats.ops[IoStats::kWrite][IoStats::kLog].count);
+  ASSERT_EQ(8, stats.ops[IoStats::kWrite][IoStats::kLog].bytes);
+  ASSERT_EQ(1, stats.ops[IoStats::kFlush][IoStats::kLog].count);
+  // ReadFileToString() reads until it reaches the end of the file.
+  ASSERT_EQ(2, stats.ops[IoStats::kRead][IoStats::kLog].count);
+  ASSERT_EQ(8, stats.ops[IoStats::kRead][IoStats::kLog].bytes);
+}
+
+TEST_F(InstrumentedEnvTest, SyncAsync) {
+  WritableFile* file;
+  ASSERT_LSMDB_OK(env_->NewWritableFile("/MANIFEST-000001", &file));
+  ASSERT_LSMDB_OK(file->Append("abc"));
+  int callbacks = 0;
+  file->SyncAsync([&callbacks](const Status& status) {
+    ASSERT_LSMDB_OK(status);
+    callbacks++;
+  });
+  ASSERT_LSMDB_OK(file->Close());
+  delete file;
+
+  ASSERT_EQ(1, callbacks);
+  const IoStats stats = env_->GetStats();
+  ASSERT_EQ(1, stats.ops[IoStats::kSync][IoStats::kManifest].count);
+}
+
+TEST_F(InstrumentedEnvTest, Trace) {
+  ASSERT_LSMDB_OK(env_->StartTrace("/trace"));
+  WriteFile("/MANIFEST-000001", "0123456789", 4);
+  ASSERT_LSMDB_OK(env_->EndTrace());
+  // Not traced anymore.
+  WriteFile("/000002.log", "x", 1);
+
+  std::string trace;
+  ASSERT_LSMDB_OK(ReadFileToString(base_env_.get(), "/trace", &trace));
+  std::vector<std::string> lines;
+  size_t start = 0;
+  for (size_t end; (end = trace.find('\n', start)) != std::string::npos;
+       start = end + 1) {
+    lines.push_back(trace.substr(start, end - start));
+  }
+  ASSERT_EQ(start, trace.size());
+  // An open, three appends, a sync and a close.
+  ASSERT_EQ(6, lines.size());
+  char op[20];
+  char file_class[20];
+  char filename[100];
+  unsigned long long micros, offset, bytes, latency;
+  char ok[10];
+  ASSERT_EQ(8, std::sscanf(lines[2].c_str(), "%llu %19s %19s %99s %llu %llu "
+                                             "%llu %9s",
+                           &micros, op, file_class, filename, &offset, &bytes,
+                           &latency, ok));
+  ASSERT_EQ(std::string("write"), op);
+  ASSERT_EQ(std::string("manifest"), file_class);
+  ASSERT_EQ(std::string("/MANIFEST-000001"), filename);
+  ASSERT_EQ(4, offset);
+  ASSERT_EQ(4, bytes);
+  ASSERT_EQ(std::string("OK"), ok);
+  ASSERT_NE(std::string::npos,
+            lines[0].find(" open manifest /MANIFEST-000001 0 0 "));
+  ASSERT_NE(std::string::npos, lines[5].find(" close manifest "));
+}
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
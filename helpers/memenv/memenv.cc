@@ -4,6 +4,7 @@
 
 #include "helpers/memenv/memenv.h"
 
+#include <algorithm>
 #include <cstring>
 #include <limits>
 #include <map>
@@ -80,30 +81,42 @@ class FileState : public noncopyable {
     }
 
     assert(offset / kBlockSize <= std::numeric_limits<size_t>::max());
-    // Find which block is the start block to read.
-    auto block = static_cast<size_t>(offset / kBlockSize);
-    // Get the start offset of the start block.
-    size_t block_offset = offset % kBlockSize;
-    size_t bytes_to_copy = n;
-    char* dst = scratch;
-
-    while (bytes_to_copy > 0) {
-      size_t avail = kBlockSize - block_offset;
-      if (avail > bytes_to_copy) {
-        avail = bytes_to_copy;
-      }
-      std::memcpy(dst, blocks_[block] + block_offset, avail);
-
-      bytes_to_copy -= avail;
-      dst += avail;
-      block++;
-      block_offset = 0;
-    }
-
+    // Find which block is the start block to read, and the start offset
+    // within it.
+    CopyOut(static_cast<size_t>(offset / kBlockSize), offset % kBlockSize, n,
+            scratch);
     *result = Slice(scratch, n);
     return Status::OK();
   }
 
+  // Like Read() for every request, but ranges that lie within one block
+  // are not copied, their results point into the block. The blocks stay
+  // put until the file is truncated.
+  void MultiRead(ReadRequest* reqs, size_t n) const {
+    MutexLock lock(&blocks_mutex_);
+    for (size_t i = 0; i < n; ++i) {
+      ReadRequest& req = reqs[i];
+      if (req.offset > size_) {
+        req.result = Slice();
+        req.status = Status::IOError("Offset greater than file size");
+        continue;
+      }
+      const size_t len = static_cast<size_t>(
+          std::min<uint64_t>(req.n, size_ - req.offset));
+      const size_t block = static_cast<size_t>(req.offset / kBlockSize);
+      const size_t block_offset = req.offset % kBlockSize;
+      req.status = Status::OK();
+      if (len == 0) {
+        req.result = Slice();
+      } else if (block_offset + len <= kBlockSize) {
+        req.result = Slice(blocks_[block] + block_offset, len);
+      } else {
+        CopyOut(block, block_offset, len, req.scratch);
+        req.result = Slice(req.scratch, len);
+      }
+    }
+  }
+
   Status Append(const Slice& data) {
     const char* src = data.data();
     size_t src_len = data.size();
@@ -140,6 +153,23 @@ class FileState : public noncopyable {
   // Private since only Unref() should be used to delete it.
   ~FileState() { Truncate(); }
 
+  // Copy "n" bytes starting at "block_offset" of blocks_[block] to "dst".
+  void CopyOut(size_t block, size_t block_offset, size_t n, char* dst) const
+      EXCLUSIVE_LOCKS_REQUIRED(blocks_mutex_) {
+    while (n > 0) {
+      size_t avail = kBlockSize - block_offset;
+      if (avail > n) {
+        avail = n;
+      }
+      std::memcpy(dst, blocks_[block] + block_offset, avail);
+
+      n -= avail;
+      dst += avail;
+      block++;
+      block_offset = 0;
+    }
+  }
+
   port::Mutex refs_mutex_;
   int refs_ GUARDED_BY(refs_mutex_);
 
@@ -192,6 +222,11 @@ class RandomAccessFileImpl : public RandomAccessFile {
     return file_->Read(offset, n, result, scratch);
   }
 
+  Status MultiRead(ReadRequest* reqs, size_t n) const override {
+    file_->MultiRead(reqs, n);
+    return Status::OK();
+  }
+
  private:
   FileState* file_;
 };
@@ -202,6 +237,7 @@ class WritableFileImpl : public WritableFile {
 
   ~WritableFileImpl() override { file_->Unref(); }
 
+  using WritableFile::Append;
   Status Append(const Slice& data) override { return file_->Append(data); }
 
   Status Close() override { return Status::OK(); }
@@ -254,6 +290,31 @@ class InMemoryEnv : public EnvWapper {
     return Status::OK();
   }
 
+  Status NewRandomAccessFile(const std::string& filename,
+                             const FileOptions& options,
+                             RandomAccessFile** result) override {
+    return NewRandomAccessFile(filename, result);
+  }
+
+  // There is no page cache to bypass, so the options do not matter.
+  Status NewSequentialFile(const std::string& filename,
+                           const FileOptions& options,
+                           SequentialFile** result) override {
+    return NewSequentialFile(filename, result);
+  }
+
+  Status NewWritableFile(const std::string& filename,
+                         const FileOptions& options,
+                         WritableFile** result) override {
+    return NewWritableFile(filename, result);
+  }
+
+  Status NewAppendableFile(const std::string& filename,
+                           const FileOptions& options,
+                           WritableFile** result) override {
+    return NewAppendableFile(filename, result);
+  }
+
   Status NewWritableFile(const std::string& filename,
                          WritableFile** result) override {
     MutexLock lock(&mutex_);
@@ -356,6 +417,9 @@ class InMemoryEnv : public EnvWapper {
     return Status::OK();
   }
 
+  // Nothing in memory survives a crash anyway.
+  Status SyncDir(const std::string& dirname) override { return Status::OK(); }
+
   Status LockFile(const std::string& fname, FileLock** lock) override {
     *lock = new FileLock;
     return Status::OK();
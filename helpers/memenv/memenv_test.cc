@@ -194,6 +194,41 @@ TEST_F(MemEnvTest, LargeWrite) {
   delete[] scratch;
 }
 
+TEST_F(MemEnvTest, MultiRead) {
+  std::string data;
+  for (int i = 0; i < 20000; ++i) {
+    data.append(1, static_cast<char>(i));
+  }
+  ASSERT_LSMDB_OK(WriteStringToFile(env_, data, "/dir/f"));
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile("/dir/f", &file));
+
+  // Offsets within one block, across blocks, near the end and past it.
+  const uint64_t kOffsets[] = {10, 8000, 19990, 20001};
+  const size_t kSizes[] = {100, 1000, 100, 10};
+  ReadRequest reqs[4];
+  std::vector<std::string> scratch(4);
+  for (int i = 0; i < 4; ++i) {
+    reqs[i].offset = kOffsets[i];
+    reqs[i].n = kSizes[i];
+    scratch[i].resize(kSizes[i]);
+    reqs[i].scratch = &scratch[i][0];
+  }
+  ASSERT_LSMDB_OK(file->MultiRead(reqs, 4));
+
+  ASSERT_LSMDB_OK(reqs[0].status);
+  ASSERT_EQ(data.substr(10, 100), reqs[0].result.ToString());
+  // Served from the file's memory, not copied.
+  ASSERT_NE(reqs[0].scratch, reqs[0].result.data());
+  ASSERT_LSMDB_OK(reqs[1].status);
+  ASSERT_EQ(data.substr(8000, 1000), reqs[1].result.ToString());
+  ASSERT_LSMDB_OK(reqs[2].status);
+  ASSERT_EQ(data.substr(19990), reqs[2].result.ToString());
+  ASSERT_TRUE(reqs[3].status.IsIOError());
+
+  delete file;
+}
+
 TEST_F(MemEnvTest, OverwriteOpenFile) {
   const char kWrite1Data[] = "Write #1 data";
   const size_t kFileDataLen = sizeof(kWrite1Data) - 1;
@@ -0,0 +1,278 @@
+//
+// Created by 刘文景 on 2021/4/19.
+//
+
+#include "helpers/shaping_env/shaping_env.h"
+
+#include <cmath>
+#include <memory>
+#include <string>
+
+#include "lsmdb/env.h"
+#include "lsmdb/rate_limiter.h"
+#include "lsmdb/slice.h"
+#include "lsmdb/status.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+
+namespace lsmdb {
+
+namespace {
+
+// Computes and applies the delays of a ShapingEnv. Thread-safe.
+class Shaper {
+ public:
+  Shaper(Env* env, const ShapingEnvOptions& options)
+      : env_(env),
+        options_(options),
+        start_micros_(env->NowMicros()),
+        rnd_(options.seed) {
+    read_limiter_ = NewLimiter(options.read_bytes_per_second);
+    write_limiter_ = NewLimiter(options.write_bytes_per_second);
+  }
+
+  void Open() { Delay(options_.open_latency); }
+
+  void Read(uint64_t bytes) {
+    Delay(options_.read_latency);
+    if (read_limiter_ != nullptr && bytes > 0) {
+      read_limiter_->Request(bytes, RateLimiter::kLow);
+    }
+  }
+
+  void Write(uint64_t bytes) {
+    Delay(options_.write_latency);
+    if (write_limiter_ != nullptr && bytes > 0) {
+      write_limiter_->Request(bytes, RateLimiter::kLow);
+    }
+  }
+
+  void Sync() {
+    Delay(options_.sync_latency);
+    const uint64_t period = options_.sync_stall_period_micros;
+    if (period == 0 || options_.sync_stall_micros == 0) {
+      return;
+    }
+    const uint64_t phase = (env_->NowMicros() - start_micros_) % period;
+    if (phase < options_.sync_stall_micros) {
+      env_->SleepForMicroseconds(
+          static_cast<int>(options_.sync_stall_micros - phase));
+    }
+  }
+
+ private:
+  static std::shared_ptr<RateLimiter> NewLimiter(uint64_t bytes_per_second) {
+    if (bytes_per_second == 0) {
+      return nullptr;
+    }
+    RateLimiterOptions options;
+    options.bytes_per_second = bytes_per_second;
+    // Short periods keep small transfers from waiting for a whole refill.
+    options.refill_period_micros = 10 * 1000;
+    return NewRateLimiter(options);
+  }
+
+  void Delay(const LatencyDistribution& latency) {
+    uint64_t micros = latency.fixed_micros;
+    if (latency.mean_jitter_micros > 0 || latency.spike_probability > 0) {
+      MutexLock l(&mutex_);
+      if (latency.mean_jitter_micros > 0) {
+        // Next() is uniform in (0, 1) once scaled.
+        const double u = rnd_.Next() / 2147483647.0;
+        micros += static_cast<uint64_t>(-std::log(u) *
+                                        latency.mean_jitter_micros);
+      }
+      if (latency.spike_probability > 0 &&
+          rnd_.Next() / 2147483647.0 < latency.spike_probability) {
+        micros += latency.spike_micros;
+      }
+    }
+    if (micros > 0) {
+      env_->SleepForMicroseconds(static_cast<int>(micros));
+    }
+  }
+
+  Env* const env_;
+  const ShapingEnvOptions options_;
+  const uint64_t start_micros_;  // Start of the first sync stall period.
+  std::shared_ptr<RateLimiter> read_limiter_;   // nullptr if uncapped.
+  std::shared_ptr<RateLimiter> write_limiter_;  // nullptr if uncapped.
+
+  port::Mutex mutex_;
+  Random rnd_ GUARDED_BY(mutex_);
+};
+
+class ShapingSequentialFile final : public SequentialFile {
+ public:
+  ShapingSequentialFile(Shaper* shaper, SequentialFile* file)
+      : shaper_(shaper), file_(file) {}
+
+  Status Read(size_t n, Slice* result, char* scratch) override {
+    Status status = file_->Read(n, result, scratch);
+    shaper_->Read(status.ok() ? result->size() : 0);
+    return status;
+  }
+
+  Status Skip(uint64_t n) override { return file_->Skip(n); }
+
+ private:
+  Shaper* const shaper_;
+  const std::unique_ptr<SequentialFile> file_;
+};
+
+class ShapingRandomAccessFile final : public RandomAccessFile {
+ public:
+  ShapingRandomAccessFile(Shaper* shaper, RandomAccessFile* file)
+      : shaper_(shaper), file_(file) {}
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override {
+    Status status = file_->Read(offset, n, result, scratch);
+    shaper_->Read(status.ok() ? result->size() : 0);
+    return status;
+  }
+
+  // The default implementations go through Read(), so every read is
+  // delayed on its own.
+  Status ReadAsync(ReadRequest* req) const override {
+    return RandomAccessFile::ReadAsync(req);
+  }
+
+  Status MultiRead(ReadRequest* reqs, size_t n) const override {
+    return RandomAccessFile::MultiRead(reqs, n);
+  }
+
+ private:
+  Shaper* const shaper_;
+  const std::unique_ptr<RandomAccessFile> file_;
+};
+
+class ShapingWritableFile final : public WritableFile {
+ public:
+  ShapingWritableFile(Shaper* shaper, WritableFile* file)
+      : shaper_(shaper), file_(file) {}
+
+  Status Append(const Slice& data) override {
+    shaper_->Write(data.size());
+    return file_->Append(data);
+  }
+
+  Status Append(const Slice* parts, size_t n) override {
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+      bytes += parts[i].size();
+    }
+    shaper_->Write(bytes);
+    return file_->Append(parts, n);
+  }
+
+  Status Close() override { return file_->Close(); }
+
+  Status Flush() override { return file_->Flush(); }
+
+  Status Sync() override {
+    shaper_->Sync();
+    return file_->Sync();
+  }
+
+  // The delay is taken on the thread running the callbacks, so that the
+  // caller does not wait for it either.
+  void SyncAsync(std::function<void(const Status&)> callback) override {
+    Shaper* const shaper = shaper_;
+    file_->SyncAsync([shaper, callback](const Status& status) {
+      shaper->Sync();
+      callback(status);
+    });
+  }
+
+ private:
+  Shaper* const shaper_;
+  const std::unique_ptr<WritableFile> file_;
+};
+
+class ShapingEnv final : public EnvWapper {
+ public:
+  ShapingEnv(Env* base_env, const ShapingEnvOptions& options)
+      : EnvWapper(base_env), shaper_(base_env, options) {}
+
+  Status NewSequentialFile(const std::string& filename,
+                           SequentialFile** result) override {
+    shaper_.Open();
+    return Wrap<ShapingSequentialFile>(
+        target()->NewSequentialFile(filename, result), result);
+  }
+
+  Status NewSequentialFile(const std::string& filename,
+                           const FileOptions& options,
+                           SequentialFile** result) override {
+    shaper_.Open();
+    return Wrap<ShapingSequentialFile>(
+        target()->NewSequentialFile(filename, options, result), result);
+  }
+
+  Status NewRandomAccessFile(const std::string& filename,
+                             RandomAccessFile** result) override {
+    shaper_.Open();
+    return Wrap<ShapingRandomAccessFile>(
+        target()->NewRandomAccessFile(filename, result), result);
+  }
+
+  Status NewRandomAccessFile(const std::string& filename,
+                             const FileOptions& options,
+                             RandomAccessFile** result) override {
+    shaper_.Open();
+    return Wrap<ShapingRandomAccessFile>(
+        target()->NewRandomAccessFile(filename, options, result), result);
+  }
+
+  Status NewWritableFile(const std::string& filename,
+                         WritableFile** result) override {
+    shaper_.Open();
+    return Wrap<ShapingWritableFile>(
+        target()->NewWritableFile(filename, result), result);
+  }
+
+  Status NewWritableFile(const std::string& filename,
+                         const FileOptions& options,
+                         WritableFile** result) override {
+    shaper_.Open();
+    return Wrap<ShapingWritableFile>(
+        target()->NewWritableFile(filename, options, result), result);
+  }
+
+  Status NewAppendableFile(const std::string& filename,
+                           WritableFile** result) override {
+    shaper_.Open();
+    return Wrap<ShapingWritableFile>(
+        target()->NewAppendableFile(filename, result), result);
+  }
+
+  Status NewAppendableFile(const std::string& filename,
+                           const FileOptions& options,
+                           WritableFile** result) override {
+    shaper_.Open();
+    return Wrap<ShapingWritableFile>(
+        target()->NewAppendableFile(filename, options, result), result);
+  }
+
+ private:
+  template <typename Shaping, typename File>
+  Status Wrap(const Status& status, File** result) {
+    if (status.ok()) {
+      *result = new Shaping(&shaper_, *result);
+    }
+    return status;
+  }
+
+  Shaper shaper_;
+};
+
+}  // namespace
+
+Env* NewShapingEnv(Env* base_env, const ShapingEnvOptions& options) {
+  return new ShapingEnv(base_env, options);
+}
+
+}  // namespace lsmdb
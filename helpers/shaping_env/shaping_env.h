@@ -0,0 +1,61 @@
+//
+// Created by 刘文景 on 2021/4/19.
+//
+
+#ifndef STORAGE_LSMDB_HELPERS_SHAPING_ENV_SHAPING_ENV_H_
+#define STORAGE_LSMDB_HELPERS_SHAPING_ENV_SHAPING_ENV_H_
+
+#include <cstdint>
+
+#include "lsmdb/export.h"
+
+namespace lsmdb {
+
+class Env;
+
+// The delay added to every operation of one kind: "fixed_micros", plus
+// an exponentially distributed delay with a mean of "mean_jitter_micros",
+// plus "spike_micros" with a probability of "spike_probability". Spikes
+// model the rare stalls that make up the tail of real disk latencies.
+struct LSMDB_EXPORT LatencyDistribution {
+  uint64_t fixed_micros = 0;
+  uint64_t mean_jitter_micros = 0;
+  double spike_probability = 0;
+  uint64_t spike_micros = 0;
+};
+
+struct LSMDB_EXPORT ShapingEnvOptions {
+  // Delays of opening a file, of every read, of every Append() and of
+  // every Sync(). Reads include those of MultiRead() and ReadAsync().
+  LatencyDistribution open_latency;
+  LatencyDistribution read_latency;
+  LatencyDistribution write_latency;
+  LatencyDistribution sync_latency;
+
+  // Caps on the bytes read and appended per second, shared by all files
+  // of the Env. 0 leaves the bandwidth uncapped.
+  uint64_t read_bytes_per_second = 0;
+  uint64_t write_bytes_per_second = 0;
+
+  // Every "sync_stall_period_micros", starting when the Env is created,
+  // syncs stall for "sync_stall_micros", like during the periodic cache
+  // flushes or journal commits of a drive. A Sync() issued during a stall
+  // waits for its end. 0 disables the stalls.
+  uint64_t sync_stall_period_micros = 0;
+  uint64_t sync_stall_micros = 0;
+
+  // Seed of the random delays.
+  uint32_t seed = 301;
+};
+
+// Returns a new environment that delays the file operations of base_env
+// as configured by "options", and forwards everything else unchanged.
+// Asynchronous reads complete synchronously. The caller must delete the
+// result when it is no longer needed. *base_env must remain live while
+// the result is in use.
+LSMDB_EXPORT Env* NewShapingEnv(Env* base_env,
+                                const ShapingEnvOptions& options);
+
+}  // namespace lsmdb
+
+#endif  // STORAGE_LSMDB_HELPERS_SHAPING_ENV_SHAPING_ENV_H_
@@ -0,0 +1,123 @@
+//
+// Created by 刘文景 on 2021/4/19.
+//
+
+#include "helpers/shaping_env/shaping_env.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "helpers/memenv/memenv.h"
+#include "lsmdb/env.h"
+#include "util/test_util.h"
+
+namespace lsmdb {
+
+class ShapingEnvTest : public testing::Test {
+ public:
+  ShapingEnvTest() : base_env_(NewMemEnv(Env::Default())) {}
+
+  void NewEnv(const ShapingEnvOptions& options) {
+    env_.reset(NewShapingEnv(base_env_.get(), options));
+  }
+
+  // Return the microseconds it takes to write "size" bytes to "filename"
+  // in appends of "chunk" bytes, with a Sync() at the end.
+  uint64_t TimeWrite(const std::string& filename, size_t size,
+                     size_t chunk) {
+    const uint64_t start = Env::Default()->NowMicros();
+    WritableFile* file;
+    EXPECT_LSMDB_OK(env_->NewWritableFile(filename, &file));
+    const std::string data(chunk, 'x');
+    for (size_t written = 0; written < size; written += chunk) {
+      EXPECT_LSMDB_OK(file->Append(data));
+    }
+    EXPECT_LSMDB_OK(file->Sync());
+    EXPECT_LSMDB_OK(file->Close());
+    delete file;
+    return Env::Default()->NowMicros() - start;
+  }
+
+  const std::unique_ptr<Env> base_env_;
+  std::unique_ptr<Env> env_;
+};
+
+TEST_F(ShapingEnvTest, FixedLatency) {
+  ShapingEnvOptions options;
+  options.read_latency.fixed_micros = 2000;
+  NewEnv(options);
+  ASSERT_LSMDB_OK(WriteStringToFile(env_.get(), "0123456789", "/f"));
+
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile("/f", &file));
+  std::string scratch(10, '\0');
+  const uint64_t start = env_->NowMicros();
+  Slice result;
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_LSMDB_OK(file->Read(i, 5, &result, &scratch[0]));
+    ASSERT_EQ(std::string("0123456789").substr(i, 5), result.ToString());
+  }
+  // Reads through MultiRead() and ReadAsync() are delayed too.
+  ReadRequest reqs[5];
+  for (int i = 0; i < 5; ++i) {
+    reqs[i].offset = i;
+    reqs[i].n = 1;
+    reqs[i].scratch = &scratch[i];
+  }
+  ASSERT_LSMDB_OK(file->MultiRead(reqs, 5));
+  ASSERT_LSMDB_OK(file->ReadAsync(&reqs[0]));
+  std::vector<ReadRequest*> completed;
+  ASSERT_LSMDB_OK(env_->PollReads(1, &completed));
+  ASSERT_EQ(1, completed.size());
+  ASSERT_EQ("0", completed[0]->result.ToString());
+  ASSERT_LE(11 * 2000, env_->NowMicros() - start);
+  delete file;
+
+  // Writes are not delayed.
+  ASSERT_GT(10 * 1000, TimeWrite("/g", 100, 1));
+}
+
+TEST_F(ShapingEnvTest, Jitter) {
+  ShapingEnvOptions options;
+  options.write_latency.mean_jitter_micros = 1000;
+  options.write_latency.spike_probability = 0.1;
+  options.write_latency.spike_micros = 1000;
+  NewEnv(options);
+  // 100 appends take 100ms on average, plus about 10ms of spikes.
+  const uint64_t micros = TimeWrite("/f", 100, 1);
+  ASSERT_LE(40 * 1000, micros);
+  ASSERT_GE(500 * 1000, micros);
+}
+
+TEST_F(ShapingEnvTest, Bandwidth) {
+  ShapingEnvOptions options;
+  options.write_bytes_per_second = 1 << 20;
+  NewEnv(options);
+  // 200KB at 1MB/s, less the first refill that is granted right away.
+  const uint64_t micros = TimeWrite("/f", 200 << 10, 4096);
+  ASSERT_LE(150 * 1000, micros);
+  ASSERT_GE(1000 * 1000, micros);
+  std::string contents;
+  ASSERT_LSMDB_OK(ReadFileToString(env_.get(), "/f", &contents));
+  ASSERT_EQ(200 << 10, contents.size());
+}
+
+TEST_F(ShapingEnvTest, SyncStalls) {
+  ShapingEnvOptions options;
+  options.sync_stall_period_micros = 10 * 1000 * 1000;
+  options.sync_stall_micros = 100 * 1000;
+  NewEnv(options);
+  // The first stall starts with the Env.
+  ASSERT_LE(90 * 1000, TimeWrite("/f", 1, 1));
+  // The stall is over.
+  ASSERT_GT(50 * 1000, TimeWrite("/g", 1, 1));
+}
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
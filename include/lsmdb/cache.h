@@ -8,19 +8,29 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 #include <util/noncopyable.h>
 
 #include "lsmdb/slice.h"
+#include "lsmdb/status.h"
 
 namespace lsmdb {
 
 class Cache;
+class SecondaryCache;
 
 // Create a new cache with a fixed size capacity.
 // This implementation of Cache uses a
 // least-recently-used eviction policy.
 std::shared_ptr<Cache> NewLRUCache(size_t capacity);
 
+// Like NewLRUCache(capacity), but entries inserted with an ItemHelper
+// are moved to "secondary_cache" when they are evicted, and looked up
+// there when they are missing from the cache.
+std::shared_ptr<Cache> NewLRUCache(
+    size_t capacity, std::shared_ptr<SecondaryCache> secondary_cache);
+
 class Cache : public noncopyable {
  public:
   Cache() = default;
@@ -32,6 +42,18 @@ class Cache : public noncopyable {
   // Opaque handle to an entry stored in the cache.
   struct Handle {};
 
+  // Callbacks that allow an entry to be serialized into a secondary
+  // cache when it is evicted and to be rebuilt when it is found there.
+  struct ItemHelper {
+    // Append a serialized form of "value" to *dst.
+    std::function<void(void* value, std::string* dst)> save;
+    // Create a value from data produced by "save" and store its charge
+    // in *charge. Returns nullptr if "data" can not be decoded.
+    std::function<void*(const Slice& data, size_t* charge)> create;
+    // Same as the deleter passed to Insert().
+    std::function<void(const Slice& key, void* value)> deleter;
+  };
+
   // Insert a mapping from key->value into the cache and assign it
   // the specified charge against the total cache capacity.
   //
@@ -41,10 +63,32 @@ class Cache : public noncopyable {
   //
   // When the inserted entry is no longer needed, the key and
   // value will be passed to "deleter".
+  //
+  // If the cache has a strict capacity limit and the entry does not fit
+  // (see SetStrictCapacityLimit()), nothing is inserted, the key and
+  // value are passed to "deleter" right away and nullptr is returned.
   virtual Handle* Insert(
       const Slice& key, void* value, size_t charge,
       std::function<void(const Slice& key, void* value)> deleter) = 0;
 
+  // Like Insert() above, but "helper->deleter" is used as the deleter,
+  // and if the entry is evicted to make room for other entries it is
+  // saved into the secondary cache, if any.
+  /// REQUIRES: helper must outlive the cache.
+  //
+  // The default implementation ignores the secondary cache.
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         const ItemHelper* helper);
+
+  // Like the Insert() methods above, but store the handle in *handle and
+  // return an Incomplete status instead of nullptr if the entry does not
+  // fit under a strict capacity limit.
+  Status TryInsert(const Slice& key, void* value, size_t charge,
+                   std::function<void(const Slice& key, void* value)> deleter,
+                   Handle** handle);
+  Status TryInsert(const Slice& key, void* value, size_t charge,
+                   const ItemHelper* helper, Handle** handle);
+
   // If the cache has no mapping for "key", return nullptr.
   //
   /// Else return a handle that corresponds to the mapping. The caller
@@ -52,6 +96,13 @@ class Cache : public noncopyable {
   /// longer needed.
   virtual Handle* Lookup(const Slice& key) = 0;
 
+  // Like Lookup() above, but on a miss "key" is looked up in the
+  // secondary cache. If it is found there, the value is rebuilt with
+  // "helper->create" and inserted into this cache.
+  //
+  // The default implementation ignores the secondary cache.
+  virtual Handle* Lookup(const Slice& key, const ItemHelper* helper);
+
   // Release a mapping returned by a previous Lookup().
   /// REQUIRES: handle must not have been released yet.
   /// REQUIRES: handle must have been returned by a method on *this.
@@ -85,6 +136,52 @@ class Cache : public noncopyable {
   // stored in the cache.
   virtual size_t TotalCharge() const = 0;
 
+  // Return the combined charges of the entries that are currently
+  // referenced by clients and therefore can not be evicted. The rest of
+  // TotalCharge() is evictable.
+  //
+  // The default implementation returns 0.
+  virtual size_t GetPinnedCharge() const;
+
+  // By default usage may exceed the capacity while entries are pinned.
+  // With a strict limit, an insertion that would leave the usage above
+  // the capacity after evicting every unpinned entry fails instead.
+  // The limit is enforced per shard, so an insertion may fail while the
+  // cache as a whole is slightly below its capacity.
+  //
+  // The default implementation ignores the setting.
+  virtual void SetStrictCapacityLimit(bool strict);
+  virtual bool HasStrictCapacityLimit() const;
+
+  // Set the quota of the client whose keys start with the fixed64
+  // encoding of "id" (see NewId()). Once the combined charge of its
+  // entries exceeds "capacity", the client's own least recently used
+  // entries are evicted first. While the combined charge is at most
+  // "reserved", its entries are not evicted to make room for others.
+  // A "capacity" of 0 means no limit. Entries inserted before the
+  // first call for "id" are not accounted to the client.
+  //
+  // The default implementation ignores quotas.
+  virtual void SetClientQuota(uint64_t id, size_t capacity, size_t reserved);
+
+  // Remove the quota of the client "id", e.g. when the database using it
+  // is closed. Its entries stay in the cache, accounted to no client.
+  //
+  // The default implementation does nothing.
+  virtual void RemoveClientQuota(uint64_t id);
+
+  // Return the combined charge of the entries of the client "id", or 0
+  // if no quota was set for it.
+  virtual size_t GetClientCharge(uint64_t id) const;
+
+  // Store in *keys the keys of up to "max_keys" entries of the cache,
+  // most recently used first. Entries currently referenced by clients
+  // count as the most recently used ones.
+  //
+  // The default implementation stores no keys.
+  virtual void GetKeysByRecency(size_t max_keys,
+                                std::vector<std::string>* keys) const;
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
@@ -0,0 +1,63 @@
+//
+// Created by 刘文景 on 2021/4/14.
+//
+// Helpers to carry the contents of a Cache across restarts. Before
+// shutting down, DumpCacheKeys() writes the keys of the hottest entries
+// to a file. After starting up, StartCacheWarmup() reloads them in the
+// background so that the cache quickly reaches its usual hit rate.
+
+#ifndef STORAGE_LSMDB_INCLUDE_CACHE_WARMUP_H_
+#define STORAGE_LSMDB_INCLUDE_CACHE_WARMUP_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lsmdb/export.h"
+#include "lsmdb/slice.h"
+#include "lsmdb/status.h"
+
+namespace lsmdb {
+
+class Cache;
+class Env;
+
+// Write the keys of up to "max_keys" entries of "cache" to "fname",
+// most recently used first. The file is replaced atomically.
+LSMDB_EXPORT Status DumpCacheKeys(Env* env, const Cache* cache,
+                                  size_t max_keys, const std::string& fname);
+
+// Read the keys written by DumpCacheKeys() into *keys, in the same order.
+LSMDB_EXPORT Status ReadCacheKeys(Env* env, const std::string& fname,
+                                  std::vector<std::string>* keys);
+
+// Reads the value of "key" from the underlying storage and inserts it
+// into the cache. Stores the number of bytes read in *bytes_read.
+using CacheLoader =
+    std::function<Status(const Slice& key, uint64_t* bytes_read)>;
+
+struct LSMDB_EXPORT CacheWarmupOptions {
+  // Maximum number of bytes the loader may read per second, so that
+  // warming up does not starve foreground reads. 0 means no limit.
+  uint64_t bytes_per_second = 0;
+
+  // If set, called from the background thread when warming up ends,
+  // with the first error encountered or OK. That is the error reading
+  // "fname" if there was one, else the first error of the loader.
+  std::function<void(const Status&)> done;
+};
+
+// Start a background thread that reads the keys dumped in "fname" and
+// calls "loader" for every key missing from "cache", hottest first.
+// Keys the loader fails on are skipped, and the warm-up goes on with the
+// next key. "env" must outlive the warm-up.
+LSMDB_EXPORT void StartCacheWarmup(Env* env, std::shared_ptr<Cache> cache,
+                                   const std::string& fname,
+                                   const CacheWarmupOptions& options,
+                                   CacheLoader loader);
+
+}  // namespace lsmdb
+
+#endif  // STORAGE_LSMDB_INCLUDE_CACHE_WARMUP_H_
@@ -5,6 +5,7 @@
 #ifndef STORAGE_LSMDB_INCLUDE_ENV_H_
 #define STORAGE_LSMDB_INCLUDE_ENV_H_
 
+#include <climits>
 #include <cstdarg>
 #include <cstdint>
 #include <functional>
@@ -12,6 +13,8 @@
 #include <vector>
 
 #include "lsmdb/export.h"
+#include "lsmdb/rate_limiter.h"
+#include "lsmdb/slice.h"
 #include "lsmdb/status.h"
 #include "util/noncopyable.h"
 
@@ -39,11 +42,167 @@ class FileLock;
 class Logger;
 class RandomAccessFile;
 class SequentialFile;
-class Slice;
 class WritableFile;
 
+// Options for opening a file. An Env ignores the options it does not
+// support.
+struct LSMDB_EXPORT FileOptions {
+  // NewRandomAccessFile() may memory-map the file.
+  bool allow_mmap_reads = true;
+
+  // Read or write the file with direct I/O (O_DIRECT), bypassing the
+  // operating system's page cache. The Env aligns buffers, offsets and
+  // sizes as needed. Opening a file fails with a NotSupported status if
+  // the platform or the file system does not support direct I/O.
+  bool use_direct_reads = false;
+  bool use_direct_writes = false;
+
+  // NewSequentialFile() reads the file in chunks of this many bytes and
+  // serves smaller reads from a buffer, while the operating system reads
+  // the next chunk ahead. 0 reads exactly what is asked for.
+  size_t readahead_size = 0;
+
+  // NewSequentialFile() drops the pages it has read from the operating
+  // system's page cache, so that a scan does not evict more useful data.
+  bool drop_consumed_pages = false;
+
+  // NewWritableFile() and NewAppendableFile() buffer small appends in
+  // memory of this size, rounded up to a multiple of 4KB, and write them
+  // once the buffer is full. Larger buffers mean fewer, larger writes,
+  // smaller ones save memory when many files are open.
+  size_t writable_file_buffer_size = 65536;
+
+  // NewWritableFile() and NewAppendableFile() start writing back the
+  // file's data in the background whenever this many bytes were written
+  // since the last time, so that Sync() has little left to flush and
+  // does not cause one large burst of I/O. 0 leaves writeback to Sync()
+  // and the operating system.
+  uint64_t bytes_per_sync = 0;
+
+  // NewWritableFile() and NewAppendableFile() allocate the file's disk
+  // space ahead of the writes in steps of this many bytes, which keeps
+  // the file contiguous and saves metadata updates on Sync(). Close()
+  // releases the space past the end of the file. Set it to the expected
+  // size of the file if it is known. 0 disables preallocation.
+  uint64_t preallocation_block_size = 0;
+
+  // NewWritableFile() and NewAppendableFile() charge every write against
+  // this limiter before issuing it, at "rate_limiter_priority", and report
+  // the latencies of writes and syncs to it. Must outlive the file.
+  RateLimiter* rate_limiter = nullptr;
+  RateLimiter::Priority rate_limiter_priority = RateLimiter::kLow;
+
+  // NewWritableFile() and NewAppendableFile() write the file through a
+  // memory mapping that is grown ahead of the appends, so that small
+  // appends need no system call. Until the file is closed, it reads as
+  // zeros past the appended data. bytes_per_sync, preallocation and rate
+  // limiting do not apply to such files, and direct I/O takes precedence.
+  bool use_mmap_writes = false;
+
+  // NewRandomAccessFile() advises the operating system about a mapped
+  // file: mmap_advise_random disables readahead, so that small random
+  // reads do not pull in the pages around them, and mmap_advise_willneed
+  // starts reading the whole file in ahead of the first reads.
+  bool mmap_advise_random = false;
+  bool mmap_advise_willneed = false;
+};
+
+// A read of "n" bytes at "offset" of a RandomAccessFile into "scratch",
+// which must have room for "n" bytes. "result" and "status" are set
+// once the read finished.
+struct LSMDB_EXPORT ReadRequest {
+  uint64_t offset = 0;
+  size_t n = 0;
+  char* scratch = nullptr;
+  Slice result;
+  Status status;
+};
+
+// Configuration of one of the background thread pools of an Env.
+struct LSMDB_EXPORT ThreadPoolOptions {
+  // Number of threads running the work of the pool.
+  int threads = 1;
+
+  // The nice value that leaves the threads at the one of the process.
+  enum : int { kInheritNice = INT_MIN };
+
+  // CPUs the threads may run on. If empty, the threads keep the CPUs the
+  // process may run on, e.g. as set by taskset. Ignored where threads can
+  // not be pinned to CPUs.
+  std::vector<int> cpus;
+
+  // Nice value of the threads. Positive values let the work of the pool
+  // yield to foreground threads. Ignored where threads can not have their
+  // own nice value.
+  int nice = kInheritNice;
+};
+
+struct LSMDB_EXPORT ThreadPoolStats {
+  int threads = 0;
+  uint64_t scheduled = 0;
+  uint64_t run = 0;
+  uint64_t unscheduled = 0;
+  // Work items waiting for a thread, now and at most so far.
+  uint64_t queue_length = 0;
+  uint64_t max_queue_length = 0;
+  // Time the work items that started running spent in the queue.
+  uint64_t total_wait_micros = 0;
+  uint64_t max_wait_micros = 0;
+};
+
+// How an Env chooses between mapping random access files and reading
+// them with pread(). Files are mapped only if FileOptions allow it, and
+// within a limit on their number.
+struct LSMDB_EXPORT MmapOptions {
+  // Bytes of files mapped at once. 0 leaves only the limit on the number
+  // of files.
+  uint64_t budget_bytes = 0;
+
+  // Larger files are never mapped. 0 maps files of any size.
+  uint64_t max_file_size = 0;
+
+  // Move files opened from now on between mmap and pread() at runtime. A
+  // file read with pread() is checked every few hundred reads and mapped
+  // if the budget allows, or if some mapped file is read much less often
+  // and can be unmapped to make room. Since a mapping may go away, reads
+  // of mapped files copy into the caller's scratch.
+  bool adaptive = false;
+};
+
+struct LSMDB_EXPORT MmapStats {
+  int mapped_files = 0;
+  uint64_t mapped_bytes = 0;
+  // Files mapped and unmapped at runtime by MmapOptions::adaptive.
+  uint64_t promotions = 0;
+  uint64_t demotions = 0;
+};
+
+// Counters of the descriptors an Env keeps open for the random access
+// files that did not get a descriptor of their own.
+struct LSMDB_EXPORT FdCacheStats {
+  // Descriptors the cache may keep open, and keeps open now.
+  int capacity = 0;
+  int open_fds = 0;
+  // Reads that found the descriptor of their file open.
+  uint64_t hits = 0;
+  // Reads that reopened their file.
+  uint64_t misses = 0;
+  // Descriptors closed to make room for another file.
+  uint64_t evictions = 0;
+  // Reads that opened and closed their file themselves because every
+  // descriptor of the cache was in use.
+  uint64_t uncached = 0;
+};
+
 class LSMDB_EXPORT Env : public noncopyable {
  public:
+  // The background thread pools, e.g. kHigh for flushes and kLow for
+  // compactions.
+  enum Priority : int {
+    kLow = 0,
+    kHigh = 1,
+  };
+
   Env();
 
   virtual ~Env();
@@ -63,6 +222,13 @@ class LSMDB_EXPORT Env : public noncopyable {
   virtual Status NewSequentialFile(const std::string& filename,
                                    SequentialFile** result) = 0;
 
+  // Like NewSequentialFile() above, but honors "options".
+  //
+  // The default implementation ignores "options".
+  virtual Status NewSequentialFile(const std::string& filename,
+                                   const FileOptions& options,
+                                   SequentialFile** result);
+
   // Create an object supporting random-access reads from the file with the
   // specified name. On success, stores a pointer to the new file in *result
   // and returns OK. On failure stores nullptr in *result and returns non-OK.
@@ -73,6 +239,13 @@ class LSMDB_EXPORT Env : public noncopyable {
   virtual Status NewRandomAccessFile(const std::string& filename,
                                      RandomAccessFile** result) = 0;
 
+  // Like NewRandomAccessFile() above, but honors "options".
+  //
+  // The default implementation ignores "options".
+  virtual Status NewRandomAccessFile(const std::string& filename,
+                                     const FileOptions& options,
+                                     RandomAccessFile** result);
+
   // Create an object that writes to a new file with the specified name.
   // Deletes any existing file with the same name and creates a new file.
   // On success, stores a pointer to the new file in *result and returns
@@ -82,6 +255,13 @@ class LSMDB_EXPORT Env : public noncopyable {
   virtual Status NewWritableFile(const std::string& filename,
                                  WritableFile** result) = 0;
 
+  // Like NewWritableFile() above, but honors "options".
+  //
+  // The default implementation ignores "options".
+  virtual Status NewWritableFile(const std::string& filename,
+                                 const FileOptions& options,
+                                 WritableFile** result);
+
   // Create an object that either appends to an existing file, or
   // writes to a new file (if the file does not exist to begin with).
   // On success, stores a pointer to the new file in *result and
@@ -97,6 +277,13 @@ class LSMDB_EXPORT Env : public noncopyable {
   virtual Status NewAppendableFile(const std::string& filename,
                                    WritableFile** result);
 
+  // Like NewAppendableFile() above, but honors "options".
+  //
+  // The default implementation ignores "options".
+  virtual Status NewAppendableFile(const std::string& filename,
+                                   const FileOptions& options,
+                                   WritableFile** result);
+
   // Returns true iff the named file exists.
   virtual bool FileExists(const std::string& filename) = 0;
 
@@ -124,6 +311,12 @@ class LSMDB_EXPORT Env : public noncopyable {
   virtual Status RenameFile(const std::string& src,
                             const std::string& target) = 0;
 
+  // Make the entries of directory "dirname" durable: the files created,
+  // renamed or removed in it survive a crash once this returns OK.
+  //
+  // The default implementation returns a NotSupported status.
+  virtual Status SyncDir(const std::string& dirname);
+
   // Lock the specified file. Used to prevent concurrent access to
   // the same db by multiple processes. On failure, stores nullptr
   // in *lock and returns non-OK.
@@ -154,6 +347,49 @@ class LSMDB_EXPORT Env : public noncopyable {
   // serialized.
   virtual void Schedule(std::function<void(void*)> func, void* arg) = 0;
 
+  // Like Schedule() above, but runs "function(arg)" in the thread pool of
+  // "priority". Work items scheduled with a non-null "tag" can be
+  // removed from the queue by Unschedule() until they start.
+  //
+  // The default implementation ignores "priority" and "tag".
+  virtual void Schedule(std::function<void(void*)> func, void* arg,
+                        Priority priority, void* tag = nullptr);
+
+  // Remove the work items scheduled with "tag" in the thread pool of
+  // "priority" that have not started yet, and return their number.
+  //
+  // The default implementation removes nothing.
+  virtual int Unschedule(void* tag, Priority priority);
+
+  // Change the configuration of the thread pool of "priority". Threads
+  // are added or retired as needed.
+  //
+  // The default implementation does nothing.
+  virtual void SetThreadPoolOptions(Priority priority,
+                                    const ThreadPoolOptions& options);
+
+  // Return a snapshot of the counters of the thread pool of "priority".
+  //
+  // The default implementation returns empty stats.
+  virtual ThreadPoolStats GetThreadPoolStats(Priority priority);
+
+  // Change how random access files are mapped. Files that are already
+  // mapped stay mapped, even if they do not fit a smaller budget.
+  //
+  // The default implementation does nothing.
+  virtual void SetMmapOptions(const MmapOptions& options);
+
+  // Return a snapshot of the counters of the mapped random access files.
+  //
+  // The default implementation returns empty stats.
+  virtual MmapStats GetMmapStats();
+
+  // Return a snapshot of the counters of the descriptors kept open for
+  // random access files.
+  //
+  // The default implementation returns empty stats.
+  virtual FdCacheStats GetFdCacheStats();
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(std::function<void(void*)> func, void* arg) = 0;
@@ -173,6 +409,17 @@ class LSMDB_EXPORT Env : public noncopyable {
 
   // Sleep/delay of the thread for the prescribed number of micro-seconds.
   virtual void SleepForMicroseconds(int micros) = 0;
+
+  // Wait until at least "min_completions" of the reads that the calling
+  // thread started with RandomAccessFile::ReadAsync() have finished, or
+  // all of them if fewer are outstanding, and append every finished
+  // request to *completed. Returns non-OK only if waiting itself failed;
+  // the outcome of each read is in its "status".
+  //
+  // The default implementation returns the reads that were performed
+  // synchronously by the default RandomAccessFile::ReadAsync().
+  virtual Status PollReads(size_t min_completions,
+                           std::vector<ReadRequest*>* completed);
 };
 
 // A file abstraction for reading sequentially through a file
@@ -218,6 +465,28 @@ class LSMDB_EXPORT RandomAccessFile : public noncopyable{
   /// Safe for concurrent use by multiple threads.
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
+
+  // Start reading "req" and return without waiting for the data. The
+  // read finishes in a later Env::PollReads() on the same thread, which
+  // hands "req" back with its "result" and "status" set. A thread may
+  // have many reads outstanding. Returns non-OK, and does not hand "req"
+  // back, if the read could not be started.
+  //
+  /// REQUIRES: *req and this file stay alive until req is handed back.
+  //
+  // The default implementation reads synchronously.
+  virtual Status ReadAsync(ReadRequest* req) const;
+
+  // Read every request of reqs[0, n-1] and set its "result" and
+  // "status". The requests may be served in any order and in parallel,
+  // and neighbouring ranges may be read at once. Returns non-OK only if
+  // the requests could not be issued; the outcome of each read is in its
+  // "status".
+  //
+  /// Safe for concurrent use by multiple threads.
+  //
+  // The default implementation calls Read() for every request.
+  virtual Status MultiRead(ReadRequest* reqs, size_t n) const;
 };
 
 // A file abstraction for sequential writing. The implementation
@@ -230,9 +499,26 @@ class LSMDB_EXPORT WritableFile : public noncopyable {
   virtual ~WritableFile();
 
   virtual Status Append(const Slice& data) = 0;
+
+  // Append the concatenation of parts[0, n-1], e.g. a record's header
+  // and its body, without the caller copying them together first.
+  //
+  // The default implementation appends the parts one by one.
+  virtual Status Append(const Slice* parts, size_t n);
+
   virtual Status Close() = 0;
   virtual Status Flush() = 0;
   virtual Status Sync() = 0;
+
+  // Like Sync(), but without waiting for the data to become durable:
+  // "callback" is called with the outcome once it is, possibly on
+  // another thread and possibly before SyncAsync() returns. The caller
+  // may append meanwhile, and pipeline the next batch of writes with the
+  // sync of the previous one. Callbacks of a file run in the order of the
+  // calls, and must not close the file. Close() waits for them.
+  //
+  // The default implementation calls Sync() and then "callback".
+  virtual void SyncAsync(std::function<void(const Status&)> callback);
 };
 
 // An interface for writing log messages.
@@ -285,16 +571,32 @@ public:
   Status NewSequentialFile(const std::string& f, SequentialFile** r) override {
     return target_->NewSequentialFile(f, r);
   }
+  Status NewSequentialFile(const std::string& f, const FileOptions& o,
+                           SequentialFile** r) override {
+    return target_->NewSequentialFile(f, o, r);
+  }
   Status NewRandomAccessFile(const std::string& f,
                              RandomAccessFile** r) override {
     return target_->NewRandomAccessFile(f, r);
   }
+  Status NewRandomAccessFile(const std::string& f, const FileOptions& o,
+                             RandomAccessFile** r) override {
+    return target_->NewRandomAccessFile(f, o, r);
+  }
   Status NewWritableFile(const std::string& f, WritableFile** r) override {
     return target_->NewWritableFile(f, r);
   }
+  Status NewWritableFile(const std::string& f, const FileOptions& o,
+                         WritableFile** r) override {
+    return target_->NewWritableFile(f, o, r);
+  }
   Status NewAppendableFile(const std::string& f, WritableFile** r) override {
     return target_->NewAppendableFile(f, r);
   }
+  Status NewAppendableFile(const std::string& f, const FileOptions& o,
+                           WritableFile** r) override {
+    return target_->NewAppendableFile(f, o, r);
+  }
   bool FileExists(const std::string& f) override {
     return target_->FileExists(f);
   }
@@ -317,6 +619,9 @@ public:
   Status RenameFile(const std::string& s, const std::string& t) override {
     return target_->RenameFile(s, t);
   }
+  Status SyncDir(const std::string& d) override {
+    return target_->SyncDir(d);
+  }
   Status LockFile(const std::string& f, FileLock** l) override {
     return target_->LockFile(f, l);
   }
@@ -324,6 +629,26 @@ public:
   void Schedule(std::function<void (void*)> f, void* a) override {
     return target_->Schedule(f, a);
   }
+  void Schedule(std::function<void(void*)> f, void* a, Priority p,
+                void* tag = nullptr) override {
+    return target_->Schedule(f, a, p, tag);
+  }
+  int Unschedule(void* tag, Priority p) override {
+    return target_->Unschedule(tag, p);
+  }
+  void SetThreadPoolOptions(Priority p, const ThreadPoolOptions& o) override {
+    target_->SetThreadPoolOptions(p, o);
+  }
+  ThreadPoolStats GetThreadPoolStats(Priority p) override {
+    return target_->GetThreadPoolStats(p);
+  }
+  void SetMmapOptions(const MmapOptions& o) override {
+    target_->SetMmapOptions(o);
+  }
+  MmapStats GetMmapStats() override { return target_->GetMmapStats(); }
+  FdCacheStats GetFdCacheStats() override {
+    return target_->GetFdCacheStats();
+  }
   void StartThread(std::function<void (void*)> f, void* a) override {
     return target_->StartThread(f, a);
   }
@@ -337,6 +662,9 @@ public:
   void SleepForMicroseconds(int micros) override {
     target_->SleepForMicroseconds(micros);
   }
+  Status PollReads(size_t n, std::vector<ReadRequest*>* r) override {
+    return target_->PollReads(n, r);
+  }
 
 private:
   Env* target_;
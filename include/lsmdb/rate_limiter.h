@@ -0,0 +1,87 @@
+//
+// Created by 刘文景 on 2021/4/17.
+//
+// A RateLimiter bounds the bandwidth of the I/O charged against it, so that
+// background writes leave room on the device for foreground reads. Files
+// opened with FileOptions::rate_limiter charge every write before issuing
+// it.
+
+#ifndef STORAGE_LSMDB_INCLUDE_RATE_LIMITER_H_
+#define STORAGE_LSMDB_INCLUDE_RATE_LIMITER_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "lsmdb/export.h"
+#include "util/noncopyable.h"
+
+namespace lsmdb {
+
+struct LSMDB_EXPORT RateLimiterStats {
+  // Indexed by RateLimiter::Priority.
+  uint64_t requests[2] = {0, 0};
+  uint64_t bytes[2] = {0, 0};
+  // Requests that had to wait, and how long they waited in total.
+  uint64_t throttled_requests[2] = {0, 0};
+  uint64_t throttled_micros[2] = {0, 0};
+};
+
+class LSMDB_EXPORT RateLimiter : public noncopyable {
+ public:
+  enum Priority : int {
+    kLow = 0,
+    kHigh = 1,
+  };
+
+  RateLimiter() = default;
+
+  virtual ~RateLimiter();
+
+  // Block until "bytes" may be transferred at "priority". Requests larger
+  // than a refill period's worth of bytes are granted over several
+  // periods.
+  virtual void Request(uint64_t bytes, Priority priority) = 0;
+
+  // Report the latency of an I/O operation that was charged against this
+  // limiter. Only used if the limiter is auto-tuned.
+  virtual void RecordLatency(uint64_t micros) = 0;
+
+  // Change the maximum rate. An auto-tuned limiter restarts from it.
+  virtual void SetBytesPerSecond(int64_t bytes_per_second) = 0;
+
+  // Return the current rate, which an auto-tuned limiter keeps adjusting.
+  virtual int64_t GetBytesPerSecond() const = 0;
+
+  // Return a snapshot of the counters of this limiter.
+  virtual RateLimiterStats GetStats() const = 0;
+};
+
+struct LSMDB_EXPORT RateLimiterOptions {
+  // Maximum rate of the requests, in bytes per second.
+  int64_t bytes_per_second = 64 << 20;
+
+  // Bytes are granted every refill period. Shorter periods make the rate
+  // smoother but wake up waiting threads more often.
+  int64_t refill_period_micros = 100 * 1000;
+
+  // High-priority requests are served first, except on one refill out of
+  // "fairness", which serves the low-priority ones first so that they can
+  // not starve.
+  int32_t fairness = 10;
+
+  // Adjust the rate between 5% and 100% of bytes_per_second so that the
+  // average latency reported through RecordLatency() stays around
+  // target_latency_micros. The rate is lowered when the latency is above
+  // the target and raised when it is below half of it and requests had
+  // to wait.
+  bool auto_tuned = false;
+  uint64_t target_latency_micros = 10 * 1000;
+};
+
+// Create a token-bucket rate limiter.
+LSMDB_EXPORT std::shared_ptr<RateLimiter> NewRateLimiter(
+    const RateLimiterOptions& options);
+
+}  // namespace lsmdb
+
+#endif  // STORAGE_LSMDB_INCLUDE_RATE_LIMITER_H_
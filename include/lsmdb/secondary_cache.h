@@ -0,0 +1,103 @@
+//
+// Created by 刘文景 on 2021/4/12.
+//
+// A SecondaryCache sits below a Cache created by NewLRUCache(). Entries
+// evicted from the primary cache are handed to it in serialized form, and
+// primary misses are served from it before going to the underlying storage.
+
+#ifndef STORAGE_LSMDB_INCLUDE_SECONDARY_CACHE_H_
+#define STORAGE_LSMDB_INCLUDE_SECONDARY_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "lsmdb/export.h"
+#include "lsmdb/slice.h"
+#include "lsmdb/status.h"
+#include "util/noncopyable.h"
+
+namespace lsmdb {
+
+class Env;
+
+struct LSMDB_EXPORT SecondaryCacheStats {
+  uint64_t inserts = 0;
+  uint64_t lookups = 0;
+  uint64_t hits = 0;
+  // Bytes handed to Insert() and bytes actually kept after encoding.
+  uint64_t bytes_inserted = 0;
+  uint64_t bytes_stored = 0;
+  // Time spent encoding in Insert() and decoding in Lookup().
+  uint64_t insert_micros = 0;
+  uint64_t lookup_micros = 0;
+
+  double HitRatio() const {
+    return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+  }
+};
+
+class LSMDB_EXPORT SecondaryCache : public noncopyable {
+ public:
+  SecondaryCache() = default;
+
+  virtual ~SecondaryCache();
+
+  // Store a copy of "data" under "key", replacing any existing entry.
+  virtual Status Insert(const Slice& key, const Slice& data) = 0;
+
+  // If the cache has an entry for "key", store its data in *data,
+  // remove the entry and return true. The entry is removed because
+  // the caller is expected to promote it back to the primary cache.
+  virtual bool Lookup(const Slice& key, std::string* data) = 0;
+
+  // If the cache contains entry for key, erase it.
+  virtual void Erase(const Slice& key) = 0;
+
+  // Return an estimate of the combined charges of all stored entries.
+  virtual size_t TotalCharge() const = 0;
+
+  // Return a snapshot of the counters of this cache.
+  virtual SecondaryCacheStats GetStats() const = 0;
+};
+
+// Create a secondary cache that keeps entries in memory, compressed with
+// snappy when it is available, up to "capacity" compressed bytes.
+LSMDB_EXPORT std::shared_ptr<SecondaryCache> NewCompressedSecondaryCache(
+    size_t capacity);
+
+struct LSMDB_EXPORT PersistentCacheOptions {
+  // Env used to read and write the cache files. Must be set and must
+  // outlive the cache.
+  Env* env = nullptr;
+
+  // Directory holding the cache files. It is created if missing, and
+  // files left there by a previous instance are reused.
+  std::string path;
+
+  // Maximum number of bytes kept in the cache files. The oldest file
+  // is deleted when a new one would exceed this limit.
+  uint64_t capacity = 1024 * 1024 * 1024;
+
+  // Size at which the file being appended to is closed and a new one
+  // is started. The contents of the file being appended to are also
+  // kept in memory, so this bounds the memory used for writing.
+  size_t file_size = 4 * 1024 * 1024;
+};
+
+// Create a secondary cache that appends entries to files under
+// "options.path" and keeps only an index of them in memory. The index
+// is rebuilt from the existing files, so entries survive restarts, and
+// Erase() appends a tombstone so that erased entries stay erased.
+// Because entries are found by key alone, a key must name the same data
+// in every process that opens "options.path". Keys built from
+// Cache::NewId() do not qualify: ids restart at 1 in each process, so a
+// recovered entry would be served for another key's data.
+// On success stores the cache in *result and returns OK.
+LSMDB_EXPORT Status NewPersistentSecondaryCache(
+    const PersistentCacheOptions& options,
+    std::shared_ptr<SecondaryCache>* result);
+
+}  // namespace lsmdb
+
+#endif  // STORAGE_LSMDB_INCLUDE_SECONDARY_CACHE_H_
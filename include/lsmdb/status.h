@@ -49,6 +49,10 @@ class LSMDB_EXPORT Status {
     return Status(kIOError, msg, msg2);
   }
 
+  static Status Incomplete(const Slice& msg, const Slice& msg2 = Slice()) {
+    return Status(kIncomplete, msg, msg2);
+  }
+
   // Returns true iff the status indicates success.
   bool ok() const { return (state_ == nullptr); }
 
@@ -67,6 +71,9 @@ class LSMDB_EXPORT Status {
   // Returns true iff the status indicates a InvalidArgument.
   bool IsInvalidArgument() const { return code() == kInvalidArgument; }
 
+  // Returns true iff the status indicates an Incomplete error.
+  bool IsIncomplete() const { return code() == kIncomplete; }
+
   // Returns a string representation of this status suitable for printing.
   // Returns the string "OK" for success.
   std::string ToString() const;
@@ -78,7 +85,8 @@ class LSMDB_EXPORT Status {
     kCorruption = 2,
     kNotSupported = 3,
     kInvalidArgument = 4,
-    kIOError = 5
+    kIOError = 5,
+    kIncomplete = 6
   };
 
   Code code() const {
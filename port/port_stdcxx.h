@@ -30,6 +30,7 @@
 #endif  // HAVE_SNAPPY
 
 #include <cassert>
+#include <chrono>  // NOLINT
 #include <condition_variable>  // NOLINT
 #include <cstddef>
 #include <cstdint>
@@ -70,6 +71,16 @@ public:
         cv_.wait(lock);
         lock.release();
     }
+    // Like Wait(), but gives up after "micros" microseconds. Returns true
+    // if the wait timed out.
+    bool TimedWait(uint64_t micros) {
+        std::unique_lock<std::mutex> lock(mu_->mu_, std::adopt_lock);
+        const bool timed_out =
+            cv_.wait_for(lock, std::chrono::microseconds(micros)) ==
+            std::cv_status::timeout;
+        lock.release();
+        return timed_out;
+    }
     void Signal() { cv_.notify_one(); }
     void SignalAll() { cv_.notify_all(); }
 
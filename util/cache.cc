@@ -5,13 +5,20 @@
 #include "lsmdb/cache.h"
 
 #include <port/port.h>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <set>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "lsmdb/secondary_cache.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
+#include "util/coding.h"
 #include "util/hash.h"
 #include "util/mutexlock.h"
 
@@ -19,6 +26,50 @@ namespace lsmdb {
 
 Cache::~Cache() {}
 
+Cache::Handle* Cache::Insert(const Slice& key, void* value, size_t charge,
+                             const ItemHelper* helper) {
+  return Insert(key, value, charge, helper->deleter);
+}
+
+Cache::Handle* Cache::Lookup(const Slice& key, const ItemHelper* helper) {
+  return Lookup(key);
+}
+
+void Cache::SetClientQuota(uint64_t id, size_t capacity, size_t reserved) {}
+
+void Cache::RemoveClientQuota(uint64_t id) {}
+
+size_t Cache::GetClientCharge(uint64_t id) const { return 0; }
+
+Status Cache::TryInsert(
+    const Slice& key, void* value, size_t charge,
+    std::function<void(const Slice& key, void* value)> deleter,
+    Handle** handle) {
+  *handle = Insert(key, value, charge, std::move(deleter));
+  return *handle != nullptr ? Status::OK()
+                            : Status::Incomplete("cache is full", key);
+}
+
+Status Cache::TryInsert(const Slice& key, void* value, size_t charge,
+                        const ItemHelper* helper, Handle** handle) {
+  *handle = Insert(key, value, charge, helper);
+  return *handle != nullptr ? Status::OK()
+                            : Status::Incomplete("cache is full", key);
+}
+
+size_t Cache::GetPinnedCharge() const { return 0; }
+
+void Cache::SetStrictCapacityLimit(bool strict) {}
+
+bool Cache::HasStrictCapacityLimit() const { return false; }
+
+void Cache::GetKeysByRecency(size_t max_keys,
+                             std::vector<std::string>* keys) const {
+  keys->clear();
+}
+
+SecondaryCache::~SecondaryCache() {}
+
 namespace {
 
 // LRU cache implementation
@@ -37,6 +88,9 @@ namespace {
 //   the check, elements that would be otherwise be on this list could be left
 //   as disconnected singleton lists.
 // - LRU: contains the items not currently referenced by clients, in LRU order
+//   Items of a client with a quota are kept on an LRU list of that client
+//   instead, so that eviction does not have to walk past items protected by
+//   the client's reservation. LRUHandle::lru_seq orders items across lists.
 //   Elements are moved between these lists by the Ref() and Unref() methods,
 //   when they detect an element in the cache acquiring or losing its only
 //   external reference.
@@ -47,10 +101,14 @@ struct LRUHandle {
   LRUHandle()
       : value(nullptr),
         deleter(nullptr),
-        next_hash(nullptr),
+        helper(nullptr),
+        client(nullptr),
+        client_next(nullptr),
+        client_prev(nullptr),
         next(nullptr),
         prev(nullptr),
         charge(0),
+        lru_seq(0),
         key_length(0),
         in_cache(false),
         refs(0),
@@ -63,13 +121,19 @@ struct LRUHandle {
   void* value;
   // 回调函数
   std::function<void(const Slice&, void* value)> deleter;
-  //
-  LRUHandle* next_hash;
+  // 非空时表示被淘汰时需要保存到secondary cache中
+  const Cache::ItemHelper* helper;
+  // 非空时表示该handle属于一个设置了quota的client
+  struct ClientQuota* client;
+  // Links of the client's list, only used when client != nullptr.
+  LRUHandle* client_next;
+  LRUHandle* client_prev;
   //
   LRUHandle* next;
   //
   LRUHandle* prev;
   size_t charge;
+  uint64_t lru_seq;   // Order in which entries were last put on an LRU list
   size_t key_length;  // Length of key
   bool in_cache;      // Whether entry is in the cache
   uint32_t refs;      // References, including cache reference, if present
@@ -86,96 +150,263 @@ struct LRUHandle {
 };
 
 // 这里使用了自己封装的简单的hashtable，在一些场景下性能比自带的实现更好
+//
+// HandleTable is an open-addressing hash table with linear probing. Every
+// slot keeps the 32-bit hash next to the handle pointer, so a probe can skip
+// non-matching slots (and reject most misses) without dereferencing any
+// LRUHandle; on 64-bit platforms four slots share one cache line.
+//
+// Removed slots are turned into tombstones so probe sequences running through
+// them stay intact. Growing does not rehash the whole table at once: a new
+// slot array is allocated and the old array is drained a few slots at a time
+// by the following Insert() and Remove() calls. While such a migration is in
+// progress every key lives in exactly one of the two arrays.
 class HandleTable {
  public:
-  HandleTable() : length_(0), elems_(0), table_(nullptr) { Resize(); }
-  ~HandleTable() { delete[] table_; }
+  HandleTable() : migrate_pos_(0), elems_(0) { current_.Allocate(kMinLength); }
+  ~HandleTable() {
+    current_.Free();
+    previous_.Free();
+  }
 
   LRUHandle* Lookup(const Slice& key, uint32_t hash) {
-    return *FindPointer(key, hash);
+    Slot* slot = current_.Find(key, hash);
+    if (slot == nullptr && previous_.slots != nullptr) {
+      slot = previous_.Find(key, hash);
+    }
+    return slot == nullptr ? nullptr : slot->handle;
   }
 
   LRUHandle* Insert(LRUHandle* h) {
-    auto ptr = FindPointer(h->key(), h->hash);
-    auto old = *ptr;
-    // 我们只需要修改一下h->next_hash使其指向old->next_hash
-    // 原先list_里面指向old的上一个handle(prev->next_hash)
-    // 在我们进行*ptr = h会指向h
-    h->next_hash = (old == nullptr) ? nullptr : old->next_hash;
-    // use h to replace old
-    *ptr = h;
+    MigrateSome();
+    Slot* slot = current_.Find(h->key(), h->hash);
+    if (slot != nullptr) {
+      // use h to replace old in place.
+      LRUHandle* old = slot->handle;
+      slot->handle = h;
+      return old;
+    }
+
+    LRUHandle* old = nullptr;
+    if (previous_.slots != nullptr) {
+      slot = previous_.Find(h->key(), h->hash);
+      if (slot != nullptr) {
+        // The old entry has not been migrated yet, drop it from the old
+        // array and put h into the new one.
+        old = slot->handle;
+        previous_.Erase(slot);
+      }
+    }
     if (old == nullptr) {
       ++elems_;
-      if (elems_ > length_) {
-        // Since each cache entry is fairly large, we aim
-        // for a small average linked list length (<= 1).
-        Resize();
-      }
     }
+    if (current_.Full()) {
+      Grow();
+    }
+    current_.Add(h->hash, h);
     return old;
   }
 
   LRUHandle* Remove(const Slice& key, uint32_t hash) {
-    auto ptr = FindPointer(key, hash);
-    auto result = *ptr;
-    if (result != nullptr) {
-      *ptr = result->next_hash;
-      --elems_;
+    MigrateSome();
+    SlotArray* array = &current_;
+    Slot* slot = current_.Find(key, hash);
+    if (slot == nullptr && previous_.slots != nullptr) {
+      array = &previous_;
+      slot = previous_.Find(key, hash);
     }
+    if (slot == nullptr) {
+      return nullptr;
+    }
+    LRUHandle* result = slot->handle;
+    array->Erase(slot);
+    --elems_;
     return result;
   }
 
  private:
-  // The table consists of an array of buckets where each bucket is
-  // a linked list of cache entries that hash into the bucket.
-  uint32_t length_;
-  uint32_t elems_;
-  LRUHandle** table_;
-
-  LRUHandle** FindPointer(const Slice& key, uint32_t hash) {
-    // 注意这里返回二级指针的原因
-    // list_[hash & (length_ - 1)]是一个分配在堆上的指针
-    // 情况1、list_[hash & (length_ - 1)] == NULL时，新添加的节点需添加在其后，
-    // 因此list_[hash & (length_ - 1)] = 新添加的节点内存地址
-    // 情况2、list_[hash & (length_ - 1)] != NULL时，通常链表插入时需修改前一个
-    // 节点的next_hash,因此需要前一个节点的地址，函数返回为二级指针，
-    // 就是前一个节点next_hash指针的自身地址因此一行 *ptr =
-    // h;就完成了旧指针的踢出 及新节点的加入
-    LRUHandle** ptr = &table_[hash & (length_ - 1)];
-    while (*ptr != nullptr && ((*ptr)->hash != hash || key != (*ptr)->key())) {
-      ptr = &(*ptr)->next_hash;
-    }
-    return ptr;
-  }
-
-  void Resize() {
-    uint32_t new_length = 4;
-    while (new_length < elems_) {
+  // Minimum number of slots of an array, must be a power of two.
+  static constexpr uint32_t kMinLength = 16;
+  // Number of old slots drained by every Insert() and Remove() while a
+  // migration is in progress.
+  static constexpr uint32_t kMigrationBatch = 8;
+
+  struct Slot {
+    uint32_t hash;
+    // nullptr for an empty slot, Tombstone() for a removed one.
+    LRUHandle* handle;
+  };
+
+  static LRUHandle* Tombstone() {
+    return reinterpret_cast<LRUHandle*>(static_cast<uintptr_t>(1));
+  }
+
+  struct SlotArray {
+    SlotArray() : slots(nullptr), length(0), used(0) {}
+
+    void Allocate(uint32_t new_length) {
+      assert((new_length & (new_length - 1)) == 0);
+      slots = new Slot[new_length];
+      memset(slots, 0, sizeof(slots[0]) * new_length);
+      length = new_length;
+      used = 0;
+    }
+
+    void Free() {
+      delete[] slots;
+      slots = nullptr;
+      length = 0;
+      used = 0;
+    }
+
+    // Returns true if adding one more slot would exceed the maximum load
+    // factor of 3/4. Keeping the load below 1 also guarantees that every
+    // probe sequence ends at an empty slot.
+    bool Full() const { return (used + 1) * 4 > length * 3; }
+
+    Slot* Find(const Slice& key, uint32_t hash) {
+      const uint32_t mask = length - 1;
+      for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot* slot = &slots[i];
+        if (slot->handle == nullptr) {
+          return nullptr;
+        }
+        // Only touch the handle when the cached hash matches.
+        if (slot->hash == hash && slot->handle != Tombstone() &&
+            key == slot->handle->key()) {
+          return slot;
+        }
+      }
+    }
+
+    // REQUIRES: no slot holds the key of h and !Full().
+    void Add(uint32_t hash, LRUHandle* h) {
+      const uint32_t mask = length - 1;
+      uint32_t i = hash & mask;
+      while (slots[i].handle != nullptr && slots[i].handle != Tombstone()) {
+        i = (i + 1) & mask;
+      }
+      if (slots[i].handle == nullptr) {
+        ++used;
+      }
+      slots[i].hash = hash;
+      slots[i].handle = h;
+    }
+
+    void Erase(Slot* slot) {
+      const uint32_t mask = length - 1;
+      uint32_t i = static_cast<uint32_t>(slot - slots);
+      slot->handle = Tombstone();
+      // No probe sequence can run past an empty slot, so if the next slot
+      // is empty, this tombstone and the ones right before it are useless.
+      if (slots[(i + 1) & mask].handle == nullptr) {
+        while (slots[i].handle == Tombstone()) {
+          slots[i].handle = nullptr;
+          --used;
+          i = (i - 1) & mask;
+        }
+      }
+    }
+
+    Slot* slots;
+    uint32_t length;
+    // Number of non-empty slots, including tombstones.
+    uint32_t used;
+  };
+
+  // Moves up to kMigrationBatch slots of previous_ into current_.
+  void MigrateSome() {
+    if (previous_.slots == nullptr) {
+      return;
+    }
+    for (uint32_t n = 0; n < kMigrationBatch; ++n) {
+      if (migrate_pos_ == previous_.length) {
+        previous_.Free();
+        return;
+      }
+      if (current_.Full()) {
+        // The next Insert() will fold both arrays into a bigger one.
+        return;
+      }
+      Slot* slot = &previous_.slots[migrate_pos_++];
+      if (slot->handle != nullptr && slot->handle != Tombstone()) {
+        current_.Add(slot->hash, slot->handle);
+        previous_.Erase(slot);
+      }
+    }
+  }
+
+  void Grow() {
+    uint32_t new_length = kMinLength;
+    // Since each cache entry is fairly large, a load factor of at most 1/2
+    // right after growing leaves enough room to finish the migration.
+    while (new_length < elems_ * 2) {
       new_length *= 2;
     }
-    auto new_table = new LRUHandle*[new_length];
-    memset(new_table, 0, sizeof(new_table[0]) * new_length);
-    uint32_t count = 0;
-    for (uint32_t i = 0; i < length_; ++i) {
-      auto h = table_[i];
-      // 一次处理完当前hash值相同的所有key
-      while (h != nullptr) {
-        auto next = h->next_hash;
-        auto hash = h->hash;
-        // 找到当前handle在新的table中所处的位置
-        LRUHandle** ptr = &new_table[hash & (new_length - 1)];
-        // 将当前handle和之前已经存在的handle连接起来
-        h->next_hash = *ptr;
-        *ptr = h;
-        h = next;
-        count++;
+    SlotArray fresh;
+    fresh.Allocate(new_length);
+    if (previous_.slots != nullptr) {
+      // The table filled up again before the last migration finished, which
+      // only happens with heavy churn on small tables. Rehash both arrays.
+      MoveAll(&previous_, &fresh);
+      MoveAll(&current_, &fresh);
+    } else {
+      previous_ = current_;
+      migrate_pos_ = 0;
+    }
+    current_ = fresh;
+  }
+
+  static void MoveAll(SlotArray* from, SlotArray* to) {
+    for (uint32_t i = 0; i < from->length; ++i) {
+      const Slot& slot = from->slots[i];
+      if (slot.handle != nullptr && slot.handle != Tombstone()) {
+        to->Add(slot.hash, slot.handle);
       }
     }
-    assert(elems_ == count);
-    delete[] table_;
-    table_ = new_table;
-    length_ = new_length;
+    from->Free();
+  }
+
+  SlotArray current_;
+  // Non-empty only while the entries of a smaller array are being migrated.
+  SlotArray previous_;
+  // Index of the next slot of previous_ to migrate.
+  uint32_t migrate_pos_;
+  // Number of handles stored in both arrays.
+  uint32_t elems_;
+};
+
+// Per-shard state of a client that has a quota, see Cache::SetClientQuota().
+// Only touched with the shard's mutex held.
+struct ClientQuota {
+  ClientQuota()
+      : capacity(0), reserved(0), usage(0), queued(false), queued_seq(0) {
+    list.client_next = &list;
+    list.client_prev = &list;
+    lru.next = &lru;
+    lru.prev = &lru;
   }
+
+  size_t capacity;  // 0 means no limit.
+  size_t reserved;
+  size_t usage;
+  // Dummy head of the client's entries, pinned or not, in access order.
+  // list.client_next is the oldest entry.
+  LRUHandle list;
+  // Dummy head of the client's entries that are not in use, in LRU order.
+  // Plays the part of LRUCache::lru_ for them.
+  LRUHandle lru;
+  // Whether the client is in LRUCache::evictable_, and under which
+  // lru_seq.
+  bool queued;
+  uint64_t queued_seq;
+};
+
+// An entry evicted from a shard that should be saved into the
+// secondary cache once the shard's mutex is released.
+struct SpilledEntry {
+  std::string key;
+  std::string data;
 };
 
 // A single shard of sharded cache.
@@ -186,26 +417,71 @@ class LRUCache {
 
   // Separate from constructor so caller can easily make an array of LRUCache
   void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  void SetStrictCapacityLimit(bool strict) {
+    MutexLock lock(&mutex_);
+    strict_capacity_limit_ = strict;
+  }
 
   // Like Cache methods, but with an extra "hash" parameter.
+  //
+  // If "spilled" is not nullptr, the evicted entries that have a helper
+  // are serialized into *spilled. Returns nullptr if the entry does not
+  // fit under the strict capacity limit.
   Cache::Handle* Insert(const Slice& key, uint32_t hash, void* value,
                         size_t charge,
-  std::function<void(const Slice& key, void* value)>);
+                        std::function<void(const Slice& key, void* value)>,
+                        const Cache::ItemHelper* helper,
+                        std::vector<SpilledEntry>* spilled);
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
+  // Called once the entry of "key" spilled by Insert() was handed to the
+  // secondary cache. Returns true if the key was erased in the meantime,
+  // in which case the caller must erase it from the secondary cache again.
+  bool FinishSpill(const std::string& key);
   void Prune();
+  void SetClientQuota(uint64_t id, size_t capacity, size_t reserved);
+  void RemoveClientQuota(uint64_t id);
+  size_t GetClientCharge(uint64_t id) const;
+  // Append to *keys up to "max_keys" keys, most recently used first.
+  void AppendKeysByRecency(size_t max_keys,
+                           std::vector<std::string>* keys) const;
   size_t TotalCharge() const {
     MutexLock lock(&mutex_);
     return usage_;
   }
+  size_t PinnedCharge() const {
+    MutexLock lock(&mutex_);
+    return pinned_usage_;
+  }
 
  private:
   static void LRU_Remove(LRUHandle* e);
   static void LRU_Append(LRUHandle* list, LRUHandle* e);
+  static void Client_Remove(LRUHandle* e);
+  static void Client_Append(ClientQuota* client, LRUHandle* e);
   void Ref(LRUHandle* e);
   void Unref(LRUHandle* e);
   bool FinishErase(LRUHandle* e) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Remove e, which must be on lru_, from the cache, serializing it into
+  // *spilled first if requested.
+  void Evict(LRUHandle* e, std::vector<SpilledEntry>* spilled)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Evict entries not in use, oldest first, until "charge" more bytes fit.
+  void EvictLRU(size_t charge, std::vector<SpilledEntry>* spilled)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Returns the oldest entry not in use that may be evicted on behalf of
+  // other clients, or nullptr if there is none.
+  LRUHandle* OldestEvictable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Puts "client" into evictable_, moves it or takes it out, after its
+  // usage or the head of its LRU list changed.
+  void UpdateEvictable(ClientQuota* client) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Returns the LRU list that e goes to when it is no longer in use.
+  LRUHandle* LRUList(LRUHandle* e) EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return e->client != nullptr ? &e->client->lru : &lru_;
+  }
+  // Returns lru_ followed by the LRU lists of all clients.
+  std::vector<LRUHandle*> LRULists() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   // Initialized before use.
   size_t capacity_;
@@ -214,10 +490,15 @@ class LRUCache {
   mutable port::Mutex mutex_;
   // current cache usage.
   size_t usage_ GUARDED_BY(mutex_);
+  // Part of usage_ charged by the entries of in_use_.
+  size_t pinned_usage_ GUARDED_BY(mutex_);
+  bool strict_capacity_limit_ GUARDED_BY(mutex_);
+  // Source of LRUHandle::lru_seq.
+  uint64_t last_lru_seq_ GUARDED_BY(mutex_);
 
   /// Dummy head of LRU list
   /// lru.prev is newest entry, lru.next is oldest entry.
-  /// Entries have refs == 1 and in_cache = true;
+  /// Entries have refs == 1 and in_cache = true, and belong to no client.
   LRUHandle lru_ GUARDED_BY(mutex_);
 
   /// Dummy head of in-use list.
@@ -225,9 +506,27 @@ class LRUCache {
   LRUHandle in_use_ GUARDED_BY(mutex_);
 
   HandleTable table_ GUARDED_BY(mutex_);
+
+  // Evicted entries that are on their way to the secondary cache, by key.
+  struct PendingSpill {
+    int count = 0;
+    bool erased = false;
+  };
+  std::unordered_map<std::string, PendingSpill> spilling_ GUARDED_BY(mutex_);
+
+  // Clients with a quota, keyed by the id their keys start with. Entries
+  // are only removed by RemoveClientQuota(), which detaches the handles
+  // pointing to them.
+  std::unordered_map<uint64_t, ClientQuota> clients_ GUARDED_BY(mutex_);
+  // Clients over their reservation that have entries not in use, ordered
+  // by the lru_seq of the oldest such entry. Keeps finding the oldest
+  // evictable entry independent of the number of clients.
+  std::set<std::pair<uint64_t, ClientQuota*>> evictable_ GUARDED_BY(mutex_);
 };
 
-LRUCache::LRUCache() : capacity_(0), usage_(0) {
+LRUCache::LRUCache()
+    : capacity_(0), usage_(0), pinned_usage_(0),
+      strict_capacity_limit_(false), last_lru_seq_(0) {
   // Make empty circular linked lists.
   lru_.next = &lru_;
   lru_.prev = &lru_;
@@ -238,14 +537,16 @@ LRUCache::LRUCache() : capacity_(0), usage_(0) {
 LRUCache::~LRUCache() {
   // Error if caller has an unreleased handle
   assert(in_use_.next == &in_use_);
-  for (auto e = lru_.next; e != &lru_;) {
-    auto next = e->next;
-    assert(e->in_cache);
-    e->in_cache = false;
-    // Invariant of lru_ list.
-    assert(e->refs == 1);
-    Unref(e);
-    e = next;
+  for (LRUHandle* list : LRULists()) {
+    for (auto e = list->next; e != list;) {
+      auto next = e->next;
+      assert(e->in_cache);
+      e->in_cache = false;
+      // Invariant of lru_ list.
+      assert(e->refs == 1);
+      Unref(e);
+      e = next;
+    }
   }
 }
 
@@ -254,6 +555,12 @@ void LRUCache::Ref(lsmdb::LRUHandle* e) {
   if (e->refs == 1 && e->in_cache) {
     LRU_Remove(e);
     LRU_Append(&in_use_, e);
+    pinned_usage_ += e->charge;
+  }
+  if (e->client != nullptr) {
+    Client_Remove(e);
+    Client_Append(e->client, e);
+    UpdateEvictable(e->client);
   }
   e->refs++;
 }
@@ -268,7 +575,12 @@ void LRUCache::Unref(lsmdb::LRUHandle* e) {
   } else if (e->in_cache && e->refs == 1) {
     // No longer in use; move to lru_ list.
     LRU_Remove(e);
-    LRU_Append(&lru_, e);
+    LRU_Append(LRUList(e), e);
+    e->lru_seq = ++last_lru_seq_;
+    pinned_usage_ -= e->charge;
+    if (e->client != nullptr) {
+      UpdateEvictable(e->client);
+    }
   }
 }
 
@@ -288,6 +600,19 @@ void LRUCache::LRU_Append(lsmdb::LRUHandle* list, lsmdb::LRUHandle* e) {
   e->next->prev = e;
 }
 
+void LRUCache::Client_Remove(lsmdb::LRUHandle* e) {
+  e->client_next->client_prev = e->client_prev;
+  e->client_prev->client_next = e->client_next;
+}
+
+void LRUCache::Client_Append(ClientQuota* client, lsmdb::LRUHandle* e) {
+  LRUHandle* list = &client->list;
+  e->client_next = list;
+  e->client_prev = list->client_prev;
+  e->client_prev->client_next = e;
+  e->client_next->client_prev = e;
+}
+
 Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
   MutexLock lock(&mutex_);
   auto e = table_.Lookup(key, hash);
@@ -304,8 +629,24 @@ void LRUCache::Release(Cache::Handle* handle) {
 
 Cache::Handle* LRUCache::Insert(
     const Slice& key, uint32_t hash, void* value, size_t charge,
-  std::function<void(const Slice&, void*)> deleter) {
-    MutexLock lock(&mutex_);
+    std::function<void(const Slice&, void*)> deleter,
+    const Cache::ItemHelper* helper, std::vector<SpilledEntry>* spilled) {
+  MutexLock lock(&mutex_);
+
+  if (capacity_ > 0 && strict_capacity_limit_) {
+    // Pinned entries can not make room, so give up before evicting
+    // anything if they alone leave no room.
+    bool fits = pinned_usage_ + charge <= capacity_;
+    if (fits) {
+      EvictLRU(charge, spilled);
+      // Entries of clients within their reservation may remain.
+      fits = usage_ + charge <= capacity_;
+    }
+    if (!fits) {
+      deleter(key, value);
+      return nullptr;
+    }
+  }
 
   // notice we should use new instead of malloc
   // LRUHandle.deleter is std::function
@@ -313,6 +654,7 @@ Cache::Handle* LRUCache::Insert(
   auto e = new LRUHandle;
   e->value = value;
   e->deleter = std::move(deleter);
+  e->helper = helper;
   e->charge = charge;
   e->key_length = key.size();
   e->hash = hash;
@@ -326,6 +668,16 @@ Cache::Handle* LRUCache::Insert(
     e->in_cache = true;
     LRU_Append(&in_use_, e);
     usage_ += charge;
+    pinned_usage_ += charge;
+    if (!clients_.empty() && key.size() >= 8) {
+      auto iter = clients_.find(DecodeFixed64(key.data()));
+      if (iter != clients_.end()) {
+        e->client = &iter->second;
+        e->client->usage += charge;
+        Client_Append(e->client, e);
+        UpdateEvictable(e->client);
+      }
+    }
     FinishErase(table_.Insert(e));
   } else {  // don't cache. (capacity_ == 0 is supported and turns off
             // cacheing.)
@@ -333,20 +685,93 @@ Cache::Handle* LRUCache::Insert(
             // e->next is initialized in default constructor.
             // e->next = nullptr;
   }
-  while (usage_ > capacity_ && lru_.next != &lru_) {
-    // 缓存淘汰，当到达容量上限之后，淘汰访问最不频繁的节点即lru_的next
-    auto old = lru_.next;
-    assert(old->refs == 1);
-    bool erased = FinishErase(table_.Remove(old->key(), old->hash));
-    if (!erased) {  // to avoid unused variable when compiled NDEBUG
-      assert(erased);
+  // A client over its own limit makes room from its own entries first.
+  ClientQuota* client = e->client;
+  if (client != nullptr && client->capacity > 0) {
+    for (auto old = client->list.client_next;
+         client->usage > client->capacity && old != &client->list;) {
+      auto next = old->client_next;
+      if (old->refs == 1) {
+        Evict(old, spilled);
+      }
+      old = next;
     }
   }
+  EvictLRU(0, spilled);
 
   // 将插入的handle强制类型转换为Cache::Handle返回
   return reinterpret_cast<Cache::Handle*>(e);
 }
 
+void LRUCache::EvictLRU(size_t charge, std::vector<SpilledEntry>* spilled) {
+  // 缓存淘汰，当到达容量上限之后，淘汰访问最不频繁的节点,
+  // 仍在自己reserved范围内的client的节点不参与淘汰
+  while (usage_ + charge > capacity_) {
+    LRUHandle* old = OldestEvictable();
+    if (old == nullptr) {
+      break;
+    }
+    Evict(old, spilled);
+  }
+}
+
+LRUHandle* LRUCache::OldestEvictable() {
+  LRUHandle* oldest = lru_.next != &lru_ ? lru_.next : nullptr;
+  // Each list is in LRU order, so only their heads need to be compared.
+  // Clients within their reservation are not in evictable_.
+  if (!evictable_.empty()) {
+    LRUHandle* head = evictable_.begin()->second->lru.next;
+    if (oldest == nullptr || head->lru_seq < oldest->lru_seq) {
+      oldest = head;
+    }
+  }
+  return oldest;
+}
+
+void LRUCache::UpdateEvictable(ClientQuota* client) {
+  const LRUHandle* head = client->lru.next;
+  const bool evictable =
+      client->usage > client->reserved && head != &client->lru;
+  if (client->queued) {
+    if (evictable && client->queued_seq == head->lru_seq) {
+      return;
+    }
+    evictable_.erase(std::make_pair(client->queued_seq, client));
+    client->queued = false;
+  }
+  if (evictable) {
+    evictable_.emplace(head->lru_seq, client);
+    client->queued = true;
+    client->queued_seq = head->lru_seq;
+  }
+}
+
+std::vector<LRUHandle*> LRUCache::LRULists() {
+  std::vector<LRUHandle*> lists;
+  lists.reserve(1 + clients_.size());
+  lists.push_back(&lru_);
+  for (auto& iter : clients_) {
+    lists.push_back(&iter.second.lru);
+  }
+  return lists;
+}
+
+void LRUCache::Evict(LRUHandle* e, std::vector<SpilledEntry>* spilled) {
+  assert(e->refs == 1);
+  if (spilled != nullptr && e->helper != nullptr) {
+    // Only serialize here, the (possibly expensive) insertion into the
+    // secondary cache happens after the mutex is released.
+    spilled->emplace_back();
+    spilled->back().key.assign(e->key_data, e->key_length);
+    e->helper->save(e->value, &spilled->back().data);
+    spilling_[spilled->back().key].count++;
+  }
+  bool erased = FinishErase(table_.Remove(e->key(), e->hash));
+  if (!erased) {  // to avoid unused variable when compiled NDEBUG
+    assert(erased);
+  }
+}
+
 // If e != nullptr, finish removing *e from the cache. it has already
 // been removed from the hash table. Return whether e != nullptr
 // 注意这个函数在被调用的场景都是e已经从hashtable中被移除了
@@ -357,9 +782,19 @@ bool LRUCache::FinishErase(lsmdb::LRUHandle* e) {
     assert(e->in_cache);
     // 将e从当前所在的双向链表中删除
     LRU_Remove(e);
+    if (e->refs > 1) {  // on in_use_
+      pinned_usage_ -= e->charge;
+    }
     // 因为e已经从hashtable中被删除了
     e->in_cache = false;
     usage_ -= e->charge;
+    if (e->client != nullptr) {
+      ClientQuota* client = e->client;
+      Client_Remove(e);
+      client->usage -= e->charge;
+      e->client = nullptr;
+      UpdateEvictable(client);
+    }
     Unref(e);
   }
   return e != nullptr;
@@ -368,17 +803,123 @@ bool LRUCache::FinishErase(lsmdb::LRUHandle* e) {
 void LRUCache::Erase(const Slice& key, uint32_t hash) {
   MutexLock lock(&mutex_);
   FinishErase(table_.Remove(key, hash));
+  if (!spilling_.empty()) {
+    // The spill may land in the secondary cache after the caller erased
+    // the key there, so let the spilling thread erase it once more.
+    auto iter = spilling_.find(key.ToString());
+    if (iter != spilling_.end()) {
+      iter->second.erased = true;
+    }
+  }
+}
+
+bool LRUCache::FinishSpill(const std::string& key) {
+  MutexLock lock(&mutex_);
+  auto iter = spilling_.find(key);
+  assert(iter != spilling_.end());
+  const bool erased = iter->second.erased;
+  if (--iter->second.count == 0) {
+    spilling_.erase(iter);
+  }
+  return erased;
 }
 
 void LRUCache::Prune() {
   MutexLock lock(&mutex_);
-  // 仅仅针对lru_链表的中handle
-  while (lru_.next != &lru_) {
-    auto e = lru_.next;
-    assert(e->refs == 1);
-    bool erased = FinishErase(table_.Remove(e->key(), e->hash));
-    if (!erased) {  // to avoid unused variable when compiled NDEBUG
-      assert(erased);
+  // 仅仅针对lru_链表(以及各client的lru链表)的中handle
+  for (LRUHandle* list : LRULists()) {
+    while (list->next != list) {
+      auto e = list->next;
+      assert(e->refs == 1);
+      bool erased = FinishErase(table_.Remove(e->key(), e->hash));
+      if (!erased) {  // to avoid unused variable when compiled NDEBUG
+        assert(erased);
+      }
+    }
+  }
+}
+
+void LRUCache::SetClientQuota(uint64_t id, size_t capacity,
+                              size_t reserved) {
+  MutexLock lock(&mutex_);
+  ClientQuota& client = clients_[id];
+  client.capacity = capacity;
+  client.reserved = reserved;
+  UpdateEvictable(&client);
+  // Entries already over the new limit go away with the next insertion.
+}
+
+void LRUCache::RemoveClientQuota(uint64_t id) {
+  MutexLock lock(&mutex_);
+  auto iter = clients_.find(id);
+  if (iter == clients_.end()) {
+    return;
+  }
+  ClientQuota* client = &iter->second;
+  if (client->queued) {
+    evictable_.erase(std::make_pair(client->queued_seq, client));
+  }
+  // The entries stay, without a client from now on.
+  for (auto e = client->list.client_next; e != &client->list;
+       e = e->client_next) {
+    e->client = nullptr;
+  }
+  // Merge the client's LRU list into lru_, both are ordered by lru_seq.
+  LRUHandle* pos = lru_.next;
+  for (auto e = client->lru.next; e != &client->lru;) {
+    auto next = e->next;
+    while (pos != &lru_ && pos->lru_seq < e->lru_seq) {
+      pos = pos->next;
+    }
+    LRU_Remove(e);
+    LRU_Append(pos, e);
+    e = next;
+  }
+  clients_.erase(iter);
+}
+
+size_t LRUCache::GetClientCharge(uint64_t id) const {
+  MutexLock lock(&mutex_);
+  auto iter = clients_.find(id);
+  return iter == clients_.end() ? 0 : iter->second.usage;
+}
+
+void LRUCache::AppendKeysByRecency(size_t max_keys,
+                                   std::vector<std::string>* keys) const {
+  MutexLock lock(&mutex_);
+  size_t count = 0;
+  // in_use_ is in no particular order, but its entries are being used
+  // right now.
+  for (auto e = in_use_.prev; e != &in_use_ && count < max_keys;
+       e = e->prev) {
+    keys->emplace_back(e->key_data, e->key_length);
+    ++count;
+  }
+  // Merge the LRU lists, newest first. list->prev is the newest entry of
+  // a list.
+  std::vector<std::pair<const LRUHandle*, const LRUHandle*>> cursors;
+  if (lru_.prev != &lru_) {
+    cursors.emplace_back(&lru_, lru_.prev);
+  }
+  for (const auto& iter : clients_) {
+    const LRUHandle* list = &iter.second.lru;
+    if (list->prev != list) {
+      cursors.emplace_back(list, list->prev);
+    }
+  }
+  while (!cursors.empty() && count < max_keys) {
+    auto newest = cursors.begin();
+    for (auto iter = cursors.begin(); iter != cursors.end(); ++iter) {
+      if (iter->second->lru_seq > newest->second->lru_seq) {
+        newest = iter;
+      }
+    }
+    const LRUHandle* e = newest->second;
+    keys->emplace_back(e->key_data, e->key_length);
+    ++count;
+    newest->second = e->prev;
+    if (newest->second == newest->first) {
+      cursors.erase(newest);
     }
   }
 }
@@ -390,7 +931,11 @@ const int kNumShards = 1 << kNumShardBits;
 // 可以定义多个LRUCache，分别处理不同hash取模后的缓存处理
 class ShardedLRUCache : public Cache {
  public:
-  explicit ShardedLRUCache(size_t capacity) : last_id_(0) {
+  explicit ShardedLRUCache(size_t capacity,
+                           std::shared_ptr<SecondaryCache> secondary_cache)
+      : secondary_cache_(std::move(secondary_cache)),
+        strict_capacity_limit_(false),
+        last_id_(0) {
     const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
     for (int s = 0; s < kNumShards; ++s) {
       shard_[s].SetCapacity(per_shard);
@@ -400,13 +945,33 @@ class ShardedLRUCache : public Cache {
   Handle* Insert(
       const Slice& key, void* value, size_t charge,
       std::function<void(const Slice& key, void* value)> deleter) override {
-    const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+    return Insert(key, value, charge, std::move(deleter), nullptr);
+  }
+  Handle* Insert(const Slice& key, void* value, size_t charge,
+                 const ItemHelper* helper) override {
+    return Insert(key, value, charge, helper->deleter, helper);
   }
   Handle* Lookup(const Slice& key) override {
     const uint32_t hash = HashSlice(key);
     return shard_[Shard(hash)].Lookup(key, hash);
   }
+  Handle* Lookup(const Slice& key, const ItemHelper* helper) override {
+    Handle* handle = Lookup(key);
+    if (handle != nullptr || secondary_cache_ == nullptr) {
+      return handle;
+    }
+    std::string data;
+    if (!secondary_cache_->Lookup(key, &data)) {
+      return nullptr;
+    }
+    size_t charge = 0;
+    void* value = helper->create(data, &charge);
+    if (value == nullptr) {
+      return nullptr;
+    }
+    // Promote the entry back to the primary cache.
+    return Insert(key, value, charge, helper);
+  }
   void Release(Handle* handle) override {
     auto h = reinterpret_cast<LRUHandle*>(handle);
     shard_[Shard(h->hash)].Release(handle);
@@ -414,6 +979,9 @@ class ShardedLRUCache : public Cache {
   void Erase(const Slice& key) override {
     const uint32_t hash = HashSlice(key);
     shard_[Shard(hash)].Erase(key, hash);
+    if (secondary_cache_ != nullptr) {
+      secondary_cache_->Erase(key);
+    }
   }
   void* Value(Handle* handle) override {
     return reinterpret_cast<LRUHandle*>(handle)->value;
@@ -428,6 +996,53 @@ class ShardedLRUCache : public Cache {
     }
   }
 
+  void SetClientQuota(uint64_t id, size_t capacity,
+                      size_t reserved) override {
+    // Keys spread evenly over the shards, so does the quota.
+    const size_t per_shard_capacity = (capacity + (kNumShards - 1)) / kNumShards;
+    const size_t per_shard_reserved = (reserved + (kNumShards - 1)) / kNumShards;
+    for (int i = 0; i < kNumShards; ++i) {
+      shard_[i].SetClientQuota(id, per_shard_capacity, per_shard_reserved);
+    }
+  }
+
+  void RemoveClientQuota(uint64_t id) override {
+    for (int i = 0; i < kNumShards; ++i) {
+      shard_[i].RemoveClientQuota(id);
+    }
+  }
+
+  size_t GetClientCharge(uint64_t id) const override {
+    size_t total = 0;
+    for (int i = 0; i < kNumShards; ++i) {
+      total += shard_[i].GetClientCharge(id);
+    }
+    return total;
+  }
+
+  void GetKeysByRecency(size_t max_keys,
+                        std::vector<std::string>* keys) const override {
+    keys->clear();
+    // Shards do not share a clock, but keys spread evenly over them, so
+    // interleaving the per-shard orders approximates the global one.
+    std::vector<std::string> shard_keys[kNumShards];
+    for (int i = 0; i < kNumShards; ++i) {
+      shard_[i].AppendKeysByRecency(max_keys, &shard_keys[i]);
+    }
+    for (size_t rank = 0; keys->size() < max_keys; ++rank) {
+      bool found = false;
+      for (int i = 0; i < kNumShards && keys->size() < max_keys; ++i) {
+        if (rank < shard_keys[i].size()) {
+          keys->push_back(std::move(shard_keys[i][rank]));
+          found = true;
+        }
+      }
+      if (!found) {
+        break;
+      }
+    }
+  }
+
   size_t TotalCharge() const override {
     size_t total = 0;
     for (int i = 0; i < kNumShards; ++i) {
@@ -436,8 +1051,54 @@ class ShardedLRUCache : public Cache {
     return total;
   }
 
+  size_t GetPinnedCharge() const override {
+    size_t total = 0;
+    for (int i = 0; i < kNumShards; ++i) {
+      total += shard_[i].PinnedCharge();
+    }
+    return total;
+  }
+
+  void SetStrictCapacityLimit(bool strict) override {
+    strict_capacity_limit_.store(strict, std::memory_order_relaxed);
+    for (int i = 0; i < kNumShards; ++i) {
+      shard_[i].SetStrictCapacityLimit(strict);
+    }
+  }
+
+  bool HasStrictCapacityLimit() const override {
+    return strict_capacity_limit_.load(std::memory_order_relaxed);
+  }
+
  private:
+  // Inserts into the shard of "key" and moves the entries it evicts, the
+  // ones that have a helper, to the secondary cache.
+  Handle* Insert(const Slice& key, void* value, size_t charge,
+                 std::function<void(const Slice& key, void* value)> deleter,
+                 const ItemHelper* helper) {
+    const uint32_t hash = HashSlice(key);
+    LRUCache& shard = shard_[Shard(hash)];
+    if (secondary_cache_ == nullptr) {
+      return shard.Insert(key, hash, value, charge, std::move(deleter),
+                          helper, nullptr);
+    }
+    std::vector<SpilledEntry> spilled;
+    Handle* handle = shard.Insert(key, hash, value, charge,
+                                  std::move(deleter), helper, &spilled);
+    for (const SpilledEntry& entry : spilled) {
+      // Failing to keep an evicted entry is not an error for the caller.
+      secondary_cache_->Insert(entry.key, entry.data);
+      if (shard.FinishSpill(entry.key)) {
+        // Erase() ran between the eviction and the insertion above.
+        secondary_cache_->Erase(entry.key);
+      }
+    }
+    return handle;
+  }
+
   LRUCache shard_[kNumShards];
+  const std::shared_ptr<SecondaryCache> secondary_cache_;
+  std::atomic<bool> strict_capacity_limit_;
   port::Mutex id_mutex_;
   uint64_t last_id_;
 
@@ -451,7 +1112,13 @@ class ShardedLRUCache : public Cache {
 }  // end anonymous namespace
 
 std::shared_ptr<Cache> NewLRUCache(size_t capacity) {
-  return std::make_shared<ShardedLRUCache>(capacity);
+  return std::make_shared<ShardedLRUCache>(capacity, nullptr);
+}
+
+std::shared_ptr<Cache> NewLRUCache(
+    size_t capacity, std::shared_ptr<SecondaryCache> secondary_cache) {
+  return std::make_shared<ShardedLRUCache>(capacity,
+                                           std::move(secondary_cache));
 }
 
 }  // namespace lsmdb
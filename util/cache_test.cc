@@ -4,6 +4,7 @@
 
 #include "lsmdb/cache.h"
 
+#include <map>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -246,6 +247,70 @@ TEST_F(CacheTest, UseExceedsCacheSize) {
   }
 }
 
+TEST_F(CacheTest, StrictCapacityLimit) {
+  cache_->SetStrictCapacityLimit(true);
+  ASSERT_TRUE(cache_->HasStrictCapacityLimit());
+
+  // Keep handles on the inserted entries until the cache refuses one.
+  std::vector<Cache::Handle*> h;
+  Status s;
+  for (int i = 0; i < kCacheSize + 100 && s.ok(); ++i) {
+    Cache::Handle* handle;
+    s = cache_->TryInsert(EncodeKey(1000 + i), EncodeValue(2000 + i), 1,
+                          CacheTest::Deleter, &handle);
+    if (s.ok()) {
+      h.push_back(handle);
+    } else {
+      ASSERT_TRUE(handle == nullptr);
+    }
+  }
+  ASSERT_TRUE(s.IsIncomplete()) << s.ToString();
+  ASSERT_LE(h.size(), static_cast<size_t>(kCacheSize));
+  ASSERT_EQ(h.size(), cache_->TotalCharge());
+  ASSERT_EQ(h.size(), cache_->GetPinnedCharge());
+  // The refused value was handed to the deleter right away.
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(1000 + h.size(), deleted_keys_[0]);
+  ASSERT_EQ(-1, Lookup(1000 + h.size()));
+
+  for (auto* handle : h) {
+    cache_->Release(handle);
+  }
+  ASSERT_EQ(0, cache_->GetPinnedCharge());
+  ASSERT_EQ(h.size(), cache_->TotalCharge());
+
+  // Unpinned entries make room.
+  Insert(1000 + h.size(), 2000 + h.size());
+  ASSERT_EQ(2000 + h.size(), Lookup(1000 + h.size()));
+
+  // An entry larger than a shard never fits.
+  Cache::Handle* handle;
+  s = cache_->TryInsert(EncodeKey(1), EncodeValue(2), kCacheSize,
+                        CacheTest::Deleter, &handle);
+  ASSERT_TRUE(s.IsIncomplete());
+  ASSERT_TRUE(handle == nullptr);
+  ASSERT_EQ(-1, Lookup(1));
+}
+
+TEST_F(CacheTest, PinnedCharge) {
+  Cache::Handle* h1 = InsertAndReturnHandle(100, 101, 10);
+  Insert(200, 201, 20);
+  ASSERT_EQ(30, cache_->TotalCharge());
+  ASSERT_EQ(10, cache_->GetPinnedCharge());
+
+  Cache::Handle* h2 = cache_->Lookup(EncodeKey(200));
+  ASSERT_EQ(30, cache_->GetPinnedCharge());
+  // Erased entries no longer count, even while referenced.
+  Erase(100);
+  ASSERT_EQ(20, cache_->TotalCharge());
+  ASSERT_EQ(20, cache_->GetPinnedCharge());
+
+  cache_->Release(h1);
+  cache_->Release(h2);
+  ASSERT_EQ(20, cache_->TotalCharge());
+  ASSERT_EQ(0, cache_->GetPinnedCharge());
+}
+
 TEST_F(CacheTest, HeavyEntries) {
   // Add a bunch of light and heavy entries and then count the combined
   // size of items still in the cache, which must be approximately the
@@ -272,6 +337,140 @@ TEST_F(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
 }
 
+TEST_F(CacheTest, ManyEntries) {
+  // Grow the hash table several times while keys are being erased and
+  // replaced, so that lookups run while old slots are still migrating.
+  cache_ = NewLRUCache(100000);
+  const int kNum = 20000;
+  std::map<int, int> expected;
+  for (int i = 0; i < kNum; ++i) {
+    Insert(i, 1000 + i);
+    expected[i] = 1000 + i;
+    if (i % 3 == 0) {
+      Erase(i / 2);
+      expected.erase(i / 2);
+    }
+    if (i % 7 == 0) {
+      Insert(i / 3, 2000 + i);
+      expected[i / 3] = 2000 + i;
+    }
+    ASSERT_EQ(expected.size(), cache_->TotalCharge());
+  }
+  for (int i = 0; i < kNum; ++i) {
+    auto iter = expected.find(i);
+    ASSERT_EQ(iter == expected.end() ? -1 : iter->second, Lookup(i));
+  }
+  for (int i = 0; i < kNum; ++i) {
+    Erase(i);
+    ASSERT_EQ(-1, Lookup(i));
+  }
+  ASSERT_EQ(0, cache_->TotalCharge());
+}
+
+static std::string EncodeClientKey(uint64_t id, int k) {
+  std::string result;
+  PutFixed64(&result, id);
+  PutFixed32(&result, k);
+  return result;
+}
+
+static void NoopDeleter(const Slice& key, void* v) {}
+
+TEST_F(CacheTest, ClientQuota) {
+  const uint64_t a = cache_->NewId();
+  const uint64_t b = cache_->NewId();
+  cache_->SetClientQuota(a, 160, 0);
+  cache_->SetClientQuota(b, 0, 0);
+  for (int i = 0; i < 100; ++i) {
+    cache_->Release(
+        cache_->Insert(EncodeClientKey(b, i), EncodeValue(i), 1, NoopDeleter));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    cache_->Release(
+        cache_->Insert(EncodeClientKey(a, i), EncodeValue(i), 1, NoopDeleter));
+  }
+  // a only evicted its own entries.
+  ASSERT_EQ(100, cache_->GetClientCharge(b));
+  ASSERT_LE(cache_->GetClientCharge(a), 160);
+  ASSERT_GE(cache_->GetClientCharge(a), 100);
+  ASSERT_EQ(0, cache_->GetClientCharge(cache_->NewId()));
+
+  // The most recently used entries of a are kept.
+  auto h = cache_->Lookup(EncodeClientKey(a, 999));
+  ASSERT_TRUE(h != nullptr);
+  cache_->Release(h);
+
+  for (int i = 0; i < 100; ++i) {
+    cache_->Erase(EncodeClientKey(b, i));
+  }
+  ASSERT_EQ(0, cache_->GetClientCharge(b));
+}
+
+TEST_F(CacheTest, ClientReservation) {
+  const uint64_t a = cache_->NewId();
+  const uint64_t b = cache_->NewId();
+  cache_->SetClientQuota(b, 0, 800);
+  for (int i = 0; i < 400; ++i) {
+    cache_->Release(
+        cache_->Insert(EncodeClientKey(b, i), EncodeValue(i), 1, NoopDeleter));
+  }
+  // Without a quota, a competes for everything left.
+  for (int i = 0; i < 5000; ++i) {
+    Insert(i, i);
+    cache_->Release(
+        cache_->Insert(EncodeClientKey(a, i), EncodeValue(i), 1, NoopDeleter));
+  }
+  ASSERT_EQ(400, cache_->GetClientCharge(b));
+  for (int i = 0; i < 400; ++i) {
+    auto h = cache_->Lookup(EncodeClientKey(b, i));
+    ASSERT_TRUE(h != nullptr);
+    cache_->Release(h);
+  }
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize + kCacheSize / 10);
+}
+
+TEST_F(CacheTest, ClientOverReservationIsEvicted) {
+  const uint64_t b = cache_->NewId();
+  cache_->SetClientQuota(b, 0, 320);
+  for (int i = 0; i < 800; ++i) {
+    cache_->Release(
+        cache_->Insert(EncodeClientKey(b, i), EncodeValue(i), 1, NoopDeleter));
+  }
+  for (int i = 0; i < 5000; ++i) {
+    Insert(i, i);
+  }
+  // Only the part of b beyond its reservation competed with other entries,
+  // and the newest entries of b are the ones kept.
+  ASSERT_LE(cache_->GetClientCharge(b), 320);
+  ASSERT_GT(cache_->GetClientCharge(b), 0);
+  ASSERT_TRUE(cache_->Lookup(EncodeClientKey(b, 0)) == nullptr);
+  auto h = cache_->Lookup(EncodeClientKey(b, 799));
+  ASSERT_TRUE(h != nullptr);
+  cache_->Release(h);
+}
+
+TEST_F(CacheTest, RemoveClientQuota) {
+  const uint64_t b = cache_->NewId();
+  cache_->SetClientQuota(b, 0, 800);
+  for (int i = 0; i < 400; ++i) {
+    cache_->Release(
+        cache_->Insert(EncodeClientKey(b, i), EncodeValue(i), 1, NoopDeleter));
+  }
+  Cache::Handle* pinned = cache_->Lookup(EncodeClientKey(b, 0));
+  ASSERT_TRUE(pinned != nullptr);
+  cache_->RemoveClientQuota(b);
+  ASSERT_EQ(0, cache_->GetClientCharge(b));
+  cache_->Release(pinned);
+
+  // Without the reservation, the entries of b are evicted like any other.
+  for (int i = 0; i < 5000; ++i) {
+    Insert(i, i);
+  }
+  for (int i = 0; i < 400; ++i) {
+    ASSERT_TRUE(cache_->Lookup(EncodeClientKey(b, i)) == nullptr);
+  }
+}
+
 TEST_F(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
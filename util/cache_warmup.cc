@@ -0,0 +1,149 @@
+//
+// Created by 刘文景 on 2021/4/14.
+//
+
+#include "lsmdb/cache_warmup.h"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lsmdb/cache.h"
+#include "lsmdb/env.h"
+#include "util/coding.h"
+
+namespace lsmdb {
+
+namespace {
+
+// Dump file format:
+//   magic: fixed64
+//   keys:  length-prefixed slices, most recently used first
+constexpr uint64_t kCacheDumpMagic = 0x6c736d6462647570ull;
+
+// State handed to the background thread.
+struct WarmupState {
+  Env* env;
+  std::shared_ptr<Cache> cache;
+  std::string fname;
+  CacheWarmupOptions options;
+  CacheLoader loader;
+};
+
+void WarmupThreadMain(void* arg) {
+  std::unique_ptr<WarmupState> state(reinterpret_cast<WarmupState*>(arg));
+  Env* env = state->env;
+
+  std::vector<std::string> keys;
+  Status s = ReadCacheKeys(env, state->fname, &keys);
+  const uint64_t start = env->NowMicros();
+  uint64_t total_bytes = 0;
+  Status load_status;
+  for (size_t i = 0; s.ok() && i < keys.size(); ++i) {
+    Cache::Handle* handle = state->cache->Lookup(keys[i]);
+    if (handle != nullptr) {
+      // Already loaded by a foreground read.
+      state->cache->Release(handle);
+      continue;
+    }
+    uint64_t bytes_read = 0;
+    Status load = state->loader(keys[i], &bytes_read);
+    if (!load.ok()) {
+      // The entry may refer to data that no longer exists, so go on with
+      // the other keys.
+      if (load_status.ok()) {
+        load_status = load;
+      }
+      continue;
+    }
+    total_bytes += bytes_read;
+
+    const uint64_t rate = state->options.bytes_per_second;
+    if (rate > 0) {
+      // Sleep until the bytes read so far fit into the allowed rate.
+      const uint64_t expected_micros = total_bytes * 1000000 / rate;
+      const uint64_t elapsed_micros = env->NowMicros() - start;
+      if (expected_micros > elapsed_micros) {
+        env->SleepForMicroseconds(static_cast<int>(
+            std::min<uint64_t>(expected_micros - elapsed_micros,
+                               std::numeric_limits<int>::max())));
+      }
+    }
+  }
+  if (state->options.done) {
+    state->options.done(s.ok() ? load_status : s);
+  }
+}
+
+}  // namespace
+
+Status DumpCacheKeys(Env* env, const Cache* cache, size_t max_keys,
+                     const std::string& fname) {
+  std::vector<std::string> keys;
+  cache->GetKeysByRecency(max_keys, &keys);
+
+  std::string contents;
+  PutFixed64(&contents, kCacheDumpMagic);
+  for (const std::string& key : keys) {
+    PutLengthPrefixedSlice(&contents, key);
+  }
+
+  // Write to a temporary file first so a crash never leaves a torn dump.
+  const std::string tmp = fname + ".tmp";
+  WritableFile* file;
+  Status s = env->NewWritableFile(tmp, &file);
+  if (!s.ok()) {
+    return s;
+  }
+  s = file->Append(contents);
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  delete file;
+  if (s.ok()) {
+    s = env->RenameFile(tmp, fname);
+  }
+  if (!s.ok()) {
+    env->RemoveFile(tmp);
+  }
+  return s;
+}
+
+Status ReadCacheKeys(Env* env, const std::string& fname,
+                     std::vector<std::string>* keys) {
+  keys->clear();
+  std::string contents;
+  Status s = ReadFileToString(env, fname, &contents);
+  if (!s.ok()) {
+    return s;
+  }
+  Slice input(contents);
+  if (input.size() < 8 || DecodeFixed64(input.data()) != kCacheDumpMagic) {
+    return Status::Corruption(fname, "not a cache dump");
+  }
+  input.remove_prefix(8);
+  Slice key;
+  while (!input.empty()) {
+    if (!GetLengthPrefixedSlice(&input, &key)) {
+      keys->clear();
+      return Status::Corruption(fname, "truncated cache dump");
+    }
+    keys->push_back(key.ToString());
+  }
+  return Status::OK();
+}
+
+void StartCacheWarmup(Env* env, std::shared_ptr<Cache> cache,
+                      const std::string& fname,
+                      const CacheWarmupOptions& options, CacheLoader loader) {
+  auto* state = new WarmupState{env, std::move(cache), fname, options,
+                                std::move(loader)};
+  env->StartThread(&WarmupThreadMain, state);
+}
+
+}  // namespace lsmdb
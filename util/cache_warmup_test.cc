@@ -0,0 +1,169 @@
+//
+// Created by 刘文景 on 2021/4/14.
+//
+
+#include "lsmdb/cache_warmup.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "helpers/memenv/memenv.h"
+#include "lsmdb/cache.h"
+#include "lsmdb/env.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+#include "util/test_util.h"
+
+namespace lsmdb {
+
+static void Deleter(const Slice& key, void* value) {}
+
+class CacheWarmupTest : public testing::Test {
+ public:
+  CacheWarmupTest()
+      : env_(NewMemEnv(Env::Default())),
+        cache_(NewLRUCache(1000)),
+        done_cv_(&mutex_),
+        done_(false),
+        loads_(0) {}
+
+  void Insert(std::shared_ptr<Cache> cache, const std::string& key) {
+    cache->Release(cache->Insert(key, nullptr, 1, &Deleter));
+  }
+
+  bool Contains(const std::string& key) {
+    Cache::Handle* handle = cache_->Lookup(key);
+    if (handle != nullptr) {
+      cache_->Release(handle);
+    }
+    return handle != nullptr;
+  }
+
+  // Warm up cache_ from "fname" and wait until it is done.
+  Status Warmup(const std::string& fname, uint64_t bytes_per_second,
+                uint64_t bytes_per_load) {
+    CacheWarmupOptions options;
+    options.bytes_per_second = bytes_per_second;
+    options.done = [this](const Status& s) {
+      MutexLock lock(&mutex_);
+      done_status_ = s;
+      done_ = true;
+      done_cv_.Signal();
+    };
+    std::shared_ptr<Cache> cache = cache_;
+    StartCacheWarmup(env_.get(), cache_, fname, options,
+                     [this, cache, bytes_per_load](const Slice& key,
+                                                   uint64_t* bytes_read) {
+                       if (key == missing_key_) {
+                         return Status::NotFound(key);
+                       }
+                       Insert(cache, key.ToString());
+                       *bytes_read = bytes_per_load;
+                       loads_++;
+                       return Status::OK();
+                     });
+    MutexLock lock(&mutex_);
+    while (!done_) {
+      done_cv_.Wait();
+    }
+    done_ = false;
+    return done_status_;
+  }
+
+  std::unique_ptr<Env> env_;
+  std::shared_ptr<Cache> cache_;
+  port::Mutex mutex_;
+  port::CondVar done_cv_;
+  bool done_;
+  Status done_status_;
+  int loads_;
+  // The loader fails on this key, as if its data was gone.
+  std::string missing_key_;
+};
+
+TEST_F(CacheWarmupTest, DumpAndRead) {
+  for (int i = 0; i < 100; ++i) {
+    Insert(cache_, std::to_string(i));
+  }
+  ASSERT_TRUE(Contains("42"));
+  Cache::Handle* in_use = cache_->Lookup("7");
+
+  ASSERT_LSMDB_OK(DumpCacheKeys(env_.get(), cache_.get(), 1000, "/dump"));
+  std::vector<std::string> keys;
+  ASSERT_LSMDB_OK(ReadCacheKeys(env_.get(), "/dump", &keys));
+  ASSERT_EQ(100, keys.size());
+  std::vector<std::string> sorted = keys;
+  std::sort(sorted.begin(), sorted.end());
+  ASSERT_TRUE(std::unique(sorted.begin(), sorted.end()) == sorted.end());
+
+  // The most recently used key of every shard comes first.
+  ASSERT_LSMDB_OK(DumpCacheKeys(env_.get(), cache_.get(), 16, "/dump"));
+  ASSERT_LSMDB_OK(ReadCacheKeys(env_.get(), "/dump", &keys));
+  ASSERT_EQ(16, keys.size());
+  ASSERT_TRUE(std::find(keys.begin(), keys.end(), "7") != keys.end());
+  ASSERT_TRUE(std::find(keys.begin(), keys.end(), "42") != keys.end());
+  cache_->Release(in_use);
+}
+
+TEST_F(CacheWarmupTest, BadDump) {
+  std::vector<std::string> keys;
+  ASSERT_TRUE(!ReadCacheKeys(env_.get(), "/missing", &keys).ok());
+  ASSERT_LSMDB_OK(WriteStringToFile(env_.get(), "garbage", "/dump"));
+  ASSERT_TRUE(ReadCacheKeys(env_.get(), "/dump", &keys).IsCorruption());
+  ASSERT_TRUE(!Warmup("/dump", 0, 0).ok());
+}
+
+TEST_F(CacheWarmupTest, Warmup) {
+  for (int i = 0; i < 50; ++i) {
+    Insert(cache_, std::to_string(i));
+  }
+  ASSERT_LSMDB_OK(DumpCacheKeys(env_.get(), cache_.get(), 1000, "/dump"));
+
+  // Simulate a restart, with one entry already loaded by a foreground read.
+  cache_ = NewLRUCache(1000);
+  Insert(cache_, "3");
+  ASSERT_LSMDB_OK(Warmup("/dump", 0, 0));
+  ASSERT_EQ(49, loads_);
+  for (int i = 0; i < 50; ++i) {
+    ASSERT_TRUE(Contains(std::to_string(i)));
+  }
+}
+
+TEST_F(CacheWarmupTest, LoaderError) {
+  for (int i = 0; i < 10; ++i) {
+    Insert(cache_, std::to_string(i));
+  }
+  ASSERT_LSMDB_OK(DumpCacheKeys(env_.get(), cache_.get(), 1000, "/dump"));
+  cache_ = NewLRUCache(1000);
+
+  // The failed key is reported, the others are still loaded.
+  missing_key_ = "5";
+  ASSERT_TRUE(Warmup("/dump", 0, 0).IsNotFound());
+  ASSERT_EQ(9, loads_);
+  ASSERT_TRUE(!Contains("5"));
+  ASSERT_TRUE(Contains("6"));
+}
+
+TEST_F(CacheWarmupTest, RateLimit) {
+  for (int i = 0; i < 10; ++i) {
+    Insert(cache_, std::to_string(i));
+  }
+  ASSERT_LSMDB_OK(DumpCacheKeys(env_.get(), cache_.get(), 1000, "/dump"));
+  cache_ = NewLRUCache(1000);
+
+  // 10 loads of 1000 bytes at 100000 bytes/sec take at least 100ms.
+  const uint64_t start = env_->NowMicros();
+  ASSERT_LSMDB_OK(Warmup("/dump", 100000, 1000));
+  ASSERT_GE(env_->NowMicros() - start, 90000);
+  ASSERT_EQ(10, loads_);
+}
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
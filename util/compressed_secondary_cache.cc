@@ -0,0 +1,145 @@
+//
+// Created by 刘文景 on 2021/4/12.
+//
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "lsmdb/cache.h"
+#include "lsmdb/secondary_cache.h"
+#include "port/port.h"
+
+namespace lsmdb {
+
+namespace {
+
+// The first byte of every stored entry tells how the rest is encoded.
+enum CompressionType : char {
+  kNoCompression = 0x0,
+  kSnappyCompression = 0x1,
+};
+
+uint64_t MicrosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Keeps the compressed entries in a private LRU cache whose values are
+// heap-allocated std::string and whose charges are the compressed sizes.
+class CompressedSecondaryCache : public SecondaryCache {
+ public:
+  explicit CompressedSecondaryCache(size_t capacity)
+      : cache_(NewLRUCache(capacity)),
+        inserts_(0),
+        lookups_(0),
+        hits_(0),
+        bytes_inserted_(0),
+        bytes_stored_(0),
+        insert_micros_(0),
+        lookup_micros_(0) {}
+
+  ~CompressedSecondaryCache() override = default;
+
+  Status Insert(const Slice& key, const Slice& data) override {
+    const auto start = std::chrono::steady_clock::now();
+    auto* stored = new std::string;
+    stored->push_back(kSnappyCompression);
+    if (!port::Snappy_Compress(data.data(), data.size(), stored) ||
+        // Compression must save at least 12.5% to be worth the CPU on
+        // every lookup.
+        stored->size() >= data.size() - data.size() / 8) {
+      stored->clear();
+      stored->push_back(kNoCompression);
+      stored->append(data.data(), data.size());
+    }
+    cache_->Release(cache_->Insert(key, stored, stored->size(), &DeleteEntry));
+
+    inserts_.fetch_add(1, std::memory_order_relaxed);
+    bytes_inserted_.fetch_add(data.size(), std::memory_order_relaxed);
+    bytes_stored_.fetch_add(stored->size(), std::memory_order_relaxed);
+    insert_micros_.fetch_add(MicrosSince(start), std::memory_order_relaxed);
+    return Status::OK();
+  }
+
+  bool Lookup(const Slice& key, std::string* data) override {
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    Cache::Handle* handle = cache_->Lookup(key);
+    if (handle == nullptr) {
+      return false;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const auto* stored =
+        reinterpret_cast<const std::string*>(cache_->Value(handle));
+    bool ok = Decode(*stored, data);
+    cache_->Release(handle);
+    // The caller promotes the entry, keeping it here would waste memory.
+    cache_->Erase(key);
+    lookup_micros_.fetch_add(MicrosSince(start), std::memory_order_relaxed);
+    if (ok) {
+      hits_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ok;
+  }
+
+  void Erase(const Slice& key) override { cache_->Erase(key); }
+
+  size_t TotalCharge() const override { return cache_->TotalCharge(); }
+
+  SecondaryCacheStats GetStats() const override {
+    SecondaryCacheStats stats;
+    stats.inserts = inserts_.load(std::memory_order_relaxed);
+    stats.lookups = lookups_.load(std::memory_order_relaxed);
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.bytes_inserted = bytes_inserted_.load(std::memory_order_relaxed);
+    stats.bytes_stored = bytes_stored_.load(std::memory_order_relaxed);
+    stats.insert_micros = insert_micros_.load(std::memory_order_relaxed);
+    stats.lookup_micros = lookup_micros_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  static void DeleteEntry(const Slice& key, void* value) {
+    delete reinterpret_cast<std::string*>(value);
+  }
+
+  static bool Decode(const std::string& stored, std::string* data) {
+    const char* contents = stored.data() + 1;
+    const size_t length = stored.size() - 1;
+    switch (stored[0]) {
+      case kNoCompression:
+        data->assign(contents, length);
+        return true;
+      case kSnappyCompression: {
+        size_t ulength;
+        if (!port::Snappy_GetUncompressedLength(contents, length, &ulength)) {
+          return false;
+        }
+        data->resize(ulength);
+        return port::Snappy_Uncompress(contents, length, &(*data)[0]);
+      }
+      default:
+        return false;
+    }
+  }
+
+  const std::shared_ptr<Cache> cache_;
+
+  // Counters are not tied to each other, so relaxed ordering is enough.
+  std::atomic<uint64_t> inserts_;
+  std::atomic<uint64_t> lookups_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> bytes_inserted_;
+  std::atomic<uint64_t> bytes_stored_;
+  std::atomic<uint64_t> insert_micros_;
+  std::atomic<uint64_t> lookup_micros_;
+};
+
+}  // namespace
+
+std::shared_ptr<SecondaryCache> NewCompressedSecondaryCache(size_t capacity) {
+  return std::make_shared<CompressedSecondaryCache>(capacity);
+}
+
+}  // namespace lsmdb
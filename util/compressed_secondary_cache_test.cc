@@ -0,0 +1,220 @@
+//
+// Created by 刘文景 on 2021/4/12.
+//
+
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "lsmdb/cache.h"
+#include "lsmdb/secondary_cache.h"
+#include "port/port.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+#include "util/test_util.h"
+
+namespace lsmdb {
+
+static std::string EncodeKey(int k) {
+  std::string result;
+  PutFixed32(&result, k);
+  return result;
+}
+
+// Values are heap-allocated strings so that they can be serialized.
+static void DeleteValue(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+static void SaveValue(void* value, std::string* dst) {
+  dst->append(*reinterpret_cast<std::string*>(value));
+}
+
+static void* CreateValue(const Slice& data, size_t* charge) {
+  *charge = 1;
+  return new std::string(data.data(), data.size());
+}
+
+// Forwards to another secondary cache, but holds up the insertion of
+// "blocked_key" until Unblock() is called.
+class BlockingSecondaryCache : public SecondaryCache {
+ public:
+  BlockingSecondaryCache(std::shared_ptr<SecondaryCache> target,
+                         std::string blocked_key)
+      : target_(std::move(target)),
+        blocked_key_(std::move(blocked_key)),
+        cv_(&mu_),
+        blocked_(false),
+        unblocked_(false) {}
+
+  Status Insert(const Slice& key, const Slice& data) override {
+    if (key == blocked_key_) {
+      MutexLock l(&mu_);
+      blocked_ = true;
+      cv_.SignalAll();
+      while (!unblocked_) {
+        cv_.Wait();
+      }
+    }
+    return target_->Insert(key, data);
+  }
+  bool Lookup(const Slice& key, std::string* data) override {
+    return target_->Lookup(key, data);
+  }
+  void Erase(const Slice& key) override { target_->Erase(key); }
+  size_t TotalCharge() const override { return target_->TotalCharge(); }
+  SecondaryCacheStats GetStats() const override {
+    return target_->GetStats();
+  }
+
+  // Waits until the insertion of the blocked key started.
+  void WaitUntilBlocked() {
+    MutexLock l(&mu_);
+    while (!blocked_) {
+      cv_.Wait();
+    }
+  }
+
+  void Unblock() {
+    MutexLock l(&mu_);
+    unblocked_ = true;
+    cv_.SignalAll();
+  }
+
+ private:
+  const std::shared_ptr<SecondaryCache> target_;
+  const std::string blocked_key_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  bool blocked_;
+  bool unblocked_;
+};
+
+class CompressedSecondaryCacheTest : public testing::Test {
+ public:
+  CompressedSecondaryCacheTest()
+      : secondary_(NewCompressedSecondaryCache(1 << 20)), rnd_(301) {
+    helper_.save = SaveValue;
+    helper_.create = CreateValue;
+    helper_.deleter = DeleteValue;
+  }
+
+  std::string Value(int i) {
+    std::string value;
+    test::CompressibleString(&rnd_, 0.25, 1000, &value);
+    value += std::to_string(i);
+    return value;
+  }
+
+  std::shared_ptr<SecondaryCache> secondary_;
+  Cache::ItemHelper helper_;
+  Random rnd_;
+};
+
+TEST_F(CompressedSecondaryCacheTest, InsertAndLookup) {
+  std::string data;
+  ASSERT_TRUE(!secondary_->Lookup("missing", &data));
+
+  const std::string value = Value(1);
+  ASSERT_LSMDB_OK(secondary_->Insert("k1", value));
+  ASSERT_LSMDB_OK(secondary_->Insert("empty", ""));
+  ASSERT_TRUE(secondary_->Lookup("k1", &data));
+  ASSERT_EQ(value, data);
+  ASSERT_TRUE(secondary_->Lookup("empty", &data));
+  ASSERT_EQ("", data);
+
+  // A hit removes the entry since it is promoted by the caller.
+  ASSERT_TRUE(!secondary_->Lookup("k1", &data));
+  ASSERT_EQ(0, secondary_->TotalCharge());
+
+  SecondaryCacheStats stats = secondary_->GetStats();
+  ASSERT_EQ(2, stats.inserts);
+  ASSERT_EQ(4, stats.lookups);
+  ASSERT_EQ(2, stats.hits);
+  ASSERT_EQ(0.5, stats.HitRatio());
+  ASSERT_EQ(value.size(), stats.bytes_inserted);
+}
+
+TEST_F(CompressedSecondaryCacheTest, Erase) {
+  std::string data;
+  ASSERT_LSMDB_OK(secondary_->Insert("k1", Value(1)));
+  secondary_->Erase("k1");
+  ASSERT_TRUE(!secondary_->Lookup("k1", &data));
+}
+
+TEST_F(CompressedSecondaryCacheTest, EvictedEntriesArePromoted) {
+  // Every shard of the primary cache holds a single entry.
+  std::shared_ptr<Cache> cache = NewLRUCache(16, secondary_);
+  const int kNum = 100;
+  std::string values[kNum];
+  for (int i = 0; i < kNum; ++i) {
+    values[i] = Value(i);
+    cache->Release(cache->Insert(EncodeKey(i), new std::string(values[i]), 1,
+                                 &helper_));
+  }
+  ASSERT_LE(cache->TotalCharge(), 16);
+  ASSERT_GT(secondary_->TotalCharge(), 0);
+
+  for (int i = 0; i < kNum; ++i) {
+    Cache::Handle* handle = cache->Lookup(EncodeKey(i), &helper_);
+    ASSERT_TRUE(handle != nullptr);
+    ASSERT_EQ(values[i], *reinterpret_cast<std::string*>(cache->Value(handle)));
+    cache->Release(handle);
+  }
+  ASSERT_GT(secondary_->GetStats().hits, 0);
+
+  // Erasing from the primary cache also drops the secondary copy.
+  for (int i = 0; i < kNum; ++i) {
+    cache->Erase(EncodeKey(i));
+    ASSERT_TRUE(cache->Lookup(EncodeKey(i), &helper_) == nullptr);
+  }
+}
+
+TEST_F(CompressedSecondaryCacheTest, PlainInsertSpillsEvictedEntries) {
+  std::shared_ptr<Cache> cache = NewLRUCache(16, secondary_);
+  const std::string value = Value(0);
+  cache->Release(
+      cache->Insert(EncodeKey(0), new std::string(value), 1, &helper_));
+  // Entries without a helper evict the first one, which still moves to
+  // the secondary cache.
+  for (int i = 1; i < 100; ++i) {
+    cache->Release(cache->Insert(EncodeKey(i), new std::string(Value(i)), 1,
+                                 DeleteValue));
+  }
+  std::string data;
+  ASSERT_TRUE(secondary_->Lookup(EncodeKey(0), &data));
+  ASSERT_EQ(value, data);
+}
+
+TEST_F(CompressedSecondaryCacheTest, EraseRacingSpill) {
+  auto blocking =
+      std::make_shared<BlockingSecondaryCache>(secondary_, EncodeKey(0));
+  std::shared_ptr<Cache> cache = NewLRUCache(16, blocking);
+  cache->Release(
+      cache->Insert(EncodeKey(0), new std::string(Value(0)), 1, &helper_));
+
+  // Evict the entry, and erase it while it is on its way to the secondary
+  // cache.
+  std::thread inserter([&]() {
+    for (int i = 1; i < 100; ++i) {
+      cache->Release(cache->Insert(EncodeKey(i), new std::string(Value(i)), 1,
+                                   &helper_));
+    }
+  });
+  blocking->WaitUntilBlocked();
+  cache->Erase(EncodeKey(0));
+  blocking->Unblock();
+  inserter.join();
+
+  ASSERT_TRUE(cache->Lookup(EncodeKey(0), &helper_) == nullptr);
+  std::string data;
+  ASSERT_TRUE(!secondary_->Lookup(EncodeKey(0), &data));
+}
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -7,6 +7,7 @@
 #include <cstdarg>
 #include <vector>
 #include <memory>
+#include <utility>
 
 // This workaround can be removed when leveldb::Env::DeleteFile is removed.
 // See env.h for justification.
@@ -16,6 +17,17 @@
 
 namespace lsmdb {
 
+namespace {
+
+// Requests read by the default RandomAccessFile::ReadAsync() that the
+// calling thread did not get back from Env::PollReads() yet.
+std::vector<ReadRequest*>& FinishedReads() {
+  thread_local std::vector<ReadRequest*> reads;
+  return reads;
+}
+
+}  // namespace
+
 Env::Env() = default;
 
 Env::~Env() = default;
@@ -24,12 +36,97 @@ Status Env::NewAppendableFile(const std::string &filename, WritableFile **result
   return Status::NotSupported("NewAppendableFile", filename);
 }
 
+Status Env::NewSequentialFile(const std::string& filename,
+                              const FileOptions& options,
+                              SequentialFile** result) {
+  return NewSequentialFile(filename, result);
+}
+
+Status Env::NewWritableFile(const std::string& filename,
+                            const FileOptions& options,
+                            WritableFile** result) {
+  return NewWritableFile(filename, result);
+}
+
+Status Env::NewAppendableFile(const std::string& filename,
+                              const FileOptions& options,
+                              WritableFile** result) {
+  return NewAppendableFile(filename, result);
+}
+
+Status Env::NewRandomAccessFile(const std::string& filename,
+                                const FileOptions& options,
+                                RandomAccessFile** result) {
+  return NewRandomAccessFile(filename, result);
+}
+
+Status Env::SyncDir(const std::string& dirname) {
+  return Status::NotSupported("SyncDir", dirname);
+}
+
+Status Env::PollReads(size_t min_completions,
+                      std::vector<ReadRequest*>* completed) {
+  // Every read in the list already finished, there is nothing to wait for.
+  std::vector<ReadRequest*>& reads = FinishedReads();
+  completed->insert(completed->end(), reads.begin(), reads.end());
+  reads.clear();
+  return Status::OK();
+}
+
+void Env::Schedule(std::function<void(void*)> func, void* arg,
+                   Priority priority, void* tag) {
+  Schedule(std::move(func), arg);
+}
+
+int Env::Unschedule(void* tag, Priority priority) { return 0; }
+
+void Env::SetThreadPoolOptions(Priority priority,
+                               const ThreadPoolOptions& options) {}
+
+ThreadPoolStats Env::GetThreadPoolStats(Priority priority) {
+  return ThreadPoolStats();
+}
+
+void Env::SetMmapOptions(const MmapOptions& options) {}
+
+MmapStats Env::GetMmapStats() { return MmapStats(); }
+
+FdCacheStats Env::GetFdCacheStats() { return FdCacheStats(); }
+
 SequentialFile::~SequentialFile() = default;
 
 RandomAccessFile::~RandomAccessFile() = default;
 
+Status RandomAccessFile::ReadAsync(ReadRequest* req) const {
+  req->status = Read(req->offset, req->n, &req->result, req->scratch);
+  FinishedReads().push_back(req);
+  return Status::OK();
+}
+
+Status RandomAccessFile::MultiRead(ReadRequest* reqs, size_t n) const {
+  for (size_t i = 0; i < n; ++i) {
+    reqs[i].status =
+        Read(reqs[i].offset, reqs[i].n, &reqs[i].result, reqs[i].scratch);
+  }
+  return Status::OK();
+}
+
 WritableFile::~WritableFile() = default;
 
+Status WritableFile::Append(const Slice* parts, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    Status status = Append(parts[i]);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+void WritableFile::SyncAsync(std::function<void(const Status&)> callback) {
+  callback(Sync());
+}
+
 Logger::~Logger() = default;
 
 FileLock::~FileLock() = default;
@@ -10,15 +10,22 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <deque>
 #include <limits>
-#include <queue>
+#include <list>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <thread>
@@ -32,8 +39,19 @@
 #include "port/port.h"
 #include "port/thread_annotations.h"
 #include "util/env_posix_test_helper.h"
+#include "util/mutexlock.h"
 #include "util/posix_logger.h"
 
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif  // HAVE_IO_URING
+#if HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif  // HAVE_SCHED_SETAFFINITY
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif  // defined(__linux__)
+
 namespace lsmdb {
 
 namespace {
@@ -54,7 +72,37 @@ constexpr const int kOpenBaseFlags = O_CLOEXEC;
 constexpr const int kOpenBaseFlags = 0;
 #endif  // defined(HAVE_O_CLOEXEC)
 
-constexpr const size_t kWritableFileBufferSize = 65536;
+// Rate-limited writes are charged and issued in pieces of this size. A
+// multiple of kDirectIOAlignment, so direct writes can be split too.
+constexpr const size_t kRateLimitedWriteSize = 65536;
+
+// Bounds of the regions mapped by PosixMmapWritableFile. Each region is
+// twice as large as the previous one, so that short files grow in small
+// steps and long ones in few.
+constexpr const size_t kMmapWriteMinRegionSize = 65536;
+constexpr const size_t kMmapWriteMaxRegionSize = 4 << 20;
+
+// Can be set using EnvPosixTestHelper::SetUseIoUring().
+std::atomic<bool> g_use_io_uring(true);
+
+// Directory fsyncs so far, read by EnvPosixTestHelper::GetDirSyncCount().
+std::atomic<uint64_t> g_dir_syncs(0);
+
+// MultiRead() reads two ranges at once if at most this many bytes lie
+// between them, trading some wasted bandwidth for fewer system calls.
+constexpr const size_t kMultiReadMaxGap = 4096;
+
+// Alignment of the offsets, sizes and buffers of direct I/O. Logical
+// block sizes are 512 or 4096 bytes in practice.
+constexpr const size_t kDirectIOAlignment = 4096;
+static_assert(kRateLimitedWriteSize % kDirectIOAlignment == 0,
+              "rate-limited direct writes must stay aligned");
+
+#if defined(IOV_MAX)
+constexpr const size_t kMaxIovecs = IOV_MAX;
+#else
+constexpr const size_t kMaxIovecs = 1024;
+#endif  // defined(IOV_MAX)
 
 Status PosixError(const std::string& context, int error_number) {
   if (error_number == ENOENT) {  // Error NO ENTry
@@ -64,6 +112,92 @@ Status PosixError(const std::string& context, int error_number) {
   }
 }
 
+#if defined(O_DIRECT)
+constexpr const int kOpenDirectFlag = O_DIRECT;
+#else
+constexpr const int kOpenDirectFlag = 0;
+#endif  // defined(O_DIRECT)
+
+// Opens "filename" like ::open(), adding O_DIRECT if "direct" is true.
+// Stores the new descriptor in *fd.
+Status OpenFile(const std::string& filename, int flags, bool direct, int* fd) {
+  if (direct) {
+    if (kOpenDirectFlag == 0) {
+      *fd = -1;
+      return Status::NotSupported(filename, "direct I/O");
+    }
+    flags |= kOpenDirectFlag;
+  }
+  *fd = ::open(filename.c_str(), flags | kOpenBaseFlags, 0644);
+  if (*fd < 0) {
+    if (direct && errno == EINVAL) {
+      // The file system does not support O_DIRECT.
+      return Status::NotSupported(filename, "direct I/O");
+    }
+    return PosixError(filename, errno);
+  }
+  return Status::OK();
+}
+
+uint64_t TruncateToAlignment(uint64_t n) {
+  return n - n % kDirectIOAlignment;
+}
+
+uint64_t RoundUpToAlignment(uint64_t n) {
+  return TruncateToAlignment(n + kDirectIOAlignment - 1);
+}
+
+bool IsAligned(const void* p) {
+  return reinterpret_cast<uintptr_t>(p) % kDirectIOAlignment == 0;
+}
+
+struct AlignedDeleter {
+  void operator()(char* p) const { std::free(p); }
+};
+
+// Memory suitable for direct I/O.
+using AlignedBuffer = std::unique_ptr<char[], AlignedDeleter>;
+
+AlignedBuffer NewAlignedBuffer(size_t size) {
+  void* p = nullptr;
+  if (::posix_memalign(&p, kDirectIOAlignment, size) != 0) {
+    // Behave like operator new without exceptions.
+    std::abort();
+  }
+  return AlignedBuffer(reinterpret_cast<char*>(p));
+}
+
+// Reads up to "n" bytes at "offset" of "fd", which was opened with
+// O_DIRECT, through an aligned bounce buffer unless the request is
+// aligned already. Returns the result of pread().
+ssize_t DirectPread(int fd, uint64_t offset, size_t n, char* scratch) {
+  const uint64_t aligned_offset = TruncateToAlignment(offset);
+  const size_t skip = static_cast<size_t>(offset - aligned_offset);
+  const size_t aligned_size = RoundUpToAlignment(skip + n);
+  if (skip == 0 && aligned_size == n && IsAligned(scratch)) {
+    return ::pread(fd, scratch, n, static_cast<off_t>(offset));
+  }
+  AlignedBuffer buffer = NewAlignedBuffer(aligned_size);
+  ssize_t read_size = ::pread(fd, buffer.get(), aligned_size,
+                              static_cast<off_t>(aligned_offset));
+  if (read_size < 0) {
+    return read_size;
+  }
+  // The read stops short at the end of the file.
+  const size_t copy_size =
+      static_cast<size_t>(read_size) > skip
+          ? std::min(n, static_cast<size_t>(read_size) - skip)
+          : 0;
+  std::memcpy(scratch, buffer.get() + skip, copy_size);
+  return static_cast<ssize_t>(copy_size);
+}
+
+uint64_t MonotonicMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 // Helper class to limit resource usage to avoid exhaustion.
 // Currently used to limit read-only files descriptors and mmap
 // file usage so that we do not run out of file descriptors or
@@ -97,47 +231,646 @@ class Limiter : public noncopyable {
   std::atomic<int> acquires_allowed_;
 };
 
+// Keeps the descriptors of the random access files that did not get a
+// permanent one open, up to a fixed number, and closes the least
+// recently used idle one when another file needs a descriptor. A file
+// whose descriptor was closed reopens it on its next read.
+//
+// Thread-safe.
+class PosixFdCache : public noncopyable {
+ public:
+  // The descriptor of one file. Members are guarded by the cache's
+  // mutex.
+  struct Entry {
+    int fd = -1;    // -1 if closed.
+    int pins = 0;   // Reads using fd.
+    std::list<Entry*>::iterator lru_pos;  // Valid if idle and open.
+  };
+
+  explicit PosixFdCache(int capacity) : capacity_(capacity), open_fds_(0) {}
+
+  ~PosixFdCache() { assert(lru_.empty()); }
+
+  // Keep "fd", just opened for *entry, open if there is room. Takes
+  // ownership of fd.
+  void Insert(Entry* entry, int fd) {
+    MutexLock l(&mutex_);
+    assert(entry->fd == -1);
+    if (MakeRoom()) {
+      entry->fd = fd;
+      lru_.push_back(entry);
+      entry->lru_pos = std::prev(lru_.end());
+    } else {
+      ::close(fd);
+    }
+  }
+
+  // Store in *fd a descriptor of "filename" for a read and set *cached
+  // to whether it belongs to *entry. It stays open until the matching
+  // Unpin(). When every cached descriptor is in use, a temporary one is
+  // opened instead.
+  Status Pin(Entry* entry, const std::string& filename, bool direct, int* fd,
+             bool* cached) {
+    {
+      MutexLock l(&mutex_);
+      if (entry->fd != -1) {
+        if (entry->pins++ == 0) {
+          lru_.erase(entry->lru_pos);
+        }
+        ++stats_.hits;
+        *fd = entry->fd;
+        *cached = true;
+        return Status::OK();
+      }
+      *cached = MakeRoom();
+      if (*cached) {
+        ++stats_.misses;
+        // The room is taken now, the file is opened without the lock.
+        ++entry->pins;
+      } else {
+        ++stats_.uncached;
+      }
+    }
+
+    Status status = OpenFile(filename, O_RDONLY, direct, fd);
+    if (!*cached) {
+      return status;
+    }
+    MutexLock l(&mutex_);
+    if (!status.ok() || entry->fd != -1) {
+      // Failed, or a concurrent read opened the file first.
+      --open_fds_;
+      if (status.ok()) {
+        ::close(*fd);
+        *fd = entry->fd;
+      } else {
+        --entry->pins;
+        ReturnIfIdle(entry);
+      }
+      return status;
+    }
+    entry->fd = *fd;
+    return Status::OK();
+  }
+
+  // Release a descriptor returned by Pin().
+  void Unpin(Entry* entry, int fd, bool cached) {
+    if (!cached) {
+      ::close(fd);
+      return;
+    }
+    MutexLock l(&mutex_);
+    assert(entry->pins > 0 && entry->fd == fd);
+    --entry->pins;
+    ReturnIfIdle(entry);
+  }
+
+  // Close the descriptor of *entry, if open. REQUIRES: *entry is not
+  // pinned.
+  void Erase(Entry* entry) {
+    MutexLock l(&mutex_);
+    assert(entry->pins == 0);
+    if (entry->fd != -1) {
+      lru_.erase(entry->lru_pos);
+      Close(entry);
+    }
+  }
+
+  FdCacheStats GetStats() {
+    MutexLock l(&mutex_);
+    FdCacheStats stats = stats_;
+    stats.capacity = capacity_;
+    stats.open_fds = open_fds_;
+    return stats;
+  }
+
+ private:
+  // Count a new descriptor, closing the least recently used idle one if
+  // the cache is full. Returns false if every descriptor is in use.
+  bool MakeRoom() EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    if (open_fds_ >= capacity_) {
+      if (lru_.empty()) {
+        return false;
+      }
+      Entry* victim = lru_.front();
+      lru_.pop_front();
+      Close(victim);
+      ++stats_.evictions;
+    }
+    ++open_fds_;
+    return true;
+  }
+
+  void Close(Entry* entry) EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    ::close(entry->fd);
+    entry->fd = -1;
+    --open_fds_;
+  }
+
+  // Make *entry evictable if it is open and no read uses it.
+  void ReturnIfIdle(Entry* entry) EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    if (entry->pins == 0 && entry->fd != -1) {
+      lru_.push_back(entry);
+      entry->lru_pos = std::prev(lru_.end());
+    }
+  }
+
+  const int capacity_;
+
+  port::Mutex mutex_;
+  // Idle entries with an open descriptor, least recently used first.
+  std::list<Entry*> lru_ GUARDED_BY(mutex_);
+  // Descriptors open or being opened.
+  int open_fds_ GUARDED_BY(mutex_);
+  FdCacheStats stats_ GUARDED_BY(mutex_);
+};
+
+#if HAVE_IO_URING
+// Asynchronous reads of one thread through io_uring. The system calls are
+// issued directly so that liburing is not needed.
+//
+// Reads are only queued by Read(), and submitted in a batch by the next
+// Reap(), so that many reads cost a single system call.
+//
+// Instances are not thread-safe, every thread uses its own ring.
+class PosixIoUring : public noncopyable {
+ public:
+  // Returns the ring of the calling thread, creating it if needed, or
+  // nullptr if io_uring is not available.
+  static PosixIoUring* Current() {
+    static std::atomic<bool> unavailable(false);
+    if (!g_use_io_uring.load(std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    std::unique_ptr<PosixIoUring>& ring = ThreadRing();
+    if (ring == nullptr && !unavailable.load(std::memory_order_relaxed)) {
+      ring.reset(Create());
+      if (ring == nullptr) {
+        // Most likely an old kernel or a seccomp filter, do not retry.
+        unavailable.store(true, std::memory_order_relaxed);
+      }
+    }
+    return ring.get();
+  }
+
+  // Returns the ring of the calling thread if it has one.
+  static PosixIoUring* CurrentIfCreated() { return ThreadRing().get(); }
+
+  ~PosixIoUring() {
+    ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_) {
+      ::munmap(cq_ring_, cq_ring_size_);
+    }
+    ::munmap(sq_ring_, sq_ring_size_);
+    ::close(ring_fd_);
+  }
+
+  // Queue a read of "req" from "fd". "filename" is used in error messages.
+  Status Read(int fd, const std::string* filename, ReadRequest* req) {
+    // Longer reads are cut short, just like pread() may do.
+    return Queue(IORING_OP_READ, fd, reinterpret_cast<uintptr_t>(req->scratch),
+                 static_cast<uint32_t>(std::min<size_t>(
+                     req->n, std::numeric_limits<uint32_t>::max())),
+                 req->offset, filename, req);
+  }
+
+  // Queue a read at "offset" of "fd" into the buffers of iov[0, iovcnt-1],
+  // which must stay alive until the read finished. The number of bytes
+  // read ends up in the size of req->result.
+  Status ReadV(int fd, const std::string* filename, const struct iovec* iov,
+               size_t iovcnt, uint64_t offset, ReadRequest* req) {
+    return Queue(IORING_OP_READV, fd, reinterpret_cast<uintptr_t>(iov),
+                 static_cast<uint32_t>(iovcnt), offset, filename, req);
+  }
+
+  // Submit the queued reads and wait until every request of "reqs" has
+  // finished. Other reads that finish meanwhile are handed out by the
+  // next Reap().
+  Status WaitAll(const std::vector<ReadRequest*>& reqs) {
+    size_t pending = reqs.size();
+    while (true) {
+      for (ReadRequest* req : reqs) {
+        auto iter = std::find(early_completions_.begin(),
+                              early_completions_.end(), req);
+        if (iter != early_completions_.end()) {
+          early_completions_.erase(iter);
+          --pending;
+        }
+      }
+      if (pending == 0) {
+        return Status::OK();
+      }
+      Status status = Wait(1, &early_completions_);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+
+  // Submit the queued reads, wait until "min_completions" reads finished,
+  // or all of them if fewer are in flight, and append every finished
+  // read to *completed.
+  Status Reap(size_t min_completions, std::vector<ReadRequest*>* completed) {
+    const size_t early = early_completions_.size();
+    completed->insert(completed->end(), early_completions_.begin(),
+                      early_completions_.end());
+    early_completions_.clear();
+    return Wait(min_completions > early ? min_completions - early : 0,
+                completed);
+  }
+
+ private:
+  struct Slot {
+    ReadRequest* req;
+    const std::string* filename;
+  };
+
+  Status Queue(uint8_t opcode, int fd, uint64_t addr, uint32_t len,
+               uint64_t offset, const std::string* filename,
+               ReadRequest* req) {
+    if (free_slots_.empty()) {
+      // Every slot is in flight; make room, and hand the finished reads
+      // out with the next Reap().
+      Status status = Wait(1, &early_completions_);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    const unsigned slot = free_slots_.back();
+    free_slots_.pop_back();
+    slots_[slot].req = req;
+    slots_[slot].filename = filename;
+
+    const unsigned tail = *sq_tail_;
+    const unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->user_data = slot;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++unsubmitted_;
+    return Status::OK();
+  }
+
+  // The ring is closed when the thread exits.
+  static std::unique_ptr<PosixIoUring>& ThreadRing() {
+    thread_local std::unique_ptr<PosixIoUring> ring;
+    return ring;
+  }
+
+  static PosixIoUring* Create();
+
+  explicit PosixIoUring(unsigned entries) : slots_(entries), unsubmitted_(0) {
+    for (unsigned i = 0; i < entries; ++i) {
+      free_slots_.push_back(entries - 1 - i);
+    }
+  }
+
+  size_t InFlight() const { return slots_.size() - free_slots_.size(); }
+
+  Status Wait(size_t min_completions, std::vector<ReadRequest*>* completed) {
+    size_t reaped = Harvest(completed);
+    const size_t wanted = std::min(min_completions, reaped + InFlight());
+    while (unsubmitted_ > 0 || reaped < wanted) {
+      const unsigned min_complete =
+          reaped < wanted ? static_cast<unsigned>(wanted - reaped) : 0;
+      const int result = ::syscall(
+          __NR_io_uring_enter, ring_fd_, unsubmitted_, min_complete,
+          min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return PosixError("io_uring_enter", errno);
+      }
+      // Without SQPOLL the kernel consumes the submitted entries in place.
+      unsubmitted_ -= static_cast<unsigned>(result);
+      reaped += Harvest(completed);
+    }
+    return Status::OK();
+  }
+
+  // Appends the reads that finished to *completed, returns their number.
+  size_t Harvest(std::vector<ReadRequest*>* completed) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+      Slot& slot = slots_[cqe.user_data];
+      ReadRequest* req = slot.req;
+      if (cqe.res < 0) {
+        req->result = Slice(req->scratch, 0);
+        req->status = PosixError(*slot.filename, -cqe.res);
+      } else {
+        req->result = Slice(req->scratch, cqe.res);
+        req->status = Status::OK();
+      }
+      completed->push_back(req);
+      free_slots_.push_back(static_cast<unsigned>(cqe.user_data));
+      ++count;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  int ring_fd_;
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;  // Same as sq_ring_ if the kernel maps both rings at once.
+  size_t cq_ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  // One slot per read in flight, never more than the submission queue
+  // holds, so that the completion queue can not overflow either.
+  std::vector<Slot> slots_;
+  std::vector<unsigned> free_slots_;
+  unsigned unsubmitted_;  // Queued by Read() but not submitted yet.
+  std::vector<ReadRequest*> early_completions_;
+};
+
+PosixIoUring* PosixIoUring::Create() {
+  static constexpr unsigned kEntries = 256;
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  const int ring_fd = ::syscall(__NR_io_uring_setup, kEntries, &params);
+  if (ring_fd < 0) {
+    return nullptr;
+  }
+#if defined(IORING_FEAT_RW_CUR_POS)
+  // Added in the same release as IORING_OP_READ.
+  if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+    ::close(ring_fd);
+    return nullptr;
+  }
+#endif  // defined(IORING_FEAT_RW_CUR_POS)
+
+  size_t sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  }
+  void* sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    ::close(ring_fd);
+    return nullptr;
+  }
+  void* cq_ring = sq_ring;
+  if (!single_mmap) {
+    cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      ::munmap(sq_ring, sq_ring_size);
+      ::close(ring_fd);
+      return nullptr;
+    }
+  }
+  const size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (cq_ring != sq_ring) {
+      ::munmap(cq_ring, cq_ring_size);
+    }
+    ::munmap(sq_ring, sq_ring_size);
+    ::close(ring_fd);
+    return nullptr;
+  }
+
+  char* sq = reinterpret_cast<char*>(sq_ring);
+  char* cq = reinterpret_cast<char*>(cq_ring);
+  PosixIoUring* ring = new PosixIoUring(params.sq_entries);
+  ring->ring_fd_ = ring_fd;
+  ring->sq_ring_ = sq_ring;
+  ring->sq_ring_size_ = sq_ring_size;
+  ring->cq_ring_ = cq_ring;
+  ring->cq_ring_size_ = cq_ring_size;
+  ring->sqes_ = reinterpret_cast<struct io_uring_sqe*>(sqes);
+  ring->sqes_size_ = sqes_size;
+  ring->sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  ring->sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  ring->sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  ring->cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  ring->cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  ring->cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  ring->cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+  return ring;
+}
+#endif  // HAVE_IO_URING
+
 // Implements sequential read access in a file using read().
 //
 // Instance of this class are thread-friendly but not thread-safe,
 // as required by the SequentialFile API.
 class PosixSequentialFile final : public SequentialFile {
  public:
-  PosixSequentialFile(std::string filename, int fd)
-      : fd_(fd), filename_(std::move(filename)) {}
+  // If |direct| is true, |fd| was opened with O_DIRECT. See FileOptions
+  // for the meaning of the other arguments.
+  PosixSequentialFile(std::string filename, int fd, bool direct,
+                      size_t readahead_size, bool drop_consumed_pages)
+      : fd_(fd),
+        direct_(direct),
+        drop_consumed_pages_(drop_consumed_pages && !direct),
+        readahead_size_(direct ? RoundUpToAlignment(readahead_size)
+                               : readahead_size),
+        buf_(readahead_size_ > 0 ? NewAlignedBuffer(readahead_size_)
+                                 : AlignedBuffer()),
+        buf_pos_(0),
+        buf_len_(0),
+        offset_(0),
+        dropped_offset_(0),
+        filename_(std::move(filename)) {
+#if HAVE_POSIX_FADVISE
+    if (!direct_) {
+      // Let the kernel read ahead more aggressively than by default.
+      ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif  // HAVE_POSIX_FADVISE
+    if (readahead_size_ > 0) {
+      ReadAhead();
+    }
+  }
 
-  ~PosixSequentialFile() override { close(fd_); }
+  ~PosixSequentialFile() override {
+    DropConsumedPages(true);
+    close(fd_);
+  }
 
   Status Read(size_t n, Slice* result, char* scrach) override {
-    Status status;
+    if (readahead_size_ == 0) {
+      Status status = ReadAt(n, scrach, result);
+      DropConsumedPages(false);
+      return status;
+    }
+
+    // Serve what we can from the buffer, then refill it, except for reads
+    // at least as large as the buffer, which go to the file directly.
+    size_t copied = 0;
+    while (copied < n) {
+      if (buf_pos_ < buf_len_) {
+        const size_t copy_size = std::min(n - copied, buf_len_ - buf_pos_);
+        std::memcpy(scrach + copied, buf_.get() + buf_pos_, copy_size);
+        buf_pos_ += copy_size;
+        copied += copy_size;
+        continue;
+      }
+
+      const bool unbuffered = n - copied >= readahead_size_;
+      Slice read;
+      Status status;
+      if (unbuffered) {
+        status = ReadAt(n - copied, scrach + copied, &read);
+      } else {
+        status = ReadAt(readahead_size_, buf_.get(), &read);
+        buf_pos_ = 0;
+        buf_len_ = read.size();
+      }
+      if (!status.ok()) {
+        *result = Slice(scrach, 0);
+        return status;
+      }
+      ReadAhead();
+      DropConsumedPages(false);
+      if (read.empty()) {
+        break;  // End of file.
+      }
+      if (unbuffered) {
+        copied += read.size();
+      }
+    }
+    *result = Slice(scrach, copied);
+    return Status::OK();
+  }
+
+  Status Skip(uint64_t n) override {
+    const size_t buffered = std::min<uint64_t>(n, buf_len_ - buf_pos_);
+    buf_pos_ += buffered;
+    n -= buffered;
+    if (n == 0) {
+      return Status::OK();
+    }
+    if (direct_ || readahead_size_ > 0) {
+      offset_ += n;
+      buf_pos_ = buf_len_ = 0;
+      return Status::OK();
+    }
+    const off_t new_offset = ::lseek(fd_, n, SEEK_CUR);
+    if (new_offset == static_cast<off_t>(-1)) {
+      return PosixError(filename_, errno);
+    }
+    offset_ = new_offset;
+    return Status::OK();
+  }
+
+ private:
+  // Reads up to "n" bytes at offset_ into "scratch" and advances offset_.
+  Status ReadAt(size_t n, char* scratch, Slice* result) {
     while (true) {
-      ::ssize_t read_size = ::read(fd_, scrach, n);
+      ssize_t read_size;
+      if (direct_) {
+        // O_DIRECT reads need aligned offsets, so keep track of the offset
+        // instead of using the file position.
+        read_size = DirectPread(fd_, offset_, n, scratch);
+      } else if (readahead_size_ > 0) {
+        read_size = ::pread(fd_, scratch, n, static_cast<off_t>(offset_));
+      } else {
+        read_size = ::read(fd_, scratch, n);
+      }
       if (read_size < 0) {
         // Read error.
         if (errno == EINTR) {
           continue;  // Retry
         }
-        status = PosixError(filename_, errno);
-        break;
+        *result = Slice(scratch, 0);
+        return PosixError(filename_, errno);
       }
-      *result = Slice(scrach, read_size);
-      break;
+      offset_ += read_size;
+      *result = Slice(scratch, read_size);
+      return Status::OK();
     }
-    return status;
   }
 
-  Status Skip(uint64_t n) override {
-    if (::lseek(fd_, n, SEEK_CUR) == static_cast<off_t>(-1)) {
-      return PosixError(filename_, errno);
+  // Asks the kernel to start reading the next buffer's worth of the file
+  // while the current one is consumed.
+  void ReadAhead() {
+    if (direct_) {
+      return;
     }
-    return Status::OK();
+#if HAVE_READAHEAD
+    ::readahead(fd_, static_cast<off64_t>(offset_), readahead_size_);
+#elif HAVE_POSIX_FADVISE
+    ::posix_fadvise(fd_, static_cast<off_t>(offset_),
+                    static_cast<off_t>(readahead_size_), POSIX_FADV_WILLNEED);
+#endif  // HAVE_READAHEAD
+  }
+
+  // Drops the pages read so far from the page cache, in chunks of at least
+  // kDropChunkSize bytes unless "all" is true.
+  void DropConsumedPages(bool all) {
+#if HAVE_POSIX_FADVISE
+    static constexpr uint64_t kDropChunkSize = 1 << 20;
+    if (!drop_consumed_pages_ || offset_ <= dropped_offset_ ||
+        (!all && offset_ - dropped_offset_ < kDropChunkSize)) {
+      return;
+    }
+    ::posix_fadvise(fd_, static_cast<off_t>(dropped_offset_),
+                    static_cast<off_t>(offset_ - dropped_offset_),
+                    POSIX_FADV_DONTNEED);
+    dropped_offset_ = offset_;
+#endif  // HAVE_POSIX_FADVISE
   }
 
- private:
   const int fd_;
+  const bool direct_;
+  const bool drop_consumed_pages_;
+  const size_t readahead_size_;  // 0 if reads are not buffered.
+  const AlignedBuffer buf_;
+  size_t buf_pos_;           // Next unread byte in buf_.
+  size_t buf_len_;           // Bytes of the file in buf_.
+  uint64_t offset_;          // Offset of the next read from the file.
+  uint64_t dropped_offset_;  // Pages before it were dropped.
   const std::string filename_;
 };
 
+// Ranges of a MultiRead() that are read at once, see kMultiReadMaxGap.
+struct MultiReadGroup {
+  // Set the results of the requests from the outcome of "read".
+  void Finish() {
+    for (ReadRequest* req : reqs) {
+      req->status = read.status;
+      const uint64_t skip = req->offset - offset;
+      size_t size = 0;
+      if (read.status.ok() && read.result.size() > skip) {
+        size = std::min<uint64_t>(req->n, read.result.size() - skip);
+      }
+      req->result = Slice(req->scratch, size);
+    }
+  }
+
+  uint64_t offset;
+  uint64_t end;
+  std::vector<ReadRequest*> reqs;  // Ordered by offset.
+  std::vector<struct iovec> iov;   // Scratch of the requests and gaps.
+  ReadRequest read;                // Only result.size() is meaningful.
+};
+
 // Implements random read access in a file using pread().
 //
 // Instance of this call are thread-safe, as required by the RandomAccessFile
@@ -145,16 +878,22 @@ class PosixSequentialFile final : public SequentialFile {
 // functions.
 class PosixRandomAccessFile final : public RandomAccessFile {
  public:
-  // The new instance takes ownership of |fd|. |fd_limiter| must outlive this
-  // instance, and will be used to determine if .
-  PosixRandomAccessFile(std::string filename, int fd, Limiter* fd_limiter)
+  // The new instance takes ownership of |fd|. |fd_limiter| and |fd_cache|
+  // must outlive this instance. The file keeps |fd| open if |fd_limiter|
+  // allows it, and leaves it to |fd_cache| otherwise.
+  //
+  // If |direct| is true, |fd| was opened with O_DIRECT.
+  PosixRandomAccessFile(std::string filename, int fd, Limiter* fd_limiter,
+                        PosixFdCache* fd_cache, bool direct)
       : has_permanent_fd_(fd_limiter->Acquire()),
         fd_(has_permanent_fd_ ? fd : -1),
+        direct_(direct),
         fd_limiter_(fd_limiter),
+        fd_cache_(fd_cache),
         filename_(std::move(filename)) {
     if (!has_permanent_fd_) {
       assert(fd_ == -1);
-      ::close(fd);  // The file will be opened on every read.
+      fd_cache_->Insert(&cache_entry_, fd);
     }
   }
   ~PosixRandomAccessFile() override {
@@ -162,67 +901,347 @@ class PosixRandomAccessFile final : public RandomAccessFile {
       assert(fd_ != -1);
       ::close(fd_);
       fd_limiter_->Release();
+    } else {
+      fd_cache_->Erase(&cache_entry_);
     }
   }
 
   Status Read(uint64_t offset, size_t n, Slice* result,
               char* scratch) const override {
     int fd = fd_;
+    bool cached = false;
     if (!has_permanent_fd_) {
-      fd = ::open(filename_.c_str(), O_RDONLY | kOpenBaseFlags);
-      if (fd < 0) {
-        return PosixError(filename_, errno);
+      Status status =
+          fd_cache_->Pin(&cache_entry_, filename_, direct_, &fd, &cached);
+      if (!status.ok()) {
+        return status;
       }
     }
 
     assert(fd != -1);
 
     Status status;
-    ssize_t read_size = ::pread(fd, scratch, n, static_cast<off_t>(offset));
+    ssize_t read_size =
+        direct_ ? DirectPread(fd, offset, n, scratch)
+                : ::pread(fd, scratch, n, static_cast<off_t>(offset));
     *result = Slice(scratch, (read_size < 0) ? 0 : read_size);
     if (read_size < 0) {
       // An error: return a non-ok status.
       status = PosixError(filename_, errno);
     }
     if (!has_permanent_fd_) {
-      // Close the temporary file descriptor opened earlier.
-      assert(fd != fd_);
-      ::close(fd);
+      fd_cache_->Unpin(&cache_entry_, fd, cached);
+    }
+    return status;
+  }
+
+  Status MultiRead(ReadRequest* reqs, size_t n) const override {
+    if (direct_) {
+      // Merged reads would rarely be aligned.
+      return RandomAccessFile::MultiRead(reqs, n);
+    }
+    int fd = fd_;
+    bool cached = false;
+    if (!has_permanent_fd_) {
+      Status status =
+          fd_cache_->Pin(&cache_entry_, filename_, direct_, &fd, &cached);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+
+    std::vector<MultiReadGroup> groups;
+    GroupRequests(reqs, n, &groups);
+
+    Status status;
+    bool issued = false;
+#if HAVE_IO_URING
+    // A single group gains nothing from io_uring.
+    PosixIoUring* ring = groups.size() > 1 ? PosixIoUring::Current() : nullptr;
+    if (ring != nullptr) {
+      std::vector<ReadRequest*> reads;
+      for (MultiReadGroup& group : groups) {
+        group.read.scratch = reinterpret_cast<char*>(group.iov[0].iov_base);
+        status = ring->ReadV(fd, &filename_, group.iov.data(),
+                             group.iov.size(), group.offset, &group.read);
+        if (!status.ok()) {
+          break;
+        }
+        reads.push_back(&group.read);
+      }
+      // Wait for whatever was queued, the buffers are about to go away.
+      Status wait_status = ring->WaitAll(reads);
+      if (status.ok()) {
+        status = wait_status;
+      }
+      issued = true;
+    }
+#endif  // HAVE_IO_URING
+    if (!issued) {
+      for (MultiReadGroup& group : groups) {
+        ReadGroup(fd, &group);
+      }
+    }
+    if (status.ok()) {
+      for (MultiReadGroup& group : groups) {
+        group.Finish();
+      }
+    }
+
+    if (!has_permanent_fd_) {
+      fd_cache_->Unpin(&cache_entry_, fd, cached);
     }
     return status;
   }
 
+  Status ReadAsync(ReadRequest* req) const override {
+#if HAVE_IO_URING
+    // A cached file descriptor would have to stay pinned until the read
+    // finished, so such files read synchronously. So do unaligned direct
+    // reads, which need a bounce buffer.
+    if (has_permanent_fd_ &&
+        (!direct_ || (req->offset % kDirectIOAlignment == 0 &&
+                      req->n % kDirectIOAlignment == 0 &&
+                      IsAligned(req->scratch)))) {
+      PosixIoUring* ring = PosixIoUring::Current();
+      if (ring != nullptr) {
+        return ring->Read(fd_, &filename_, req);
+      }
+    }
+#endif  // HAVE_IO_URING
+    return RandomAccessFile::ReadAsync(req);
+  }
+
  private:
-  const bool has_permanent_fd_;  // If false, the file is opened on every read.
+  // Sort the non-empty requests of reqs[0, n-1] by offset into groups of
+  // ranges that can be read at once. Empty requests are completed.
+  static void GroupRequests(ReadRequest* reqs, size_t n,
+                            std::vector<MultiReadGroup>* groups) {
+    // The bytes between two ranges of a group are read into here and
+    // thrown away. Per thread, since MultiRead() is called concurrently;
+    // the reads of one call are all done before it returns.
+    thread_local char gap_buffer[kMultiReadMaxGap];
+
+    std::vector<ReadRequest*> sorted;
+    for (size_t i = 0; i < n; ++i) {
+      if (reqs[i].n == 0) {
+        reqs[i].result = Slice();
+        reqs[i].status = Status::OK();
+      } else {
+        sorted.push_back(&reqs[i]);
+      }
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const ReadRequest* a, const ReadRequest* b) {
+                return a->offset < b->offset;
+              });
+
+    for (ReadRequest* req : sorted) {
+      MultiReadGroup* group = groups->empty() ? nullptr : &groups->back();
+      // Overlapping ranges can not share a read.
+      if (HAVE_PREADV && group != nullptr && req->offset >= group->end &&
+          req->offset - group->end <= kMultiReadMaxGap &&
+          group->iov.size() + 2 <= kMaxIovecs) {
+        if (req->offset > group->end) {
+          struct iovec gap;
+          gap.iov_base = gap_buffer;
+          gap.iov_len = req->offset - group->end;
+          group->iov.push_back(gap);
+        }
+      } else {
+        groups->emplace_back();
+        group = &groups->back();
+        group->offset = req->offset;
+      }
+      struct iovec range;
+      range.iov_base = req->scratch;
+      range.iov_len = req->n;
+      group->iov.push_back(range);
+      group->reqs.push_back(req);
+      group->end = req->offset + req->n;
+    }
+  }
+
+  void ReadGroup(int fd, MultiReadGroup* group) const {
+    ssize_t read_size;
+#if HAVE_PREADV
+    if (group->iov.size() > 1) {
+      read_size = ::preadv(fd, group->iov.data(),
+                           static_cast<int>(group->iov.size()),
+                           static_cast<off_t>(group->offset));
+    } else
+#endif  // HAVE_PREADV
+    {
+      read_size = ::pread(fd, group->iov[0].iov_base, group->iov[0].iov_len,
+                          static_cast<off_t>(group->offset));
+    }
+    group->read.result =
+        Slice(reinterpret_cast<char*>(group->iov[0].iov_base),
+              read_size < 0 ? 0 : read_size);
+    group->read.status =
+        read_size < 0 ? PosixError(filename_, errno) : Status::OK();
+  }
+
+  const bool has_permanent_fd_;  // If false, fd_cache_ holds the descriptor.
   const int fd_;                 // -1 if has_permanent_fd_ is false.
+  const bool direct_;            // True if the file is read with O_DIRECT.
   Limiter* const fd_limiter_;
+  PosixFdCache* const fd_cache_;
+  mutable PosixFdCache::Entry cache_entry_;  // Unused if has_permanent_fd_.
   const std::string filename_;
 };
 
-// Implements random read access in a file using mmap.
+class PosixAdaptiveRandomAccessFile;
+
+// Pass the FileOptions' advice about a mapped file on to the kernel.
+void AdviseMapping(char* base, size_t length, const FileOptions& options) {
+  if (options.mmap_advise_random) {
+    ::madvise(base, length, MADV_RANDOM);
+  }
+  if (options.mmap_advise_willneed) {
+    ::madvise(base, length, MADV_WILLNEED);
+  }
+}
+
+// Decides which random access files are mapped: enforces the limits on
+// the number and the bytes of mappings, and moves adaptive files between
+// mmap and pread().
 //
-// Instance of this class are thread-safe, as required by the RandomAccessFile
-// API. Instances are immutable and Read() only calls thread-safe library
-// functions.
-class PosixMmapReadableFile final : public RandomAccessFile {
+// Thread-safe.
+class PosixMmapManager : public noncopyable {
  public:
-  // mmap_base[0, length-1] points to the memory-mmaped contents of the file. It
-  // must be the result of a successful call to mmap(). This instance takes
-  // over the ownership of the region.
+  explicit PosixMmapManager(int max_mmaps)
+      : max_file_size_(0),
+        budget_bytes_(0),
+        adaptive_(false),
+        mmap_limiter_(max_mmaps),
+        mapped_files_(0),
+        mapped_bytes_(0),
+        promotions_(0),
+        demotions_(0) {}
+
+  void SetOptions(const MmapOptions& options) {
+    max_file_size_.store(options.max_file_size, std::memory_order_relaxed);
+    budget_bytes_.store(options.budget_bytes, std::memory_order_relaxed);
+    adaptive_.store(options.adaptive, std::memory_order_relaxed);
+  }
+
+  bool adaptive() const { return adaptive_.load(std::memory_order_relaxed); }
+
+  // If a file of "size" bytes may be mapped, take the right to map it and
+  // return true. Else return false.
+  bool Reserve(uint64_t size) {
+    const uint64_t max_file_size =
+        max_file_size_.load(std::memory_order_relaxed);
+    if (max_file_size > 0 && size > max_file_size) {
+      return false;
+    }
+    if (!mmap_limiter_.Acquire()) {
+      return false;
+    }
+    const uint64_t budget = budget_bytes_.load(std::memory_order_relaxed);
+    uint64_t mapped = mapped_bytes_.load(std::memory_order_relaxed);
+    do {
+      if (budget > 0 && mapped + size > budget) {
+        mmap_limiter_.Release();
+        return false;
+      }
+    } while (!mapped_bytes_.compare_exchange_weak(mapped, mapped + size,
+                                                  std::memory_order_relaxed));
+    mapped_files_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Release the right taken by a successful Reserve(size).
+  void Release(uint64_t size) {
+    mapped_files_.fetch_sub(1, std::memory_order_relaxed);
+    mapped_bytes_.fetch_sub(size, std::memory_order_relaxed);
+    mmap_limiter_.Release();
+  }
+
+  void Register(PosixAdaptiveRandomAccessFile* file) {
+    MutexLock l(&mutex_);
+    files_.insert(file);
+  }
+
+  void Unregister(PosixAdaptiveRandomAccessFile* file) {
+    MutexLock l(&mutex_);
+    files_.erase(file);
+  }
+
+  // Map *file, which is read with pread(), if it fits the budget, or if
+  // unmapping files that are read much less often makes it fit.
+  void MaybePromote(PosixAdaptiveRandomAccessFile* file);
+
+  MmapStats GetStats() {
+    MmapStats stats;
+    stats.mapped_files = mapped_files_.load(std::memory_order_relaxed);
+    stats.mapped_bytes = mapped_bytes_.load(std::memory_order_relaxed);
+    MutexLock l(&mutex_);
+    stats.promotions = promotions_;
+    stats.demotions = demotions_;
+    return stats;
+  }
+
+ private:
+  std::atomic<uint64_t> max_file_size_;
+  std::atomic<uint64_t> budget_bytes_;
+  std::atomic<bool> adaptive_;
+
+  // Mappings are released by the last reader using them, so the
+  // accounting does not take the mutex.
+  Limiter mmap_limiter_;
+  std::atomic<int> mapped_files_;
+  std::atomic<uint64_t> mapped_bytes_;
+
+  port::Mutex mutex_;
+  std::set<PosixAdaptiveRandomAccessFile*> files_ GUARDED_BY(mutex_);
+  uint64_t promotions_ GUARDED_BY(mutex_);
+  uint64_t demotions_ GUARDED_BY(mutex_);
+};
+
+// A read-only mapping of a whole file, unmapped when the last reference
+// goes away.
+struct PosixMapping : public noncopyable {
+  // The right to map |length| bytes must have been reserved from
+  // |manager|, which must outlive this instance.
+  PosixMapping(char* base, size_t length, PosixMmapManager* manager)
+      : base(base), length(length), manager(manager) {}
+
+  ~PosixMapping() {
+    ::munmap(static_cast<void*>(base), length);
+    manager->Release(length);
+  }
+
+  char* const base;
+  const size_t length;
+  PosixMmapManager* const manager;
+};
+
+// Implements random read access in a file using mmap.
+//
+// Instance of this class are thread-safe, as required by the RandomAccessFile
+// API. Instances are immutable and Read() only calls thread-safe library
+// functions.
+class PosixMmapReadableFile final : public RandomAccessFile {
+ public:
+  // mmap_base[0, length-1] points to the memory-mmaped contents of the file. It
+  // must be the result of a successful call to mmap(). This instance takes
+  // over the ownership of the region.
   //
-  // |mmap_limiter| must outlive this instance. The caller must have already
-  // acquired the right to use one mmap region, which will be released when
+  // |mmap_manager| must outlive this instance. The caller must have already
+  // reserved the right to map |length| bytes, which will be released when
   // this instance is destroyed.
   PosixMmapReadableFile(std::string filename, char* mmap_base, size_t length,
-                        Limiter* mmap_limiter)
+                        PosixMmapManager* mmap_manager)
       : mmap_base_(mmap_base),
         length_(length),
-        mmap_limiter_(mmap_limiter),
+        mmap_manager_(mmap_manager),
         filename_(std::move(filename)) {}
 
   ~PosixMmapReadableFile() override {
     ::munmap(static_cast<void*>(mmap_base_), length_);
-    mmap_limiter_->Release();
+    mmap_manager_->Release(length_);
   }
 
   Status Read(uint64_t offset, size_t n, Slice* result,
@@ -236,205 +1255,1100 @@ class PosixMmapReadableFile final : public RandomAccessFile {
     return Status::OK();
   }
 
- private:
-  char* const mmap_base_;
-  const size_t length_;
-  Limiter* const mmap_limiter_;
+ private:
+  char* const mmap_base_;
+  const size_t length_;
+  PosixMmapManager* const mmap_manager_;
+  const std::string filename_;
+};
+
+// Implements random read access in a file that PosixMmapManager maps and
+// unmaps as its reads come and go. Reads of the mapping copy into the
+// caller's scratch, so that they need not keep the mapping alive, and
+// stop at the end of the file like pread() does.
+//
+// Instances of this class are thread-safe.
+class PosixAdaptiveRandomAccessFile final : public RandomAccessFile {
+ public:
+  // |preader| reads the file while it is not mapped and is owned by the
+  // new instance. |mapping| may be nullptr. |mmap_manager| must outlive
+  // this instance.
+  PosixAdaptiveRandomAccessFile(std::string filename, uint64_t size,
+                                const FileOptions& options,
+                                PosixMmapManager* mmap_manager,
+                                RandomAccessFile* preader,
+                                std::shared_ptr<PosixMapping> mapping)
+      : filename_(std::move(filename)),
+        size_(size),
+        options_(options),
+        mmap_manager_(mmap_manager),
+        preader_(preader),
+        mapping_(std::move(mapping)),
+        reads_(0),
+        window_start_micros_(MonotonicMicros()),
+        window_start_reads_(0),
+        rate_(0) {
+    mmap_manager_->Register(this);
+  }
+
+  ~PosixAdaptiveRandomAccessFile() override {
+    mmap_manager_->Unregister(this);
+  }
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override {
+    const uint64_t reads = reads_.fetch_add(1, std::memory_order_relaxed);
+    std::shared_ptr<PosixMapping> mapping = std::atomic_load(&mapping_);
+    if (mapping != nullptr) {
+      n = offset < mapping->length
+              ? static_cast<size_t>(
+                    std::min<uint64_t>(n, mapping->length - offset))
+              : 0;
+      std::memcpy(scratch, mapping->base + offset, n);
+      *result = Slice(scratch, n);
+      return Status::OK();
+    }
+    if ((reads + 1) % kPromotionCheckInterval == 0) {
+      mmap_manager_->MaybePromote(
+          const_cast<PosixAdaptiveRandomAccessFile*>(this));
+    }
+    return preader_->Read(offset, n, result, scratch);
+  }
+
+  // Mapped files go through Read().
+  Status MultiRead(ReadRequest* reqs, size_t n) const override {
+    if (mapped()) {
+      return RandomAccessFile::MultiRead(reqs, n);
+    }
+    reads_.fetch_add(n, std::memory_order_relaxed);
+    return preader_->MultiRead(reqs, n);
+  }
+
+  Status ReadAsync(ReadRequest* req) const override {
+    if (mapped()) {
+      return RandomAccessFile::ReadAsync(req);
+    }
+    reads_.fetch_add(1, std::memory_order_relaxed);
+    return preader_->ReadAsync(req);
+  }
+
+ private:
+  friend class PosixMmapManager;
+
+  // A file read with pread() asks to be mapped every this many reads.
+  static constexpr uint64_t kPromotionCheckInterval = 256;
+
+  // The read rate of a file is averaged over windows of this length.
+  static constexpr uint64_t kHeatWindowMicros = 1000000;
+
+  bool mapped() const { return std::atomic_load(&mapping_) != nullptr; }
+
+  // Return the recent reads per second. REQUIRES: the manager's mutex is
+  // held.
+  double Heat(uint64_t now_micros) {
+    const uint64_t reads = reads_.load(std::memory_order_relaxed);
+    const uint64_t elapsed = now_micros - window_start_micros_;
+    if (elapsed == 0) {
+      return rate_;
+    }
+    const double window_rate = (reads - window_start_reads_) * 1e6 / elapsed;
+    const double heat = (rate_ + window_rate) / 2;
+    if (elapsed >= kHeatWindowMicros) {
+      rate_ = heat;
+      window_start_micros_ = now_micros;
+      window_start_reads_ = reads;
+    }
+    return heat;
+  }
+
+  // Map the file. The right to map size_ bytes must have been reserved.
+  // REQUIRES: the manager's mutex is held.
+  bool Map() {
+    int fd;
+    if (!OpenFile(filename_, O_RDONLY, false, &fd).ok()) {
+      mmap_manager_->Release(size_);
+      return false;
+    }
+    void* base = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      mmap_manager_->Release(size_);
+      return false;
+    }
+    AdviseMapping(reinterpret_cast<char*>(base), size_, options_);
+    std::atomic_store(&mapping_, std::make_shared<PosixMapping>(
+                                     reinterpret_cast<char*>(base), size_,
+                                     mmap_manager_));
+    return true;
+  }
+
+  // The mapping goes away once the reads using it finished. REQUIRES: the
+  // manager's mutex is held.
+  void Unmap() {
+    std::atomic_store(&mapping_, std::shared_ptr<PosixMapping>());
+  }
+
+  const std::string filename_;
+  const uint64_t size_;
+  const FileOptions options_;
+  PosixMmapManager* const mmap_manager_;
+  const std::unique_ptr<RandomAccessFile> preader_;
+
+  // Accessed with std::atomic_load() and std::atomic_store().
+  mutable std::shared_ptr<PosixMapping> mapping_;
+  mutable std::atomic<uint64_t> reads_;
+
+  // Guarded by the manager's mutex.
+  uint64_t window_start_micros_;
+  uint64_t window_start_reads_;
+  double rate_;  // Reads per second of the previous windows.
+};
+
+void PosixMmapManager::MaybePromote(PosixAdaptiveRandomAccessFile* file) {
+  MutexLock l(&mutex_);
+  if (!adaptive() || file->size_ == 0 || file->mapped()) {
+    return;
+  }
+  const uint64_t max_file_size = max_file_size_.load(std::memory_order_relaxed);
+  const uint64_t budget = budget_bytes_.load(std::memory_order_relaxed);
+  if ((max_file_size > 0 && file->size_ > max_file_size) ||
+      (budget > 0 && file->size_ > budget)) {
+    return;
+  }
+  const uint64_t now = MonotonicMicros();
+  const double heat = file->Heat(now);
+  // Bytes of the victims unmapped so far. A victim's bytes only come back
+  // once the reads using its mapping finish, so Reserve() may keep failing
+  // for a while after enough victims were unmapped.
+  uint64_t unmapped = 0;
+  while (!Reserve(file->size_)) {
+    if (unmapped >= file->size_) {
+      // Try again at the next check instead of unmapping more files.
+      return;
+    }
+    // Only unmap files that are clearly colder, so that two files of
+    // about the same heat do not keep trading places.
+    PosixAdaptiveRandomAccessFile* victim = nullptr;
+    double victim_heat = 0;
+    for (PosixAdaptiveRandomAccessFile* other : files_) {
+      if (other == file || !other->mapped()) {
+        continue;
+      }
+      const double other_heat = other->Heat(now);
+      if (victim == nullptr || other_heat < victim_heat) {
+        victim = other;
+        victim_heat = other_heat;
+      }
+    }
+    if (victim == nullptr || victim_heat * 2 >= heat) {
+      return;
+    }
+    unmapped += victim->size_;
+    victim->Unmap();
+    ++demotions_;
+  }
+  if (file->Map()) {
+    ++promotions_;
+  }
+}
+
+// Ensures that all the caches associated with the given file descriptor's
+// data are flushed all the way to durable media, and can withstand power
+// failures.
+//
+// The fd_path argument is only used to populate the description string
+// in the returned Status if any error occurs.
+Status SyncFd(int fd, const std::string& fd_path) {
+#if HAVE_FULLFSYNC
+  // On macOS and iOS, fsync() doesn't guarantee durability past power
+  // failures. fcntl(F_FULLSYNC) is required fot that purpose. Some
+  // filesystems don't support fnctl(F_FULLSYNC), and requires a
+  // fallback to fsync().
+  if (::fcntl(fd, F_FULLFSYNC) == 0) {
+    return Status::OK();
+  }
+#endif  // HAVE_FULLFSYNC
+
+#if HAVE_FDATASYNC
+  bool sync_success = ::fdatasync(fd) == 0;
+#else
+  bool sync_success = ::fsync(fd) == 0;
+#endif
+
+  if (sync_success) {
+    return Status::OK();
+  }
+  return PosixError(fd_path, errno);
+}
+
+// Ensures that the entries of the directory "dirname" are durable.
+Status FsyncDir(const std::string& dirname) {
+  g_dir_syncs.fetch_add(1, std::memory_order_relaxed);
+  int fd = ::open(dirname.c_str(), O_RDONLY | kOpenBaseFlags);
+  if (fd < 0) {
+    return PosixError(dirname, errno);
+  }
+  Status status = SyncFd(fd, dirname);
+  ::close(fd);
+  return status;
+}
+
+// Returns the directory name in a path pointing to a file.
+//
+// Returns "." if the path does not contain any directory separator.
+std::string Dirname(const std::string& filename) {
+  auto separator_pos = filename.rfind('/');
+  if (separator_pos == std::string::npos) {
+    return std::string(".");
+  }
+  // The filename component should not contain a path separator.
+  // If it does, the splitting was done incorrectly.
+  assert(filename.find('/', separator_pos + 1) == std::string::npos);
+
+  return filename.substr(0, separator_pos);
+}
+
+// Extracts the filename from a path pointing to a file.
+//
+// The returned Slice points to |filename|'s data buffer,
+// so it is only valid while |filename| is alive and
+// unchanged.
+Slice Basename(const std::string& filename) {
+  auto separator_pos = filename.rfind('/');
+  if (separator_pos == std::string::npos) {
+    return Slice(filename);
+  }
+  // The filename component should be not contain a path
+  // separator. If it does, the splitting was done
+  // incorrectly.
+  assert(filename.find('/', separator_pos + 1) == std::string::npos);
+
+  return Slice(filename.data() + separator_pos + 1,
+               filename.length() - separator_pos - 1);
+}
+
+// True if the given file is a manifest file.
+bool IsManifest(const std::string& filename) {
+  return Basename(filename).starts_with("MANIFEST");
+}
+
+// Tracks the directories whose entries were changed through the Env
+// since their last sync, so that syncing a clean directory costs no
+// fsync. Concurrent syncs of a directory share one fsync: a caller whose
+// changes are covered by a sync in progress waits for it instead of
+// issuing its own.
+//
+// Directories are identified by device and inode, so that different
+// paths of the same directory agree. Changes made by other processes or
+// Envs are not seen, and directories not synced yet count as dirty.
+//
+// Thread-safe.
+class PosixDirSyncer : public noncopyable {
+ public:
+  using DirId = std::pair<dev_t, ino_t>;
+
+  PosixDirSyncer() : cv_(&mutex_) {}
+
+  // Record that entries of "dirname" were created, renamed or removed.
+  // Must be called after the change, so that a sync that starts later
+  // covers it.
+  void MarkDirty(const std::string& dirname) {
+    DirId id;
+    if (GetDirId(dirname, &id)) {
+      MarkDirty(id);
+    }
+  }
+
+  // Same, for the directory containing "filename".
+  void MarkParentDirty(const std::string& filename) {
+    MarkDirty(Dirname(filename));
+  }
+
+  // Ditto for a directory that may be gone by now, identified by an id
+  // from GetDirId(). A new directory that reuses the inode starts dirty.
+  void MarkDirty(const DirId& id) {
+    MutexLock l(&mutex_);
+    ++dirs_[id].dirty_seq;
+  }
+
+  // Make the entries of "dirname" durable, if they changed since its
+  // last sync.
+  Status Sync(const std::string& dirname) {
+    DirId id;
+    if (!GetDirId(dirname, &id)) {
+      return FsyncDir(dirname);  // Reports the error.
+    }
+    MutexLock l(&mutex_);
+    // Entries of dirs_ are never erased.
+    DirState& state = dirs_[id];
+    const uint64_t target = state.dirty_seq;
+    while (state.synced_seq < target && state.syncing) {
+      cv_.Wait();
+    }
+    if (state.synced_seq >= target) {
+      return Status::OK();
+    }
+    state.syncing = true;
+    const uint64_t seq = state.dirty_seq;
+    mutex_.Unlock();
+    Status status = FsyncDir(dirname);
+    mutex_.Lock();
+    state.syncing = false;
+    if (status.ok()) {
+      state.synced_seq = std::max(state.synced_seq, seq);
+    }
+    cv_.SignalAll();
+    return status;
+  }
+
+  // Store the identity of directory "dirname" in *id. Returns false if
+  // it can not be determined.
+  static bool GetDirId(const std::string& dirname, DirId* id) {
+    struct ::stat dir_stat;
+    if (::stat(dirname.c_str(), &dir_stat) != 0) {
+      return false;
+    }
+    *id = std::make_pair(dir_stat.st_dev, dir_stat.st_ino);
+    return true;
+  }
+
+ private:
+  struct DirState {
+    // Every change of the directory takes a new sequence number, and a
+    // sync covers the changes up to the number current when it started.
+    uint64_t dirty_seq = 1;
+    uint64_t synced_seq = 0;
+    bool syncing = false;  // A sync of the directory is in progress.
+  };
+
+  port::Mutex mutex_;
+  port::CondVar cv_ GUARDED_BY(mutex_);
+  std::map<DirId, DirState> dirs_ GUARDED_BY(mutex_);
+};
+
+// A dedicated thread running the syncs of WritableFile::SyncAsync(), so
+// that they do not wait behind compactions in the thread pools.
+//
+// Thread-safe.
+class PosixSyncWorker : public noncopyable {
+ public:
+  // The worker thread is started by the first Submit(), and never
+  // stopped, since the PosixEnv owning the worker is never destroyed.
+  PosixSyncWorker() : work_cv_(&mutex_), done_cv_(&mutex_), started_(false) {}
+
+  // Run "sync", a sync of the file identified by "key", on the worker
+  // thread, and call "callback" with its outcome. Syncs of the same file
+  // that are queued back-to-back run once, since a single sync covers
+  // everything written before it started.
+  void Submit(const void* key, std::function<Status()> sync,
+              std::function<void(const Status&)> callback) {
+    MutexLock l(&mutex_);
+    FileState& state = files_[key];
+    if (state.queued != nullptr) {
+      state.queued->callbacks.push_back(std::move(callback));
+      return;
+    }
+    state.queued = Enqueue(key, std::move(sync), std::move(callback));
+  }
+
+  // Call "callback" with "status" on the worker thread, after the callbacks
+  // of the syncs of "key" submitted before. Used to report a failure found
+  // before syncing without breaking the order of a file's callbacks.
+  void SubmitStatus(const void* key, const Status& status,
+                    std::function<void(const Status&)> callback) {
+    MutexLock l(&mutex_);
+    // Later syncs must not join a request that runs before this one.
+    files_[key].queued = nullptr;
+    Enqueue(key, [status]() { return status; }, std::move(callback));
+  }
+
+  // Wait until the syncs of "key" and their callbacks finished.
+  void Wait(const void* key) {
+    MutexLock l(&mutex_);
+    while (files_.find(key) != files_.end()) {
+      done_cv_.Wait();
+    }
+  }
+
+ private:
+  struct Request {
+    const void* key;
+    std::function<Status()> sync;
+    std::vector<std::function<void(const Status&)>> callbacks;
+  };
+
+  struct FileState {
+    Request* queued = nullptr;  // Waiting in queue_, gathers more callbacks.
+    int requests = 0;           // Queued or running.
+  };
+
+  Request* Enqueue(const void* key, std::function<Status()> sync,
+                   std::function<void(const Status&)> callback)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    Request* request = new Request;
+    request->key = key;
+    request->sync = std::move(sync);
+    request->callbacks.push_back(std::move(callback));
+    ++files_[key].requests;
+    queue_.push_back(request);
+    if (!started_) {
+      started_ = true;
+      std::thread thread(&PosixSyncWorker::ThreadMain, this);
+      thread.detach();
+    }
+    work_cv_.Signal();
+    return request;
+  }
+
+  void ThreadMain() {
+    mutex_.Lock();
+    while (true) {
+      while (queue_.empty()) {
+        work_cv_.Wait();
+      }
+      Request* request = queue_.front();
+      queue_.pop_front();
+      // Later requests need a sync of their own.
+      FileState& state = files_[request->key];
+      if (state.queued == request) {
+        state.queued = nullptr;
+      }
+      mutex_.Unlock();
+
+      const Status status = request->sync();
+      for (const auto& callback : request->callbacks) {
+        callback(status);
+      }
+
+      mutex_.Lock();
+      auto iter = files_.find(request->key);
+      if (--iter->second.requests == 0) {
+        files_.erase(iter);
+        done_cv_.SignalAll();
+      }
+      delete request;
+    }
+  }
+
+  port::Mutex mutex_;
+  port::CondVar work_cv_ GUARDED_BY(mutex_);
+  port::CondVar done_cv_ GUARDED_BY(mutex_);
+  bool started_ GUARDED_BY(mutex_);
+  std::deque<Request*> queue_ GUARDED_BY(mutex_);
+  std::map<const void*, FileState> files_ GUARDED_BY(mutex_);
+};
+
+class PosixWritableFile final : public WritableFile {
+ public:
+  // If |direct| is true, |fd| was opened with O_DIRECT and is written at
+  // explicit offsets. The file is assumed to be empty unless LoadTail() is
+  // called. See FileOptions for the meaning of |options|.
+  PosixWritableFile(std::string filename, int fd, bool direct,
+                    const FileOptions& options, PosixSyncWorker* sync_worker,
+                    PosixDirSyncer* dir_syncer)
+      : buffer_size_(std::max<size_t>(
+            RoundUpToAlignment(options.writable_file_buffer_size),
+            kDirectIOAlignment)),
+        buf_(NewAlignedBuffer(buffer_size_)),
+        pos_(0),
+        fd_(fd),
+        direct_(direct),
+        bytes_per_sync_(direct ? 0 : options.bytes_per_sync),
+        preallocation_block_size_(options.preallocation_block_size),
+        rate_limiter_(options.rate_limiter),
+        rate_limiter_priority_(options.rate_limiter_priority),
+        buf_offset_(0),
+        range_synced_offset_(0),
+        preallocated_offset_(0),
+        is_manifest_(IsManifest(filename)),
+        filename_(std::move(filename)),
+        dirname_(Dirname(filename_)),
+        sync_worker_(sync_worker),
+        dir_syncer_(dir_syncer) {}
+
+  ~PosixWritableFile() override {
+    if (fd_ >= 0) {
+      // Ignoring any potential errors.
+      Close();
+    }
+  }
+
+  // Continue a file of "size" bytes. With direct I/O, its last partial
+  // block is read back into the buffer, since writes must start at a
+  // block boundary.
+  Status LoadTail(uint64_t size) {
+    range_synced_offset_ = size;
+    preallocated_offset_ = size;
+    if (!direct_) {
+      buf_offset_ = size;
+      return Status::OK();
+    }
+    buf_offset_ = TruncateToAlignment(size);
+    pos_ = static_cast<size_t>(size - buf_offset_);
+    if (pos_ == 0) {
+      return Status::OK();
+    }
+    ssize_t read_size = ::pread(fd_, buf_.get(), kDirectIOAlignment,
+                                static_cast<off_t>(buf_offset_));
+    if (read_size < 0) {
+      return PosixError(filename_, errno);
+    }
+    if (static_cast<size_t>(read_size) < pos_) {
+      return Status::IOError(filename_, "file shrank while opening");
+    }
+    return Status::OK();
+  }
+
+  Status Append(const Slice& data) override {
+    size_t write_size = data.size();
+    const char* write_data = data.data();
+
+    if (direct_) {
+      // Everything goes through the aligned buffer.
+      while (write_size > 0) {
+        size_t copy_size =
+            std::min(write_size, buffer_size_ - pos_);
+        std::memcpy(buf_.get() + pos_, write_data, copy_size);
+        write_data += copy_size;
+        write_size -= copy_size;
+        pos_ += copy_size;
+        if (pos_ == buffer_size_) {
+          Status status = FlushDirect(false);
+          if (!status.ok()) {
+            return status;
+          }
+        }
+      }
+      return Status::OK();
+    }
+    return Append(&data, 1);
+  }
+
+  Status Append(const Slice* parts, size_t n) override {
+    if (direct_) {
+      return WritableFile::Append(parts, n);
+    }
+
+    size_t total_size = 0;
+    for (size_t i = 0; i < n; ++i) {
+      total_size += parts[i].size();
+    }
+    // Small writes go to the buffer. Otherwise the buffer and the parts
+    // are written together, without copying the parts.
+    if (pos_ + total_size > buffer_size_) {
+      return WriteGathered(parts, n);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      std::memcpy(buf_.get() + pos_, parts[i].data(), parts[i].size());
+      pos_ += parts[i].size();
+    }
+    return Status::OK();
+  }
+
+  Status Close() override {
+    sync_worker_->Wait(this);
+    Status status = direct_ ? FlushDirect(true) : FlushBuffer();
+    // Give back the preallocated space past the end of the file.
+    const uint64_t size = buf_offset_ + pos_;
+    if (status.ok() && preallocated_offset_ > size &&
+        ::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+      status = PosixError(filename_, errno);
+    }
+    const int close_result = ::close(fd_);
+    if (close_result < 0 && status.ok()) {
+      status = PosixError(filename_, errno);
+    }
+    fd_ = -1;
+    // if FlushBuffer() and close() both failed,
+    // we will return the FlushBuffer() error.
+    return status;
+  }
+
+  // With direct I/O, a partial last block is only written by Sync() and
+  // Close().
+  Status Flush() override {
+    return direct_ ? FlushDirect(false) : FlushBuffer();
+  }
+
+  Status Sync() override {
+    // Ensure new files referred to by the manifest are in the filesystem.
+    //
+    // This needs to happen before the manifest file is flushed to disk,
+    // to avoid crashing in a status where the manifest refers to files
+    // that are not yet on disk.
+    Status status = SyncDirIfManifest();
+    if (!status.ok()) {
+      return status;
+    }
+
+    status = direct_ ? FlushDirect(true) : FlushBuffer();
+    if (!status.ok()) {
+      return status;
+    }
+    return SyncWritten();
+  }
+
+  // The data is written here, and made durable by the sync worker.
+  void SyncAsync(std::function<void(const Status&)> callback) override {
+    Status status = SyncDirIfManifest();
+    if (status.ok()) {
+      status = direct_ ? FlushDirect(true) : FlushBuffer();
+    }
+    if (!status.ok()) {
+      // Earlier syncs of this file may still be pending on the worker.
+      sync_worker_->SubmitStatus(this, status, std::move(callback));
+      return;
+    }
+    sync_worker_->Submit(this, [this]() { return SyncWritten(); },
+                         std::move(callback));
+  }
+
+ private:
+  // Makes the data written to fd_ durable. Only uses members that do not
+  // change until Close(), so that it can run on the sync worker.
+  Status SyncWritten() {
+    const uint64_t start = rate_limiter_ != nullptr ? MonotonicMicros() : 0;
+    Status status = SyncFd(fd_, filename_);
+    if (rate_limiter_ != nullptr) {
+      rate_limiter_->RecordLatency(MonotonicMicros() - start);
+    }
+    return status;
+  }
+
+  // Called by every Flush(), so it writes the buffer without gathering.
+  Status FlushBuffer() {
+    struct ::iovec iov = {buf_.get(), pos_};
+    const size_t iovcnt = pos_ > 0 ? 1 : 0;
+    pos_ = 0;
+    return WriteIovecs(&iov, iovcnt);
+  }
+
+  // Writes the buffer followed by parts[0, n-1] with as few writev()
+  // calls as possible, and empties the buffer.
+  Status WriteGathered(const Slice* parts, size_t n) {
+    // Appends of a few parts, the common case, need no allocation.
+    constexpr size_t kStackIovecs = 16;
+    struct ::iovec stack_iovs[kStackIovecs];
+    std::unique_ptr<struct ::iovec[]> heap_iovs;
+    struct ::iovec* iovs = stack_iovs;
+    if (n + 1 > kStackIovecs) {
+      heap_iovs.reset(new struct ::iovec[n + 1]);
+      iovs = heap_iovs.get();
+    }
+    size_t iovcnt = 0;
+    if (pos_ > 0) {
+      iovs[iovcnt++] = {buf_.get(), pos_};
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (parts[i].size() > 0) {
+        iovs[iovcnt++] = {const_cast<char*>(parts[i].data()), parts[i].size()};
+      }
+    }
+    // Whatever happens, the buffer's contents are not written again.
+    pos_ = 0;
+    return WriteIovecs(iovs, iovcnt);
+  }
+
+  // Writes iov[0, iovcnt-1], whose lengths are non-zero, in order.
+  // The iovecs are modified.
+  Status WriteIovecs(struct ::iovec* iov, size_t iovcnt) {
+    uint64_t total_size = 0;
+    for (size_t i = 0; i < iovcnt; ++i) {
+      total_size += iov[i].iov_len;
+    }
+    Preallocate(buf_offset_ + total_size);
+    size_t prepaid = 0;
+    while (iovcnt > 0) {
+      // Rate-limited writes are charged and issued in small pieces, which
+      // keeps large writes from bursting. The last iovec of a piece is
+      // shortened for the write if needed.
+      const size_t max_size = rate_limiter_ != nullptr
+                                  ? kRateLimitedWriteSize
+                                  : std::numeric_limits<size_t>::max();
+      size_t count = 0;
+      size_t write_size = 0;
+      while (count < std::min(iovcnt, kMaxIovecs) && write_size < max_size) {
+        write_size += iov[count++].iov_len;
+      }
+      const size_t excess = write_size > max_size ? write_size - max_size : 0;
+      iov[count - 1].iov_len -= excess;
+      write_size -= excess;
+
+      const uint64_t start = RequestWrite(write_size, &prepaid);
+      ssize_t write_result = ::writev(fd_, iov, static_cast<int>(count));
+      RecordWriteLatency(start);
+      iov[count - 1].iov_len += excess;
+      if (write_result < 0) {
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        return PosixError(filename_, errno);
+      }
+      buf_offset_ += write_result;
+      prepaid -= std::min<size_t>(prepaid, write_result);
+
+      // Skip what was written.
+      size_t written = static_cast<size_t>(write_result);
+      while (written > 0) {
+        if (written >= iov->iov_len) {
+          written -= iov->iov_len;
+          ++iov;
+          --iovcnt;
+        } else {
+          iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+          iov->iov_len -= written;
+          written = 0;
+        }
+      }
+    }
+    return RangeSyncIfNeeded();
+  }
+
+  // Charges a write of "size" bytes against rate_limiter_, if any, and
+  // returns the time at which the write starts. *prepaid holds the bytes
+  // charged but not written yet, by an interrupted or partial write, and
+  // only the bytes beyond them are charged.
+  uint64_t RequestWrite(size_t size, size_t* prepaid) {
+    if (rate_limiter_ == nullptr) {
+      return 0;
+    }
+    if (size > *prepaid) {
+      rate_limiter_->Request(size - *prepaid, rate_limiter_priority_);
+      *prepaid = size;
+    }
+    return MonotonicMicros();
+  }
+
+  void RecordWriteLatency(uint64_t start) {
+    if (rate_limiter_ != nullptr) {
+      rate_limiter_->RecordLatency(MonotonicMicros() - start);
+    }
+  }
+
+  // Allocates the file's space up to at least "end" in steps of
+  // preallocation_block_size_, without changing the file's size. This is
+  // only a hint, so failures are ignored.
+  void Preallocate(uint64_t end) {
+#if HAVE_FALLOCATE
+    if (preallocation_block_size_ == 0 || end <= preallocated_offset_) {
+      return;
+    }
+    const uint64_t new_offset =
+        (end + preallocation_block_size_ - 1) / preallocation_block_size_ *
+        preallocation_block_size_;
+    if (::fallocate(fd_, FALLOC_FL_KEEP_SIZE,
+                    static_cast<off_t>(preallocated_offset_),
+                    static_cast<off_t>(new_offset - preallocated_offset_)) ==
+        0) {
+      preallocated_offset_ = new_offset;
+    } else if (errno == EOPNOTSUPP || errno == ENOSYS) {
+      preallocation_block_size_ = 0;
+    }
+#endif  // HAVE_FALLOCATE
+  }
+
+  // Starts the writeback of the whole pages written since the last range
+  // sync once there are at least bytes_per_sync_ of them, without waiting
+  // for it to finish.
+  Status RangeSyncIfNeeded() {
+#if HAVE_SYNC_FILE_RANGE
+    static constexpr uint64_t kPageSize = 4096;
+    const uint64_t end = buf_offset_ - buf_offset_ % kPageSize;
+    if (bytes_per_sync_ == 0 || end < range_synced_offset_ + bytes_per_sync_) {
+      return Status::OK();
+    }
+    if (::sync_file_range(fd_, static_cast<off64_t>(range_synced_offset_),
+                          static_cast<off64_t>(end - range_synced_offset_),
+                          SYNC_FILE_RANGE_WRITE) != 0) {
+      return PosixError(filename_, errno);
+    }
+    range_synced_offset_ = end;
+#endif  // HAVE_SYNC_FILE_RANGE
+    return Status::OK();
+  }
+
+  // Writes the whole blocks of the buffer with direct I/O. If "pad" is
+  // true, the partial last block is written too, padded with zeros, and
+  // the padding is cut off the file again. The partial block stays in
+  // the buffer either way, to be rewritten once it grows.
+  Status FlushDirect(bool pad) {
+    const size_t whole_size = TruncateToAlignment(pos_);
+    size_t write_size = whole_size;
+    if (pad && pos_ > whole_size) {
+      write_size = RoundUpToAlignment(pos_);
+      std::memset(buf_.get() + pos_, 0, write_size - pos_);
+    }
+    Preallocate(buf_offset_ + write_size);
+    size_t written = 0;
+    size_t prepaid = 0;
+    while (written < write_size) {
+      // Like in WriteIovecs(), rate-limited writes are charged and issued
+      // in pieces, which stay aligned.
+      const size_t piece_size =
+          rate_limiter_ != nullptr
+              ? std::min(write_size - written, kRateLimitedWriteSize)
+              : write_size - written;
+      const uint64_t start = RequestWrite(piece_size, &prepaid);
+      ssize_t write_result =
+          ::pwrite(fd_, buf_.get() + written, piece_size,
+                   static_cast<off_t>(buf_offset_ + written));
+      RecordWriteLatency(start);
+      if (write_result < 0) {
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        return PosixError(filename_, errno);
+      }
+      written += write_result;
+      prepaid -= std::min<size_t>(prepaid, write_result);
+    }
+    if (write_size > whole_size) {
+      const uint64_t size = buf_offset_ + pos_;
+      if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+        return PosixError(filename_, errno);
+      }
+      // The truncation also freed the space preallocated past the end of
+      // the file, allocate it again.
+      if (preallocated_offset_ > size) {
+        const uint64_t preallocated_end = preallocated_offset_;
+        preallocated_offset_ = size;
+        Preallocate(preallocated_end);
+      }
+    }
+
+    std::memmove(buf_.get(), buf_.get() + whole_size, pos_ - whole_size);
+    buf_offset_ += whole_size;
+    pos_ -= whole_size;
+    return Status::OK();
+  }
+
+  Status SyncDirIfManifest() {
+    return is_manifest_ ? dir_syncer_->Sync(dirname_) : Status::OK();
+  }
+
+  // buf_[0, pos_ - 1] contains data to be written to fd_. The buffer is
+  // aligned for direct I/O, and so is its size.
+  const size_t buffer_size_;
+  const AlignedBuffer buf_;
+  size_t pos_;
+  int fd_;
+  const bool direct_;  // True if the file is written with O_DIRECT.
+  const uint64_t bytes_per_sync_;      // 0 if range syncs are disabled.
+  uint64_t preallocation_block_size_;  // 0 if nothing is preallocated.
+  RateLimiter* const rate_limiter_;    // nullptr if writes are unlimited.
+  const RateLimiter::Priority rate_limiter_priority_;
+  uint64_t buf_offset_;                // The file offset of buf_[0].
+  uint64_t range_synced_offset_;       // Writeback was started up to here.
+  uint64_t preallocated_offset_;       // Space is allocated up to here.
+
+  const bool is_manifest_;  // True if the file's name starts with MANIFEST.
   const std::string filename_;
+  const std::string dirname_;  // The directory of filename_;
+  PosixSyncWorker* const sync_worker_;
+  PosixDirSyncer* const dir_syncer_;
 };
 
-class PosixWritableFile final : public WritableFile {
+// Implements a WritableFile by copying appends into a shared mapping of
+// the file, so that an Append() is a memcpy() and needs no system call
+// unless it crosses into a new region. Regions start at
+// kMmapWriteMinRegionSize and double up to kMmapWriteMaxRegionSize, and
+// the file is grown to cover a region before it is mapped. Close() trims
+// the file to the bytes appended; until then, the file reads as zeros
+// past them.
+class PosixMmapWritableFile final : public WritableFile {
  public:
-  PosixWritableFile(std::string filename, int fd)
-      : pos_(0),
-        fd_(fd),
+  // Appends to |fd|, which holds "size" bytes already and must have been
+  // opened for reading and writing.
+  PosixMmapWritableFile(std::string filename, int fd, uint64_t size,
+                        PosixDirSyncer* dir_syncer)
+      : fd_(fd),
+        page_size_(static_cast<size_t>(::sysconf(_SC_PAGESIZE))),
+        region_size_(kMmapWriteMinRegionSize),
+        base_(nullptr),
+        limit_(nullptr),
+        dst_(nullptr),
+        last_sync_(nullptr),
+        region_offset_(0),
+        file_size_(size),
+        allocated_size_(size),
+        pending_sync_(false),
         is_manifest_(IsManifest(filename)),
         filename_(std::move(filename)),
-        dirname_(Dirname(filename_)) {}
+        dirname_(Dirname(filename_)),
+        dir_syncer_(dir_syncer) {}
 
-  ~PosixWritableFile() override {
+  ~PosixMmapWritableFile() override {
     if (fd_ >= 0) {
       // Ignoring any potential errors.
       Close();
     }
   }
 
+  using WritableFile::Append;
   Status Append(const Slice& data) override {
-    size_t write_size = data.size();
-    const char* write_data = data.data();
-
-    // Fit as much as possible into buffer.
-    size_t copy_size = std::min(write_size, kWritableFileBufferSize - pos_);
-    std::memcpy(buf_ + pos_, write_data, copy_size);
-    write_data += copy_size;
-    write_size -= copy_size;
-    pos_ += copy_size;
-    if (write_size == 0) {
-      return Status::OK();
-    }
-
-    // Can't fit in buffer, so need to do at least one write.
-    Status status = FlushBuffer();
-    if (!status.ok()) {
-      return status;
-    }
-
-    // Small writes go to buffer, large writes are written directly.
-    if (write_size < kWritableFileBufferSize) {
-      std::memcpy(buf_, write_data, write_size);
-      pos_ = write_size;
-      return Status::OK();
+    const char* src = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+      if (dst_ == limit_) {
+        Status status = UnmapCurrentRegion();
+        if (status.ok()) {
+          status = MapNewRegion();
+        }
+        if (!status.ok()) {
+          return status;
+        }
+      }
+      const size_t n = std::min(left, static_cast<size_t>(limit_ - dst_));
+      std::memcpy(dst_, src, n);
+      dst_ += n;
+      src += n;
+      left -= n;
+      file_size_ += n;
     }
-    return WriteUnbuffered(write_data, write_size);
+    return Status::OK();
   }
 
   Status Close() override {
-    Status status = FlushBuffer();
-    const int close_result = ::close(fd_);
-    if (close_result < 0 && status.ok()) {
+    Status status = UnmapCurrentRegion();
+    // Cut off the unused part of the last region.
+    if (allocated_size_ > file_size_ &&
+        ::ftruncate(fd_, static_cast<off_t>(file_size_)) != 0 &&
+        status.ok()) {
+      status = PosixError(filename_, errno);
+    }
+    if (::close(fd_) < 0 && status.ok()) {
       status = PosixError(filename_, errno);
     }
     fd_ = -1;
-    // if FlushBuffer() and close() both failed,
-    // we will return the FlushBuffer() error.
     return status;
   }
 
-  Status Flush() override { return FlushBuffer(); }
+  // The appended data is in the page cache already.
+  Status Flush() override { return Status::OK(); }
 
   Status Sync() override {
-    // Ensure new files referred to by the manifest are in the filesystem.
-    //
-    // This needs to happen before the manifest file is flushed to disk,
-    // to avoid crashing in a status where the manifest refers to files
-    // that are not yet on disk.
+    // See PosixWritableFile::Sync().
     Status status = SyncDirIfManifest();
     if (!status.ok()) {
       return status;
     }
 
-    status = FlushBuffer();
-    if (!status.ok()) {
-      return status;
+    if (pending_sync_) {
+      // Regions unmapped since the last Sync() can only be synced through
+      // the descriptor, which syncs the current region too.
+      pending_sync_ = false;
+      last_sync_ = dst_;
+      return SyncFd(fd_, filename_);
     }
-
-    return SyncFd(fd_, filename_);
+    if (dst_ > last_sync_) {
+#if HAVE_FULLFSYNC
+      // msync() does not flush the drive's cache either.
+      status = SyncFd(fd_, filename_);
+#else
+      // msync() needs a page-aligned start.
+      const size_t start = TruncateToPageBoundary(last_sync_ - base_);
+      const size_t end = dst_ - base_;
+      if (::msync(base_ + start, end - start, MS_SYNC) != 0) {
+        status = PosixError(filename_, errno);
+      }
+#endif  // HAVE_FULLFSYNC
+      last_sync_ = dst_;
+    }
+    return status;
   }
 
  private:
-  Status FlushBuffer() {
-    Status status = WriteUnbuffered(buf_, pos_);
-    pos_ = 0;
-    return status;
-  }
+  size_t TruncateToPageBoundary(size_t n) const { return n - n % page_size_; }
 
-  Status WriteUnbuffered(const char* data, size_t size) {
-    while (size > 0) {
-      ssize_t write_result = ::write(fd_, data, size);
-      if (write_result < 0) {
-        if (errno == EINTR) {
-          continue;  // Retry
-        }
-        return PosixError(filename_, errno);
-      }
-      data += write_result;
-      size -= write_result;
+  Status UnmapCurrentRegion() {
+    if (base_ == nullptr) {
+      return Status::OK();
     }
-    return Status::OK();
+    if (last_sync_ < dst_) {
+      pending_sync_ = true;
+    }
+    Status status;
+    if (::munmap(base_, limit_ - base_) != 0) {
+      status = PosixError(filename_, errno);
+    }
+    base_ = limit_ = dst_ = last_sync_ = nullptr;
+    // Later regions are larger, up to the maximum.
+    region_size_ = std::min(region_size_ * 2, kMmapWriteMaxRegionSize);
+    return status;
   }
 
-  Status SyncDirIfManifest() {
-    Status status;
-    if (!is_manifest_) {
+  // Maps the region that continues the file at file_size_.
+  Status MapNewRegion() {
+    assert(base_ == nullptr);
+    // Mappings start at a page boundary, so the region may begin with the
+    // last partial page of the file.
+    region_offset_ = file_size_ - file_size_ % page_size_;
+    const size_t skip = static_cast<size_t>(file_size_ - region_offset_);
+    const size_t size = std::max(region_size_, skip + page_size_);
+    Status status = GrowFile(region_offset_ + size);
+    if (!status.ok()) {
       return status;
     }
-
-    int fd = ::open(dirname_.c_str(), O_RDONLY | kOpenBaseFlags);
-    if (fd < 0) {
-      status = PosixError(dirname_, errno);
-    } else {
-      status = SyncFd(fd, dirname_);
-      ::close(fd);
+    void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+                       static_cast<off_t>(region_offset_));
+    if (ptr == MAP_FAILED) {
+      return PosixError(filename_, errno);
     }
-    return status;
+    base_ = reinterpret_cast<char*>(ptr);
+    limit_ = base_ + size;
+    dst_ = base_ + skip;
+    last_sync_ = dst_;
+    return Status::OK();
   }
 
-  // Ensures that all the caches associated with the given file descriptor's
-  // data are flushed all the way to durable media, and can withstand power
-  // failures.
-  //
-  // The fd_path argument is only used to populate the description string
-  // in the returned Status if any error occurs.
-  static Status SyncFd(int fd, const std::string& fd_path) {
-#if HAVE_FULLFSYNC
-    // On macOS and iOS, fsync() doesn't guarantee durability past power
-    // failures. fcntl(F_FULLSYNC) is required fot that purpose. Some
-    // filesystems don't support fnctl(F_FULLSYNC), and requires a
-    // fallback to fsync().
-    if (::fcntl(fd, F_FULLFSYNC) == 0) {
+  // Extends the file to at least "size" bytes. Where possible, the space
+  // is allocated too: writes to a mapped hole of a full file system would
+  // raise SIGBUS instead of failing.
+  Status GrowFile(uint64_t size) {
+    if (size <= allocated_size_) {
       return Status::OK();
     }
-#endif  // HAVE_FULLFSYNC
-
-#if HAVE_FDATASYNC
-    bool sync_success = ::fdatasync(fd) == 0;
-#else
-    bool sync_success = ::fsync(fd) == 0;
-#endif
-
-    if (sync_success) {
+#if HAVE_FALLOCATE
+    if (::fallocate(fd_, 0, static_cast<off_t>(allocated_size_),
+                    static_cast<off_t>(size - allocated_size_)) == 0) {
+      allocated_size_ = size;
       return Status::OK();
     }
-    return PosixError(fd_path, errno);
-  }
-
-  // Returns the directory name in a path pointing to a file.
-  //
-  // Returns "." if the path does not contain any directory separator.
-  static std::string Dirname(const std::string& filename) {
-    auto separator_pos = filename.rfind('/');
-    if (separator_pos == std::string::npos) {
-      return std::string(".");
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+      return PosixError(filename_, errno);
     }
-    // The filename component should not contain a path separator.
-    // If it does, the splitting was done incorrectly.
-    assert(filename.find('/', separator_pos + 1) == std::string::npos);
-
-    return filename.substr(0, separator_pos);
-  }
-
-  // Extracts the filename from a path pointing to a file.
-  //
-  // The returned Slice points to |filename|'s data buffer,
-  // so it is only valid while |filename| is alive and
-  // unchanged.
-  static Slice Basename(const std::string& filename) {
-    auto separator_pos = filename.rfind('/');
-    if (separator_pos == std::string::npos) {
-      return Slice(filename);
+#endif  // HAVE_FALLOCATE
+    if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+      return PosixError(filename_, errno);
     }
-    // The filename component should be not contain a path
-    // separator. If it does, the splitting was done
-    // incorrectly.
-    assert(filename.find('/', separator_pos + 1) == std::string::npos);
-
-    return Slice(filename.data() + separator_pos + 1,
-                 filename.length() - separator_pos - 1);
+    allocated_size_ = size;
+    return Status::OK();
   }
 
-  // True if the given file is a manifest file.
-  static bool IsManifest(const std::string& filename) {
-    return Basename(filename).starts_with("MANIFEST");
+  Status SyncDirIfManifest() {
+    return is_manifest_ ? dir_syncer_->Sync(dirname_) : Status::OK();
   }
 
-  // buf_[0, pos_ - 1] contains data to be written to fd_.
-  char buf_[kWritableFileBufferSize];
-  size_t pos_;
   int fd_;
+  const size_t page_size_;
+  size_t region_size_;  // Size of the next region to map.
+
+  // base_[0, limit_ - base_ - 1] maps the file at region_offset_, and the
+  // data is appended at dst_. All of them are nullptr while no region is
+  // mapped.
+  char* base_;
+  char* limit_;
+  char* dst_;
+  char* last_sync_;          // Data up to here was synced.
+  uint64_t region_offset_;
+  uint64_t file_size_;       // Bytes appended, including the initial ones.
+  uint64_t allocated_size_;  // Size of the file on disk until Close().
+  bool pending_sync_;        // An unmapped region was not synced.
 
   const bool is_manifest_;  // True if the file's name starts with MANIFEST.
   const std::string filename_;
   const std::string dirname_;  // The directory of filename_;
+  PosixDirSyncer* const dir_syncer_;
 };
 
 int LockOrUnlock(int fd, bool lock) {
@@ -489,6 +2403,218 @@ class PosixLockTable {
   std::set<std::string> locked_files_ GUARDED_BY(mutex_);
 };
 
+// A pool of detached threads running the work scheduled with one
+// priority. Threads are started on first use, and retired when the pool
+// shrinks by whichever thread wakes up next.
+class PosixThreadPool : public noncopyable {
+ public:
+  explicit PosixThreadPool(const char* name)
+      : name_(name),
+        cv_(&mutex_),
+        started_(false),
+        num_threads_(0),
+        options_generation_(0) {}
+
+  void Schedule(std::function<void(void*)> function, void* arg, void* tag) {
+    MutexLock l(&mutex_);
+    if (!started_) {
+      started_ = true;
+      StartThreads();
+    }
+    queue_.emplace_back(std::move(function), arg, tag, MonotonicMicros());
+    stats_.scheduled++;
+    stats_.max_queue_length = std::max<uint64_t>(stats_.max_queue_length,
+                                                 queue_.size());
+    cv_.Signal();
+  }
+
+  int Unschedule(void* tag) {
+    if (tag == nullptr) {
+      return 0;
+    }
+    MutexLock l(&mutex_);
+    const size_t before = queue_.size();
+    queue_.erase(std::remove_if(queue_.begin(), queue_.end(),
+                                [tag](const WorkItem& item) {
+                                  return item.tag == tag;
+                                }),
+                 queue_.end());
+    const int removed = static_cast<int>(before - queue_.size());
+    stats_.unscheduled += removed;
+    return removed;
+  }
+
+  void SetOptions(const ThreadPoolOptions& options) {
+    MutexLock l(&mutex_);
+    options_ = options;
+    options_.threads = std::max(options.threads, 1);
+    options_generation_++;
+    if (started_) {
+      StartThreads();
+    }
+    // Surplus threads retire, the others apply the new options.
+    cv_.SignalAll();
+  }
+
+  ThreadPoolStats GetStats() {
+    MutexLock l(&mutex_);
+    ThreadPoolStats stats = stats_;
+    stats.threads = num_threads_;
+    stats.queue_length = queue_.size();
+    return stats;
+  }
+
+ private:
+  // Stores the work item data in a Schedule() call.
+  //
+  // Instances are constructed on the thread calling Schedule() and
+  // used on the background thread.
+  struct WorkItem {
+    WorkItem(std::function<void(void*)> function, void* arg, void* tag,
+             uint64_t enqueue_micros)
+        : func(std::move(function)),
+          arg(arg),
+          tag(tag),
+          enqueue_micros(enqueue_micros) {}
+
+    std::function<void(void*)> func;
+    void* arg;
+    void* tag;
+    uint64_t enqueue_micros;
+  };
+
+  void StartThreads() EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    while (num_threads_ < options_.threads) {
+      std::thread thread(&PosixThreadPool::ThreadMain, this, num_threads_);
+      thread.detach();
+      num_threads_++;
+    }
+  }
+
+  void ThreadMain(int index) {
+#if HAVE_PTHREAD_SETNAME_NP
+    char thread_name[16];
+    std::snprintf(thread_name, sizeof(thread_name), "lsmdb:%s%d", name_,
+                  index);
+#if defined(__APPLE__)
+    ::pthread_setname_np(thread_name);
+#else
+    ::pthread_setname_np(::pthread_self(), thread_name);
+#endif  // defined(__APPLE__)
+#endif  // HAVE_PTHREAD_SETNAME_NP
+    // The threads keep what they inherit until SetOptions() is called.
+    ThreadSettings settings;
+    uint64_t applied_generation = 0;
+    mutex_.Lock();
+    while (true) {
+      if (num_threads_ > options_.threads) {
+        num_threads_--;
+        break;
+      }
+      if (applied_generation != options_generation_) {
+        const ThreadPoolOptions options = options_;
+        applied_generation = options_generation_;
+        mutex_.Unlock();
+        settings.Apply(options);
+        mutex_.Lock();
+        continue;
+      }
+      if (queue_.empty()) {
+        cv_.Wait();
+        continue;
+      }
+
+      WorkItem item = std::move(queue_.front());
+      queue_.pop_front();
+      const uint64_t wait_micros = MonotonicMicros() - item.enqueue_micros;
+      stats_.run++;
+      stats_.total_wait_micros += wait_micros;
+      stats_.max_wait_micros = std::max(stats_.max_wait_micros, wait_micros);
+      mutex_.Unlock();
+      item.func(item.arg);
+      mutex_.Lock();
+    }
+    mutex_.Unlock();
+  }
+
+  // The CPUs and the nice value of a pool thread. What the thread
+  // inherited from the process is restored when the options stop setting
+  // them.
+  class ThreadSettings {
+   public:
+    ThreadSettings() : pinned_(false), reniced_(false) {
+#if HAVE_SCHED_SETAFFINITY
+      has_inherited_cpus_ =
+          ::sched_getaffinity(0, sizeof(inherited_cpus_), &inherited_cpus_) ==
+          0;
+#endif  // HAVE_SCHED_SETAFFINITY
+#if defined(__linux__)
+      errno = 0;
+      inherited_nice_ = ::getpriority(PRIO_PROCESS, ThreadId());
+      has_inherited_nice_ = errno == 0;
+#endif  // defined(__linux__)
+    }
+
+    // Pins the calling thread to the CPUs of "options" and sets its nice
+    // value. Failures are ignored, since both are only hints.
+    void Apply(const ThreadPoolOptions& options) {
+#if HAVE_SCHED_SETAFFINITY
+      if (!options.cpus.empty()) {
+        ::cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu : options.cpus) {
+          if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpus);
+          }
+        }
+        ::sched_setaffinity(0, sizeof(cpus), &cpus);
+        pinned_ = true;
+      } else if (pinned_ && has_inherited_cpus_) {
+        ::sched_setaffinity(0, sizeof(inherited_cpus_), &inherited_cpus_);
+        pinned_ = false;
+      }
+#endif  // HAVE_SCHED_SETAFFINITY
+#if defined(__linux__)
+      // On Linux, and only there, the nice value belongs to the thread.
+      if (options.nice != ThreadPoolOptions::kInheritNice) {
+        ::setpriority(PRIO_PROCESS, ThreadId(), options.nice);
+        reniced_ = true;
+      } else if (reniced_ && has_inherited_nice_) {
+        ::setpriority(PRIO_PROCESS, ThreadId(), inherited_nice_);
+        reniced_ = false;
+      }
+#endif  // defined(__linux__)
+    }
+
+   private:
+#if defined(__linux__)
+    static id_t ThreadId() { return static_cast<id_t>(::syscall(SYS_gettid)); }
+#endif  // defined(__linux__)
+
+    bool pinned_;   // The thread runs on CPUs of the options.
+    bool reniced_;  // The thread has the nice value of the options.
+#if HAVE_SCHED_SETAFFINITY
+    bool has_inherited_cpus_;
+    ::cpu_set_t inherited_cpus_;
+#endif  // HAVE_SCHED_SETAFFINITY
+#if defined(__linux__)
+    bool has_inherited_nice_;
+    int inherited_nice_;
+#endif  // defined(__linux__)
+  };
+
+  const char* const name_;
+
+  port::Mutex mutex_;
+  port::CondVar cv_ GUARDED_BY(mutex_);
+  bool started_ GUARDED_BY(mutex_);
+  int num_threads_ GUARDED_BY(mutex_);
+  ThreadPoolOptions options_ GUARDED_BY(mutex_);
+  uint64_t options_generation_ GUARDED_BY(mutex_);
+  std::deque<WorkItem> queue_ GUARDED_BY(mutex_);
+  ThreadPoolStats stats_ GUARDED_BY(mutex_);
+};
+
 class PosixEnv : public Env {
  public:
   PosixEnv();
@@ -501,75 +2627,172 @@ class PosixEnv : public Env {
 
   Status NewSequentialFile(const std::string& filename,
                            SequentialFile** result) override {
-    int fd = ::open(filename.c_str(), O_RDONLY | kOpenBaseFlags);
-    if (fd < 0) {
+    return NewSequentialFile(filename, FileOptions(), result);
+  }
+
+  Status NewSequentialFile(const std::string& filename,
+                           const FileOptions& options,
+                           SequentialFile** result) override {
+    int fd;
+    Status status =
+        OpenFile(filename, O_RDONLY, options.use_direct_reads, &fd);
+    if (!status.ok()) {
       *result = nullptr;
-      return PosixError(filename, errno);
+      return status;
     }
 
-    *result = new PosixSequentialFile(filename, fd);
+    *result = new PosixSequentialFile(filename, fd, options.use_direct_reads,
+                                      options.readahead_size,
+                                      options.drop_consumed_pages);
     return Status::OK();
   }
 
   Status NewRandomAccessFile(const std::string& filename,
                              RandomAccessFile** result) override {
+    return NewRandomAccessFile(filename, FileOptions(), result);
+  }
+
+  Status NewRandomAccessFile(const std::string& filename,
+                             const FileOptions& options,
+                             RandomAccessFile** result) override {
     *result = nullptr;
-    int fd = ::open(filename.c_str(), O_RDONLY | kOpenBaseFlags);
-    if (fd < 0) {
-      return PosixError(filename, errno);
+    int fd;
+    Status status =
+        OpenFile(filename, O_RDONLY, options.use_direct_reads, &fd);
+    if (!status.ok()) {
+      return status;
     }
 
-    if (!mmap_limiter_.Acquire()) {
-      // if we reach the mmap limit
-      *result = new PosixRandomAccessFile(filename, fd, &fd_limiter_);
+    // Mapped files are read through the page cache.
+    if (options.use_direct_reads || !options.allow_mmap_reads) {
+      *result = new PosixRandomAccessFile(filename, fd, &fd_limiter_,
+                                          &fd_cache_, options.use_direct_reads);
       return Status::OK();
     }
 
     uint64_t file_size;
-    Status status = GetFileSize(filename, &file_size);
-    if (status.ok()) {
-      void* mmap_base =
-          ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
-      if (mmap_base != MAP_FAILED) {
-        *result = new PosixMmapReadableFile(filename,
-                                            reinterpret_cast<char*>(mmap_base),
-                                            file_size, &mmap_limiter_);
-      } else {
-        status = PosixError(filename, errno);
+    status = GetFileSize(filename, &file_size);
+    if (!status.ok()) {
+      ::close(fd);
+      return status;
+    }
+
+    if (mmap_manager_.adaptive()) {
+      // Empty files can not be mapped, and need no reads anyway.
+      std::shared_ptr<PosixMapping> mapping;
+      if (file_size > 0 && mmap_manager_.Reserve(file_size)) {
+        void* mmap_base =
+            ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mmap_base != MAP_FAILED) {
+          AdviseMapping(reinterpret_cast<char*>(mmap_base), file_size,
+                        options);
+          mapping = std::make_shared<PosixMapping>(
+              reinterpret_cast<char*>(mmap_base), file_size, &mmap_manager_);
+        } else {
+          mmap_manager_.Release(file_size);
+        }
       }
+      *result = new PosixAdaptiveRandomAccessFile(
+          filename, file_size, options, &mmap_manager_,
+          new PosixRandomAccessFile(filename, fd, &fd_limiter_, &fd_cache_,
+                                    false),
+          std::move(mapping));
+      return Status::OK();
     }
-    ::close(fd);
-    if (!status.ok()) {
-      mmap_limiter_.Release();
+
+    if (!mmap_manager_.Reserve(file_size)) {
+      // Over the size threshold or the mmap budget.
+      *result = new PosixRandomAccessFile(filename, fd, &fd_limiter_,
+                                          &fd_cache_, false);
+      return Status::OK();
+    }
+
+    void* mmap_base = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mmap_base != MAP_FAILED) {
+      AdviseMapping(reinterpret_cast<char*>(mmap_base), file_size, options);
+      *result = new PosixMmapReadableFile(filename,
+                                          reinterpret_cast<char*>(mmap_base),
+                                          file_size, &mmap_manager_);
+    } else {
+      status = PosixError(filename, errno);
+      mmap_manager_.Release(file_size);
     }
+    ::close(fd);
     return status;
   }
 
   Status NewWritableFile(const std::string& filename,
                          WritableFile** result) override {
-    int fd = ::open(filename.c_str(),
-                    O_TRUNC | O_WRONLY | O_CREAT | kOpenBaseFlags, 0644);
+    return NewWritableFile(filename, FileOptions(), result);
+  }
 
-    if (fd < 0) {
+  Status NewWritableFile(const std::string& filename,
+                         const FileOptions& options,
+                         WritableFile** result) override {
+    const bool mmap = UseMmapWrites(options);
+    int fd;
+    // Writing a shared mapping needs the file to be readable too.
+    Status status =
+        OpenFile(filename, O_TRUNC | (mmap ? O_RDWR : O_WRONLY) | O_CREAT,
+                 options.use_direct_writes, &fd);
+    if (!status.ok()) {
       *result = nullptr;
-      return PosixError(filename, errno);
+      return status;
     }
+    dir_syncer_.MarkParentDirty(filename);
 
-    *result = new PosixWritableFile(filename, fd);
+    if (mmap) {
+      *result = new PosixMmapWritableFile(filename, fd, 0, &dir_syncer_);
+    } else {
+      *result = new PosixWritableFile(filename, fd, options.use_direct_writes,
+                                      options, &sync_worker_, &dir_syncer_);
+    }
     return Status::OK();
   }
 
   Status NewAppendableFile(const std::string& filename,
                            WritableFile** result) override {
-    int fd = ::open(filename.c_str(),
-                    O_APPEND | O_WRONLY | O_CREAT | kOpenBaseFlags, 0644);
+    return NewAppendableFile(filename, FileOptions(), result);
+  }
 
-    if (fd < 0) {
-      *result = nullptr;
-      return PosixError(filename, errno);
+  Status NewAppendableFile(const std::string& filename,
+                           const FileOptions& options,
+                           WritableFile** result) override {
+    *result = nullptr;
+    const bool mmap = UseMmapWrites(options);
+    // With direct I/O, O_APPEND would override the offsets of pwrite(),
+    // and the last partial block has to be read back. Mapped files are
+    // written past the end of the file.
+    const int flags = options.use_direct_writes || mmap
+                          ? O_RDWR | O_CREAT
+                          : O_APPEND | O_WRONLY | O_CREAT;
+    int fd;
+    Status status =
+        OpenFile(filename, flags, options.use_direct_writes, &fd);
+    if (!status.ok()) {
+      return status;
     }
-
-    *result = new PosixWritableFile(filename, fd);
+    dir_syncer_.MarkParentDirty(filename);
+    struct ::stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+      status = PosixError(filename, errno);
+      ::close(fd);
+      return status;
+    }
+    if (mmap) {
+      *result = new PosixMmapWritableFile(filename, fd, file_stat.st_size,
+                                          &dir_syncer_);
+      return Status::OK();
+    }
+    PosixWritableFile* file =
+        new PosixWritableFile(filename, fd, options.use_direct_writes, options,
+                              &sync_worker_, &dir_syncer_);
+    status = file->LoadTail(file_stat.st_size);
+    if (!status.ok()) {
+      delete file;
+      return status;
+    }
+    *result = file;
     return Status::OK();
   }
 
@@ -596,6 +2819,7 @@ class PosixEnv : public Env {
     if (::unlink(filename.c_str()) != 0) {
       return PosixError(filename, errno);
     }
+    dir_syncer_.MarkParentDirty(filename);
     return Status::OK();
   }
 
@@ -603,13 +2827,20 @@ class PosixEnv : public Env {
     if (::mkdir(dirname.c_str(), 0755) != 0) {
       return PosixError(dirname, errno);
     }
+    dir_syncer_.MarkParentDirty(dirname);
     return Status::OK();
   }
 
   Status RemoveDir(const std::string& dirname) override {
+    PosixDirSyncer::DirId id;
+    const bool has_id = PosixDirSyncer::GetDirId(dirname, &id);
     if (::rmdir(dirname.c_str()) != 0) {
       return PosixError(dirname, errno);
     }
+    if (has_id) {
+      dir_syncer_.MarkDirty(id);
+    }
+    dir_syncer_.MarkParentDirty(dirname);
     return Status::OK();
   }
 
@@ -627,9 +2858,15 @@ class PosixEnv : public Env {
     if (std::rename(from.c_str(), to.c_str()) != 0) {
       return PosixError(from, errno);
     }
+    dir_syncer_.MarkParentDirty(from);
+    dir_syncer_.MarkParentDirty(to);
     return Status::OK();
   }
 
+  Status SyncDir(const std::string& dirname) override {
+    return dir_syncer_.Sync(dirname);
+  }
+
   Status LockFile(const std::string& filename, FileLock** lock) override {
     *lock = nullptr;
 
@@ -637,6 +2874,7 @@ class PosixEnv : public Env {
     if (fd < 0) {
       return PosixError(filename, errno);
     }
+    dir_syncer_.MarkParentDirty(filename);
 
     if (!locks_.Insert(filename)) {
       ::close(fd);
@@ -669,7 +2907,38 @@ class PosixEnv : public Env {
   }
 
   void Schedule(std::function<void(void*)> background_work_function,
-                void* background_work_arg) override;
+                void* background_work_arg) override {
+    Schedule(std::move(background_work_function), background_work_arg, kLow,
+             nullptr);
+  }
+
+  void Schedule(std::function<void(void*)> background_work_function,
+                void* background_work_arg, Priority priority,
+                void* tag) override {
+    Pool(priority)->Schedule(std::move(background_work_function),
+                              background_work_arg, tag);
+  }
+
+  int Unschedule(void* tag, Priority priority) override {
+    return Pool(priority)->Unschedule(tag);
+  }
+
+  void SetThreadPoolOptions(Priority priority,
+                            const ThreadPoolOptions& options) override {
+    Pool(priority)->SetOptions(options);
+  }
+
+  ThreadPoolStats GetThreadPoolStats(Priority priority) override {
+    return Pool(priority)->GetStats();
+  }
+
+  void SetMmapOptions(const MmapOptions& options) override {
+    mmap_manager_.SetOptions(options);
+  }
+
+  MmapStats GetMmapStats() override { return mmap_manager_.GetStats(); }
+
+  FdCacheStats GetFdCacheStats() override { return fd_cache_.GetStats(); }
 
   void StartThread(std::function<void(void*)> thread_main,
                    void* thread_main_arg) override {
@@ -706,6 +2975,7 @@ class PosixEnv : public Env {
       *result = nullptr;
       return PosixError(filename, errno);
     }
+    dir_syncer_.MarkParentDirty(filename);
 
     std::FILE* fp = ::fdopen(fd, "w");
     if (fp == nullptr) {
@@ -729,38 +2999,43 @@ class PosixEnv : public Env {
     std::this_thread::sleep_for(std::chrono::microseconds(micros));
   }
 
- private:
-  void BackgroundThreadMain();
-
-  static void BackgroundThreadEntryPoint(PosixEnv* env) {
-    env->BackgroundThreadMain();
+  Status PollReads(size_t min_completions,
+                   std::vector<ReadRequest*>* completed) override {
+    // Reads of mmap-ed files, and reads without io_uring, finish
+    // synchronously.
+    const size_t before = completed->size();
+    Status status = Env::PollReads(0, completed);
+#if HAVE_IO_URING
+    PosixIoUring* ring = PosixIoUring::CurrentIfCreated();
+    const size_t finished = completed->size() - before;
+    if (status.ok() && ring != nullptr) {
+      status = ring->Reap(
+          min_completions > finished ? min_completions - finished : 0,
+          completed);
+    }
+#endif  // HAVE_IO_URING
+    return status;
   }
 
-  // Stores the work item data in a Schedule() call.
-  //
-  // Instances are constructed on the thread calling Schedule() and
-  // used on the background thread.
-  //
-  // This structure is thread-safe because it is immutable.
-  // note that we MUST NOT use malloc to allocate memory for this struct.
-  struct BackgroundWorkItem {
-    explicit BackgroundWorkItem(std::function<void(void*)> function, void* arg)
-        : func(std::move(function)), arg(arg) {}
-
-    const std::function<void(void*)> func;
-    void* const arg;
-  };
+ private:
+  // Direct I/O takes precedence over mapping the file.
+  static bool UseMmapWrites(const FileOptions& options) {
+    return options.use_mmap_writes && !options.use_direct_writes;
+  }
 
-  port::Mutex background_work_mutex_;
-  port::CondVar background_work_cv_ GUARDED_BY(background_work_mutex_);
-  bool started_background_thread_ GUARDED_BY(background_work_mutex_);
+  PosixThreadPool* Pool(Priority priority) {
+    return priority == kHigh ? &high_pool_ : &low_pool_;
+  }
 
-  std::queue<BackgroundWorkItem> background_work_queue_
-      GUARDED_BY(background_work_mutex_);
+  PosixThreadPool low_pool_;
+  PosixThreadPool high_pool_;
 
   PosixLockTable locks_;  // Thread-safe.
-  Limiter mmap_limiter_;  // Thread-safe.
-  Limiter fd_limiter_;    // Thread-safe.
+  PosixMmapManager mmap_manager_;  // Thread-safe.
+  Limiter fd_limiter_;             // Thread-safe.
+  PosixFdCache fd_cache_;          // Thread-safe.
+  PosixSyncWorker sync_worker_;    // Thread-safe.
+  PosixDirSyncer dir_syncer_;      // Thread-safe.
 };
 
 // Return the maximum number of concurrent mmaps.
@@ -784,52 +3059,22 @@ int MaxOpenFiles() {
   return g_open_read_only_file_limit;
 }
 
-}  // namespace
-
-PosixEnv::PosixEnv()
-    : background_work_cv_(&background_work_mutex_),
-      started_background_thread_(false),
-      mmap_limiter_(MaxMmaps()),
-      fd_limiter_(MaxOpenFiles()) {}
-
-void PosixEnv::Schedule(std::function<void(void*)> background_work_function,
-                        void* background_work_arg) {
-  background_work_mutex_.Lock();
-
-  // Start the background thread, if we haven't done so already.
-  if (!started_background_thread_) {
-    started_background_thread_ = true;
-    std::thread background_thread(PosixEnv::BackgroundThreadEntryPoint, this);
-    background_thread.detach();
-  }
-
-  // If the queue is empty, the background thread may be waiting for work.
-  if (background_work_queue_.empty()) {
-    background_work_cv_.Signal();
-  }
-
-  background_work_queue_.emplace(background_work_function, background_work_arg);
-  background_work_mutex_.Unlock();
+// Return the part of MaxOpenFiles() left to the fd cache, so that files
+// opened after the permanent descriptors ran out still keep the hot ones
+// open.
+int FdCacheCapacity() {
+  const int limit = MaxOpenFiles();
+  return limit / 4 + (limit % 4 != 0 ? 1 : 0);
 }
 
-void PosixEnv::BackgroundThreadMain() {
-  while (true) {
-    background_work_mutex_.Lock();
-
-    // Wait until there is work to be done.
-    while (background_work_queue_.empty()) {
-      background_work_cv_.Wait();
-    }
-
-    assert(!background_work_queue_.empty());
-    auto background_work_function = background_work_queue_.front().func;
-    auto background_work_arg = background_work_queue_.front().arg;
-    background_work_queue_.pop();
+}  // namespace
 
-    background_work_mutex_.Unlock();
-    background_work_function(background_work_arg);
-  }
-}
+PosixEnv::PosixEnv()
+    : low_pool_("low"),
+      high_pool_("high"),
+      mmap_manager_(MaxMmaps()),
+      fd_limiter_(MaxOpenFiles() - FdCacheCapacity()),
+      fd_cache_(FdCacheCapacity()) {}
 
 namespace {
 
@@ -897,6 +3142,14 @@ void EnvPosixTestHelper::SetReadOnlyMMapLimit(int limit) {
   g_mmap_limit = limit;
 }
 
+void EnvPosixTestHelper::SetUseIoUring(bool use) {
+  g_use_io_uring.store(use, std::memory_order_relaxed);
+}
+
+uint64_t EnvPosixTestHelper::GetDirSyncCount() {
+  return g_dir_syncs.load(std::memory_order_relaxed);
+}
+
 Env* Env::Default() {
   static PosixDefaultEnv env_container;
   return env_container.env();
@@ -0,0 +1,1210 @@
+//
+// Created by 刘文景 on 2021/4/16.
+//
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "lsmdb/env.h"
+#include "lsmdb/rate_limiter.h"
+#include "port/port.h"
+#include "util/env_posix_test_helper.h"
+#include "util/mutexlock.h"
+#include "util/test_util.h"
+
+namespace lsmdb {
+
+static const int kReadOnlyFileLimit = 8;
+
+class EnvPosixTest : public testing::Test {
+ public:
+  EnvPosixTest() : env_(Env::Default()) {}
+
+  static void SetFileLimit(int limit) {
+    EnvPosixTestHelper::SetReadOnlyFDLimit(limit);
+  }
+
+  static void SetUseIoUring(bool use) { EnvPosixTestHelper::SetUseIoUring(use); }
+
+  static uint64_t GetDirSyncCount() {
+    return EnvPosixTestHelper::GetDirSyncCount();
+  }
+
+  // Write a file of "size" random bytes named "name" into the test
+  // directory, store its contents in *contents and return its path.
+  std::string WriteTestFile(const std::string& name, size_t size,
+                            std::string* contents) {
+    std::string test_dir;
+    EXPECT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+    const std::string path = test_dir + "/" + name;
+    Random rnd(test::RandomSeed());
+    contents->clear();
+    while (contents->size() < size) {
+      contents->push_back(static_cast<char>(' ' + rnd.Uniform(95)));
+    }
+    EXPECT_LSMDB_OK(WriteStringToFile(env_, *contents, path));
+    return path;
+  }
+
+  // Read "count" random ranges of "file" through ReadAsync(), with up to
+  // "depth" reads in flight, and check them against "contents".
+  void CheckAsyncReads(RandomAccessFile* file, const std::string& contents,
+                       int count, size_t depth) {
+    Random rnd(test::RandomSeed());
+    std::vector<ReadRequest> requests(count);
+    std::vector<std::string> scratch(count);
+    std::vector<ReadRequest*> completed;
+    size_t in_flight = 0;
+    int finished = 0;
+    for (int i = 0; i < count; ++i) {
+      ReadRequest& req = requests[i];
+      req.offset = rnd.Uniform(static_cast<int>(contents.size()));
+      // Some of the reads go past the end of the file.
+      req.n = 1 + rnd.Uniform(8192);
+      scratch[i].resize(req.n);
+      req.scratch = &scratch[i][0];
+      ASSERT_LSMDB_OK(file->ReadAsync(&req));
+      if (++in_flight == depth) {
+        completed.clear();
+        ASSERT_LSMDB_OK(env_->PollReads(1, &completed));
+        ASSERT_LE(1, completed.size());
+        in_flight -= completed.size();
+        finished += CheckCompleted(completed, contents);
+      }
+    }
+    completed.clear();
+    ASSERT_LSMDB_OK(env_->PollReads(in_flight, &completed));
+    ASSERT_EQ(in_flight, completed.size());
+    finished += CheckCompleted(completed, contents);
+    ASSERT_EQ(count, finished);
+
+    // Nothing is left in flight.
+    completed.clear();
+    ASSERT_LSMDB_OK(env_->PollReads(1, &completed));
+    ASSERT_TRUE(completed.empty());
+  }
+
+  // Read ranges of "file" that are adjacent, close to each other, far
+  // apart, overlapping, empty and past the end with a single MultiRead()
+  // and check them against "contents".
+  void CheckMultiRead(RandomAccessFile* file, const std::string& contents) {
+    const uint64_t size = contents.size();
+    const uint64_t kOffsets[] = {size - 100, 0,   4096, 8192,    8200,
+                                 12000,      500, 70000, 4000,   9000,
+                                 size + 10,  100, 20000, size - 1};
+    const size_t kSizes[] = {100,  4096, 4096, 8, 4096, 100, 0,
+                             4096, 5000, 200,  10, 300, 1,   2};
+    const size_t n = sizeof(kOffsets) / sizeof(kOffsets[0]);
+    std::vector<ReadRequest> reqs(n);
+    std::vector<std::string> scratch(n);
+    for (size_t i = 0; i < n; ++i) {
+      reqs[i].offset = kOffsets[i];
+      reqs[i].n = kSizes[i];
+      scratch[i].resize(kSizes[i]);
+      reqs[i].scratch = &scratch[i][0];
+    }
+    ASSERT_LSMDB_OK(file->MultiRead(reqs.data(), n));
+    for (size_t i = 0; i < n; ++i) {
+      ASSERT_LSMDB_OK(reqs[i].status);
+      const std::string expected =
+          kOffsets[i] < size ? contents.substr(kOffsets[i], kSizes[i]) : "";
+      ASSERT_EQ(expected, reqs[i].result.ToString()) << "request " << i;
+    }
+  }
+
+  // Read "file" to its end with reads and skips of random sizes and check
+  // what is read against "contents".
+  static void CheckSequentialReads(SequentialFile* file,
+                                   const std::string& contents) {
+    Random rnd(test::RandomSeed());
+    std::string scratch(1 << 20, '\0');
+    uint64_t offset = 0;
+    while (true) {
+      const size_t n = rnd.Skewed(20);
+      if (rnd.OneIn(4)) {
+        ASSERT_LSMDB_OK(file->Skip(n));
+        offset += n;
+        continue;
+      }
+      Slice result;
+      ASSERT_LSMDB_OK(file->Read(n, &result, &scratch[0]));
+      const std::string expected =
+          offset < contents.size() ? contents.substr(offset, n) : "";
+      ASSERT_EQ(expected, result.ToString()) << "read at " << offset;
+      if (n > 0 && result.empty()) {
+        break;
+      }
+      offset += n;
+    }
+  }
+
+  Env* env_;
+
+ private:
+  static int CheckCompleted(const std::vector<ReadRequest*>& completed,
+                            const std::string& contents) {
+    for (const ReadRequest* req : completed) {
+      EXPECT_LSMDB_OK(req->status);
+      EXPECT_EQ(contents.substr(req->offset, req->n),
+                req->result.ToString());
+    }
+    return static_cast<int>(completed.size());
+  }
+};
+
+TEST_F(EnvPosixTest, AsyncReads) {
+  std::string contents;
+  const std::string path = WriteTestFile("async_reads", 1 << 20, &contents);
+  FileOptions options;
+  options.allow_mmap_reads = false;
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(path, options, &file));
+
+  CheckAsyncReads(file, contents, 1000, 32);
+  // More reads in flight than an io_uring ring has entries.
+  CheckAsyncReads(file, contents, 1000, 1000);
+
+  delete file;
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, AsyncReadsWithoutIoUring) {
+  std::string contents;
+  const std::string path = WriteTestFile("async_reads", 1 << 20, &contents);
+  FileOptions options;
+  options.allow_mmap_reads = false;
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(path, options, &file));
+
+  SetUseIoUring(false);
+  CheckAsyncReads(file, contents, 1000, 32);
+  SetUseIoUring(true);
+
+  delete file;
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, AsyncReadsOfMmapFile) {
+  std::string contents;
+  const std::string path = WriteTestFile("async_reads", 1 << 20, &contents);
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(path, &file));
+
+  // Reads past the end of a mmap-ed file fail, so stay within it.
+  Random rnd(test::RandomSeed());
+  std::vector<ReadRequest> requests(100);
+  for (ReadRequest& req : requests) {
+    req.offset = rnd.Uniform(static_cast<int>(contents.size()) - 8192);
+    req.n = 1 + rnd.Uniform(8192);
+    ASSERT_LSMDB_OK(file->ReadAsync(&req));
+  }
+  std::vector<ReadRequest*> completed;
+  ASSERT_LSMDB_OK(env_->PollReads(requests.size(), &completed));
+  ASSERT_EQ(requests.size(), completed.size());
+  for (size_t i = 0; i < requests.size(); ++i) {
+    ASSERT_EQ(&requests[i], completed[i]);
+    ASSERT_LSMDB_OK(requests[i].status);
+    ASSERT_EQ(contents.substr(requests[i].offset, requests[i].n),
+              requests[i].result.ToString());
+  }
+
+  delete file;
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, MultiRead) {
+  std::string contents;
+  const std::string path = WriteTestFile("multi_read", 1 << 20, &contents);
+  FileOptions options;
+  options.allow_mmap_reads = false;
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(path, options, &file));
+
+  CheckMultiRead(file, contents);
+  SetUseIoUring(false);
+  CheckMultiRead(file, contents);
+  SetUseIoUring(true);
+
+  // Reads started with ReadAsync() are not affected by MultiRead().
+  CheckAsyncReads(file, contents, 100, 100);
+  std::vector<ReadRequest> pending(10);
+  std::vector<std::string> scratch(10, std::string(100, '\0'));
+  for (int i = 0; i < 10; ++i) {
+    pending[i].offset = i * 1000;
+    pending[i].n = 100;
+    pending[i].scratch = &scratch[i][0];
+    ASSERT_LSMDB_OK(file->ReadAsync(&pending[i]));
+  }
+  CheckMultiRead(file, contents);
+  std::vector<ReadRequest*> completed;
+  ASSERT_LSMDB_OK(env_->PollReads(10, &completed));
+  ASSERT_EQ(10, completed.size());
+  for (const ReadRequest& req : pending) {
+    ASSERT_EQ(contents.substr(req.offset, 100), req.result.ToString());
+  }
+
+  delete file;
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, MultiReadOfMmapFile) {
+  std::string contents;
+  const std::string path = WriteTestFile("multi_read", 1 << 20, &contents);
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(path, &file));
+
+  ReadRequest reqs[2];
+  char scratch[2][100];
+  for (int i = 0; i < 2; ++i) {
+    reqs[i].offset = 1000 * i;
+    reqs[i].n = 100;
+    reqs[i].scratch = scratch[i];
+  }
+  ASSERT_LSMDB_OK(file->MultiRead(reqs, 2));
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_LSMDB_OK(reqs[i].status);
+    ASSERT_EQ(contents.substr(1000 * i, 100), reqs[i].result.ToString());
+    // Served from the mapping, not copied.
+    ASSERT_NE(reqs[i].scratch, reqs[i].result.data());
+  }
+
+  delete file;
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, DirectWrites) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string path = test_dir + "/direct_writes";
+  FileOptions options;
+  options.use_direct_writes = true;
+  WritableFile* file;
+  Status status = env_->NewWritableFile(path, options, &file);
+  if (status.IsNotSupportedError()) {
+    GTEST_SKIP() << status.ToString();
+  }
+  ASSERT_LSMDB_OK(status);
+
+  // Unaligned appends, partly larger than the write buffer, with a Sync()
+  // of a partial block in between.
+  Random rnd(test::RandomSeed());
+  std::string contents;
+  for (int i = 0; i < 100; ++i) {
+    const std::string data = test::RandomKey(&rnd, 1 + rnd.Skewed(17));
+    ASSERT_LSMDB_OK(file->Append(data));
+    contents += data;
+    if (i == 50) {
+      ASSERT_LSMDB_OK(file->Sync());
+      uint64_t size;
+      ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+      ASSERT_EQ(contents.size(), size);
+    }
+  }
+  ASSERT_LSMDB_OK(file->Close());
+  delete file;
+
+  uint64_t size;
+  ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+  ASSERT_EQ(contents.size(), size);
+  std::string read;
+  ASSERT_LSMDB_OK(ReadFileToString(env_, path, &read));
+  ASSERT_EQ(contents, read);
+
+  // Continue the file from its partial last block.
+  ASSERT_LSMDB_OK(env_->NewAppendableFile(path, options, &file));
+  ASSERT_LSMDB_OK(file->Append("appended"));
+  ASSERT_LSMDB_OK(file->Close());
+  delete file;
+  ASSERT_LSMDB_OK(ReadFileToString(env_, path, &read));
+  ASSERT_EQ(contents + "appended", read);
+
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, DirectReads) {
+  std::string contents;
+  const std::string path = WriteTestFile("direct_reads", 100000, &contents);
+  FileOptions options;
+  options.use_direct_reads = true;
+
+  SequentialFile* seq_file;
+  Status status = env_->NewSequentialFile(path, options, &seq_file);
+  if (status.IsNotSupportedError()) {
+    ASSERT_LSMDB_OK(env_->RemoveFile(path));
+    GTEST_SKIP() << status.ToString();
+  }
+  ASSERT_LSMDB_OK(status);
+  std::string read;
+  std::string scratch(10000, '\0');
+  Slice result;
+  ASSERT_LSMDB_OK(seq_file->Skip(1000));
+  do {
+    ASSERT_LSMDB_OK(seq_file->Read(3000, &result, &scratch[0]));
+    read.append(result.data(), result.size());
+  } while (!result.empty());
+  ASSERT_EQ(contents.substr(1000), read);
+  delete seq_file;
+
+  RandomAccessFile* file;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(path, options, &file));
+  // Aligned and unaligned ranges, including one past the end.
+  const uint64_t kOffsets[] = {0, 4096, 100, 99000, 0, 200000};
+  const size_t kSizes[] = {4096, 8192, 5000, 5000, 1, 10};
+  for (size_t i = 0; i < sizeof(kOffsets) / sizeof(kOffsets[0]); ++i) {
+    ASSERT_LSMDB_OK(file->Read(kOffsets[i], kSizes[i], &result, &scratch[0]));
+    const std::string expected = kOffsets[i] < contents.size()
+                                     ? contents.substr(kOffsets[i], kSizes[i])
+                                     : "";
+    ASSERT_EQ(expected, result.ToString()) << "read " << i;
+  }
+  CheckAsyncReads(file, contents, 100, 10);
+  CheckMultiRead(file, contents);
+  delete file;
+
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, SequentialReadahead) {
+  std::string contents;
+  const std::string path =
+      WriteTestFile("sequential_readahead", 3 << 20, &contents);
+  const size_t kReadaheadSizes[] = {0, 1, 4096, 100000};
+  for (size_t readahead_size : kReadaheadSizes) {
+    for (int drop_consumed_pages = 0; drop_consumed_pages < 2;
+         ++drop_consumed_pages) {
+      FileOptions options;
+      options.readahead_size = readahead_size;
+      options.drop_consumed_pages = drop_consumed_pages;
+      SequentialFile* file;
+      ASSERT_LSMDB_OK(env_->NewSequentialFile(path, options, &file));
+      CheckSequentialReads(file, contents);
+      delete file;
+    }
+
+    FileOptions options;
+    options.readahead_size = readahead_size;
+    options.use_direct_reads = true;
+    SequentialFile* file;
+    Status status = env_->NewSequentialFile(path, options, &file);
+    if (status.IsNotSupportedError()) {
+      continue;
+    }
+    ASSERT_LSMDB_OK(status);
+    CheckSequentialReads(file, contents);
+    delete file;
+  }
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, WritableFileBufferSize) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string path = test_dir + "/writable_file_buffer_size";
+
+  const size_t kBufferSizes[] = {0, 1, 4096, 100000, 1 << 20};
+  for (size_t buffer_size : kBufferSizes) {
+    for (int direct = 0; direct < 2; ++direct) {
+      FileOptions options;
+      options.writable_file_buffer_size = buffer_size;
+      options.use_direct_writes = direct;
+      WritableFile* file;
+      Status status = env_->NewWritableFile(path, options, &file);
+      if (status.IsNotSupportedError()) {
+        continue;
+      }
+      ASSERT_LSMDB_OK(status);
+      Random rnd(test::RandomSeed());
+      std::string contents;
+      for (int i = 0; i < 100; ++i) {
+        const std::string data = test::RandomKey(&rnd, rnd.Skewed(17));
+        ASSERT_LSMDB_OK(file->Append(data));
+        contents += data;
+      }
+      ASSERT_LSMDB_OK(file->Close());
+      delete file;
+      std::string read;
+      ASSERT_LSMDB_OK(ReadFileToString(env_, path, &read));
+      ASSERT_TRUE(contents == read)
+          << "buffer size " << buffer_size << " direct " << direct;
+    }
+  }
+
+  // Appends stay in a large buffer until it is full.
+  FileOptions options;
+  options.writable_file_buffer_size = 1 << 20;
+  WritableFile* file;
+  ASSERT_LSMDB_OK(env_->NewWritableFile(path, options, &file));
+  const std::string data(500 << 10, 'x');
+  ASSERT_LSMDB_OK(file->Append(data));
+  uint64_t size;
+  ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+  ASSERT_EQ(0, size);
+  ASSERT_LSMDB_OK(file->Append(data));
+  ASSERT_LSMDB_OK(file->Append(data));
+  ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+  ASSERT_EQ(3 * data.size(), size);
+  ASSERT_LSMDB_OK(file->Close());
+  delete file;
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, BytesPerSync) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string path = test_dir + "/bytes_per_sync";
+  FileOptions options;
+  options.bytes_per_sync = 64 << 10;
+
+  Random rnd(test::RandomSeed());
+  std::string contents;
+  for (int reopen = 0; reopen < 2; ++reopen) {
+    WritableFile* file;
+    if (reopen == 0) {
+      ASSERT_LSMDB_OK(env_->NewWritableFile(path, options, &file));
+    } else {
+      ASSERT_LSMDB_OK(env_->NewAppendableFile(path, options, &file));
+    }
+    for (int i = 0; i < 200; ++i) {
+      const std::string data = test::RandomKey(&rnd, 1 + rnd.Skewed(17));
+      ASSERT_LSMDB_OK(file->Append(data));
+      contents += data;
+    }
+    ASSERT_LSMDB_OK(file->Sync());
+    ASSERT_LSMDB_OK(file->Close());
+    delete file;
+  }
+
+  std::string read;
+  ASSERT_LSMDB_OK(ReadFileToString(env_, path, &read));
+  ASSERT_EQ(contents, read);
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+// Returns true if the file system of "dir" can allocate space past the
+// end of a file.
+static bool SupportsPreallocation(const std::string& dir) {
+#if HAVE_FALLOCATE
+  const std::string path = dir + "/fallocate_probe";
+  const int fd = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const bool supported = ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 4096) == 0;
+  ::close(fd);
+  ::unlink(path.c_str());
+  return supported;
+#else
+  return false;
+#endif  // HAVE_FALLOCATE
+}
+
+TEST_F(EnvPosixTest, Preallocation) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string path = test_dir + "/preallocation";
+  const uint64_t kBlockSize = 1 << 20;
+  const bool preallocated = SupportsPreallocation(test_dir);
+  FileOptions options;
+  options.preallocation_block_size = kBlockSize;
+
+  for (int direct = 0; direct < 2; ++direct) {
+    options.use_direct_writes = direct;
+    WritableFile* file;
+    Status status = env_->NewWritableFile(path, options, &file);
+    if (status.IsNotSupportedError()) {
+      continue;
+    }
+    ASSERT_LSMDB_OK(status);
+    // Syncs of partial blocks with direct I/O must keep the space too.
+    const std::string data(10000, 'x');
+    ASSERT_LSMDB_OK(file->Append(data.substr(0, 5000)));
+    ASSERT_LSMDB_OK(file->Sync());
+    ASSERT_LSMDB_OK(file->Append(data.substr(5000)));
+    ASSERT_LSMDB_OK(file->Sync());
+
+    // The space is allocated, but the size of the file is unchanged.
+    uint64_t size;
+    ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+    ASSERT_EQ(data.size(), size);
+    struct ::stat file_stat;
+    ASSERT_EQ(0, ::stat(path.c_str(), &file_stat));
+    if (preallocated) {
+      ASSERT_GE(static_cast<uint64_t>(file_stat.st_blocks) * 512, kBlockSize)
+          << "direct " << direct;
+    }
+
+    ASSERT_LSMDB_OK(file->Close());
+    delete file;
+    ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+    ASSERT_EQ(data.size(), size);
+    ASSERT_EQ(0, ::stat(path.c_str(), &file_stat));
+    if (preallocated) {
+      // Close() released the space past the end of the file.
+      ASSERT_LT(static_cast<uint64_t>(file_stat.st_blocks) * 512, kBlockSize);
+    }
+    std::string read;
+    ASSERT_LSMDB_OK(ReadFileToString(env_, path, &read));
+    ASSERT_EQ(data, read);
+  }
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, MmapWrites) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string path = test_dir + "/mmap_writes";
+  FileOptions options;
+  options.use_mmap_writes = true;
+
+  // Small appends across several regions, then appends to the partial
+  // last page of the closed file, some of them larger than a region.
+  Random rnd(test::RandomSeed());
+  std::string contents;
+  for (int reopen = 0; reopen < 2; ++reopen) {
+    WritableFile* file;
+    if (reopen == 0) {
+      ASSERT_LSMDB_OK(env_->NewWritableFile(path, options, &file));
+    } else {
+      ASSERT_LSMDB_OK(env_->NewAppendableFile(path, options, &file));
+    }
+    for (int i = 0; i < 2000; ++i) {
+      const size_t size = i % 500 == 499 ? 1 << 20 : 1 + rnd.Skewed(12);
+      const std::string data = test::RandomKey(&rnd, size);
+      ASSERT_LSMDB_OK(file->Append(data));
+      contents += data;
+      if (i % 300 == 0) {
+        ASSERT_LSMDB_OK(file->Sync());
+        // The file is grown ahead of the appends.
+        uint64_t size;
+        ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+        ASSERT_LE(contents.size(), size);
+      }
+    }
+    ASSERT_LSMDB_OK(file->Sync());
+    ASSERT_LSMDB_OK(file->Close());
+    delete file;
+
+    // Close() trimmed the file.
+    uint64_t size;
+    ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+    ASSERT_EQ(contents.size(), size);
+    std::string read;
+    ASSERT_LSMDB_OK(ReadFileToString(env_, path, &read));
+    ASSERT_TRUE(contents == read);
+  }
+
+  // An empty file stays empty.
+  WritableFile* file;
+  ASSERT_LSMDB_OK(env_->NewWritableFile(path, options, &file));
+  ASSERT_LSMDB_OK(file->Sync());
+  ASSERT_LSMDB_OK(file->Close());
+  delete file;
+  uint64_t size;
+  ASSERT_LSMDB_OK(env_->GetFileSize(path, &size));
+  ASSERT_EQ(0, size);
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, RateLimitedWrites) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string path = test_dir + "/rate_limited_writes";
+  RateLimiterOptions limiter_options;
+  limiter_options.bytes_per_second = 4 << 20;
+  limiter_options.refill_period_micros = 10 * 1000;
+  std::shared_ptr<RateLimiter> limiter = NewRateLimiter(limiter_options);
+  FileOptions options;
+  options.rate_limiter = limiter.get();
+  options.rate_limiter_priority = RateLimiter::kHigh;
+  // A large buffer must still be written in small pieces.
+  options.writable_file_buffer_size = 4 << 20;
+
+  for (int direct = 0; direct < 2; ++direct) {
+    options.use_direct_writes = direct;
+    WritableFile* file;
+    Status status = env_->NewWritableFile(path, options, &file);
+    if (status.IsNotSupportedError()) {
+      continue;
+    }
+    ASSERT_LSMDB_OK(status);
+    const uint64_t bytes_before = limiter->GetStats().bytes[RateLimiter::kHigh];
+    const uint64_t requests_before =
+        limiter->GetStats().requests[RateLimiter::kHigh];
+    const uint64_t start = env_->NowMicros();
+    // One write larger than the buffer and many small ones.
+    const std::string data(1 << 20, 'x');
+    ASSERT_LSMDB_OK(file->Append(data));
+    for (int i = 0; i < 1000; ++i) {
+      ASSERT_LSMDB_OK(file->Append(Slice(data.data(), 1000)));
+    }
+    ASSERT_LSMDB_OK(file->Close());
+    delete file;
+
+    // 2MB at 4MB/s.
+    ASSERT_LE(400 * 1000, env_->NowMicros() - start);
+    const uint64_t bytes = limiter->GetStats().bytes[RateLimiter::kHigh];
+    const uint64_t requests = limiter->GetStats().requests[RateLimiter::kHigh];
+    // No request charged more than a 64KB piece.
+    ASSERT_GE(requests - requests_before, (bytes - bytes_before) / 65536)
+        << "direct " << direct;
+    if (direct) {
+      // The padding of the last block is charged as well.
+      ASSERT_LE(data.size() + 1000 * 1000, bytes - bytes_before);
+    } else {
+      ASSERT_EQ(data.size() + 1000 * 1000, bytes - bytes_before);
+    }
+  }
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+// Lets the work items of a test wait for each other.
+struct Rendezvous {
+  Rendezvous() : cv(&mu), arrived(0), departed(0), released(false) {}
+
+  // Count the arrival of the calling work item and wait for release.
+  void ArriveAndWait() {
+    MutexLock l(&mu);
+    arrived++;
+    cv.SignalAll();
+    while (!released) {
+      cv.Wait();
+    }
+    departed++;
+    cv.SignalAll();
+  }
+
+  void WaitForArrivals(int n) {
+    MutexLock l(&mu);
+    while (arrived < n) {
+      cv.Wait();
+    }
+  }
+
+  // Release the work items and wait until all that arrived are gone.
+  void Release() {
+    MutexLock l(&mu);
+    released = true;
+    cv.SignalAll();
+    while (departed < arrived) {
+      cv.Wait();
+    }
+  }
+
+  port::Mutex mu;
+  port::CondVar cv;
+  int arrived;
+  int departed;
+  bool released;
+};
+
+TEST_F(EnvPosixTest, GatheredAppends) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string path = test_dir + "/gathered_appends";
+  RateLimiterOptions limiter_options;
+  limiter_options.bytes_per_second = 1 << 30;
+  std::shared_ptr<RateLimiter> limiter = NewRateLimiter(limiter_options);
+
+  // Buffered, rate-limited, direct and mapped files.
+  for (int mode = 0; mode < 4; ++mode) {
+    FileOptions options;
+    options.rate_limiter = mode == 1 ? limiter.get() : nullptr;
+    options.use_direct_writes = mode == 2;
+    options.use_mmap_writes = mode == 3;
+    WritableFile* file;
+    Status status = env_->NewWritableFile(path, options, &file);
+    if (status.IsNotSupportedError()) {
+      continue;
+    }
+    ASSERT_LSMDB_OK(status);
+
+    // Records of a header and a body of up to twice the write buffer,
+    // some empty parts and more parts than a writev() takes at once.
+    Random rnd(test::RandomSeed());
+    std::string contents;
+    std::vector<std::string> strings;
+    std::vector<Slice> parts;
+    for (int i = 0; i < 200; ++i) {
+      strings.clear();
+      const size_t n = i % 50 == 49 ? 2000 : 1 + rnd.Uniform(3);
+      for (size_t j = 0; j < n; ++j) {
+        const int size = rnd.OneIn(5) ? 0 : n > 3 ? 50 : rnd.Skewed(17);
+        strings.push_back(test::RandomKey(&rnd, size));
+        contents += strings.back();
+      }
+      parts.assign(strings.begin(), strings.end());
+      ASSERT_LSMDB_OK(file->Append(parts.data(), parts.size()));
+    }
+    ASSERT_LSMDB_OK(file->Append(nullptr, 0));
+    ASSERT_LSMDB_OK(file->Close());
+    delete file;
+
+    std::string read;
+    ASSERT_LSMDB_OK(ReadFileToString(env_, path, &read));
+    ASSERT_TRUE(contents == read) << "mode " << mode;
+  }
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, SyncAsync) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string path = test_dir + "/sync_async";
+  WritableFile* file;
+  ASSERT_LSMDB_OK(env_->NewWritableFile(path, &file));
+
+  // The first callback holds up the sync worker, so the following
+  // requests pile up behind it.
+  Rendezvous rendezvous;
+  port::Mutex mu;
+  std::vector<int> order;
+  std::string expected;
+  const int kSyncs = 10;
+  for (int i = 0; i <= kSyncs; ++i) {
+    const std::string record = "record " + std::to_string(i) + "\n";
+    ASSERT_LSMDB_OK(file->Append(record));
+    expected += record;
+    file->SyncAsync([&, i](const Status& status) {
+      ASSERT_LSMDB_OK(status);
+      if (i == 0) {
+        rendezvous.ArriveAndWait();
+      }
+      MutexLock l(&mu);
+      order.push_back(i);
+    });
+    if (i == 0) {
+      rendezvous.WaitForArrivals(1);
+    }
+  }
+  {
+    MutexLock l(&mu);
+    ASSERT_TRUE(order.empty());
+  }
+  rendezvous.Release();
+
+  // Close() waits for the callbacks.
+  ASSERT_LSMDB_OK(file->Close());
+  delete file;
+  ASSERT_EQ(kSyncs + 1, order.size());
+  for (int i = 0; i <= kSyncs; ++i) {
+    ASSERT_EQ(i, order[i]);
+  }
+
+  std::string contents;
+  ASSERT_LSMDB_OK(ReadFileToString(env_, path, &contents));
+  ASSERT_EQ(expected, contents);
+  ASSERT_LSMDB_OK(env_->RemoveFile(path));
+}
+
+TEST_F(EnvPosixTest, SyncAsyncFailureKeepsOrder) {
+  // Writes to /dev/full fail with ENOSPC.
+  WritableFile* file;
+  if (!env_->NewWritableFile("/dev/full", &file).ok()) {
+    return;
+  }
+  Rendezvous rendezvous;
+  port::Mutex mu;
+  std::vector<int> order;
+  // Nothing to write, so this one reaches the sync worker and holds it up.
+  file->SyncAsync([&](const Status& status) {
+    rendezvous.ArriveAndWait();
+    MutexLock l(&mu);
+    order.push_back(0);
+  });
+  rendezvous.WaitForArrivals(1);
+  ASSERT_LSMDB_OK(file->Append("record"));
+  // Fails to write, but reports it after the pending sync.
+  file->SyncAsync([&](const Status& status) {
+    ASSERT_TRUE(!status.ok());
+    MutexLock l(&mu);
+    order.push_back(1);
+  });
+  {
+    MutexLock l(&mu);
+    ASSERT_TRUE(order.empty());
+  }
+  rendezvous.Release();
+  file->Close();
+  delete file;
+  ASSERT_EQ(2, order.size());
+  ASSERT_EQ(0, order[0]);
+  ASSERT_EQ(1, order[1]);
+}
+
+TEST_F(EnvPosixTest, SyncDir) {
+  std::string test_dir;
+  ASSERT_LSMDB_OK(env_->GetTestDirectory(&test_dir));
+  const std::string dir = test_dir + "/sync_dir";
+  env_->CreateDir(dir);
+
+  // A directory not synced yet counts as dirty, a clean one costs nothing.
+  uint64_t syncs = GetDirSyncCount();
+  ASSERT_LSMDB_OK(env_->SyncDir(dir));
+  ASSERT_EQ(++syncs, GetDirSyncCount());
+  ASSERT_LSMDB_OK(env_->SyncDir(dir + "/"));
+  ASSERT_EQ(syncs, GetDirSyncCount());
+
+  // Creating, renaming and removing files dirties the directory.
+  ASSERT_LSMDB_OK(WriteStringToFile(env_, "data", dir + "/a"));
+  ASSERT_LSMDB_OK(env_->SyncDir(dir));
+  ASSERT_EQ(++syncs, GetDirSyncCount());
+  ASSERT_LSMDB_OK(env_->RenameFile(dir + "/a", dir + "/b"));
+  ASSERT_LSMDB_OK(env_->SyncDir(dir));
+  ASSERT_EQ(++syncs, GetDirSyncCount());
+  ASSERT_LSMDB_OK(env_->RemoveFile(dir + "/b"));
+  ASSERT_LSMDB_OK(env_->SyncDir(dir));
+  ASSERT_EQ(++syncs, GetDirSyncCount());
+
+  // Only the first sync of a manifest finds the directory dirty.
+  WritableFile* manifest;
+  ASSERT_LSMDB_OK(env_->NewWritableFile(dir + "/MANIFEST-000001", &manifest));
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_LSMDB_OK(manifest->Append("edit"));
+    ASSERT_LSMDB_OK(manifest->Sync());
+  }
+  ASSERT_EQ(++syncs, GetDirSyncCount());
+  ASSERT_LSMDB_OK(manifest->Close());
+  delete manifest;
+
+  // Concurrent syncs of the same changes share one fsync.
+  ASSERT_LSMDB_OK(env_->RemoveFile(dir + "/MANIFEST-000001"));
+  std::vector<std::thread> threads;
+  std::atomic<int> failures(0);
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&]() {
+      if (!env_->SyncDir(dir).ok()) {
+        failures.fetch_add(1);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(0, failures.load());
+  ASSERT_EQ(++syncs, GetDirSyncCount());
+
+  ASSERT_LSMDB_OK(env_->RemoveDir(dir));
+  ASSERT_FALSE(env_->SyncDir(dir).ok());
+}
+
+TEST_F(EnvPosixTest, MmapBudget) {
+  const size_t kFileSize = 65536;
+  std::string contents[3];
+  std::string paths[3];
+  for (int i = 0; i < 3; ++i) {
+    paths[i] = WriteTestFile("mmap_budget_" + std::to_string(i), kFileSize,
+                             &contents[i]);
+  }
+
+  // Room for two of the files.
+  MmapOptions mmap_options;
+  mmap_options.budget_bytes = 2 * kFileSize + kFileSize / 2;
+  env_->SetMmapOptions(mmap_options);
+  const MmapStats before = env_->GetMmapStats();
+  RandomAccessFile* files[3];
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_LSMDB_OK(env_->NewRandomAccessFile(paths[i], &files[i]));
+  }
+  MmapStats stats = env_->GetMmapStats();
+  ASSERT_EQ(before.mapped_files + 2, stats.mapped_files);
+  ASSERT_EQ(before.mapped_bytes + 2 * kFileSize, stats.mapped_bytes);
+  char scratch[100];
+  Slice result;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_LSMDB_OK(files[i]->Read(1000, 100, &result, scratch));
+    ASSERT_EQ(contents[i].substr(1000, 100), result.ToString());
+  }
+  delete files[0];
+  ASSERT_EQ(before.mapped_files + 1, env_->GetMmapStats().mapped_files);
+
+  // Files over the size threshold are not mapped, even with room left.
+  mmap_options.max_file_size = kFileSize - 1;
+  env_->SetMmapOptions(mmap_options);
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(paths[0], &files[0]));
+  ASSERT_EQ(before.mapped_files + 1, env_->GetMmapStats().mapped_files);
+
+  for (int i = 0; i < 3; ++i) {
+    delete files[i];
+    ASSERT_LSMDB_OK(env_->RemoveFile(paths[i]));
+  }
+  stats = env_->GetMmapStats();
+  ASSERT_EQ(before.mapped_files, stats.mapped_files);
+  ASSERT_EQ(before.mapped_bytes, stats.mapped_bytes);
+  env_->SetMmapOptions(MmapOptions());
+}
+
+TEST_F(EnvPosixTest, AdaptiveMmap) {
+  const size_t kFileSize = 65536;
+  std::string cold_contents, hot_contents;
+  const std::string cold_path =
+      WriteTestFile("adaptive_mmap_cold", kFileSize, &cold_contents);
+  const std::string hot_path =
+      WriteTestFile("adaptive_mmap_hot", kFileSize, &hot_contents);
+
+  // Room for one of the files, which goes to the first one opened.
+  MmapOptions mmap_options;
+  mmap_options.budget_bytes = kFileSize;
+  mmap_options.adaptive = true;
+  env_->SetMmapOptions(mmap_options);
+  FileOptions options;
+  options.mmap_advise_random = true;
+  const MmapStats before = env_->GetMmapStats();
+  RandomAccessFile* cold;
+  RandomAccessFile* hot;
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(cold_path, options, &cold));
+  ASSERT_LSMDB_OK(env_->NewRandomAccessFile(hot_path, options, &hot));
+  ASSERT_EQ(before.mapped_files + 1, env_->GetMmapStats().mapped_files);
+
+  // Reads of the other file move the mapping over to it.
+  Random rnd(test::RandomSeed());
+  char scratch[200];
+  Slice result;
+  for (int i = 0; i < 2000; ++i) {
+    const uint64_t offset = rnd.Uniform(kFileSize + 100);
+    ASSERT_LSMDB_OK(hot->Read(offset, 200, &result, scratch));
+    // Reads stop at the end of the file, mapped or not.
+    const std::string expected =
+        offset < kFileSize ? hot_contents.substr(offset, 200) : "";
+    ASSERT_EQ(expected, result.ToString()) << "read " << i;
+  }
+  MmapStats stats = env_->GetMmapStats();
+  ASSERT_EQ(before.promotions + 1, stats.promotions);
+  ASSERT_EQ(before.demotions + 1, stats.demotions);
+  ASSERT_EQ(before.mapped_files + 1, stats.mapped_files);
+
+  // The unmapped file still reads.
+  ASSERT_LSMDB_OK(cold->Read(kFileSize - 50, 100, &result, scratch));
+  ASSERT_EQ(cold_contents.substr(kFileSize - 50), result.ToString());
+
+  delete cold;
+  delete hot;
+  ASSERT_EQ(before.mapped_files, env_->GetMmapStats().mapped_files);
+  ASSERT_LSMDB_OK(env_->RemoveFile(cold_path));
+  ASSERT_LSMDB_OK(env_->RemoveFile(hot_path));
+  env_->SetMmapOptions(MmapOptions());
+}
+
+TEST_F(EnvPosixTest, FdCache) {
+  // More files than the read-only file limit set by main().
+  const int kFiles = 2 * kReadOnlyFileLimit;
+  const size_t kFileSize = 4096;
+  FileOptions options;
+  options.allow_mmap_reads = false;
+  std::vector<std::string> paths(kFiles);
+  std::vector<std::string> contents(kFiles);
+  std::vector<RandomAccessFile*> files(kFiles);
+  const FdCacheStats before = env_->GetFdCacheStats();
+  for (int i = 0; i < kFiles; ++i) {
+    paths[i] = WriteTestFile("fd_cache_" + std::to_string(i), kFileSize,
+                             &contents[i]);
+    ASSERT_LSMDB_OK(env_->NewRandomAccessFile(paths[i], options, &files[i]));
+  }
+  FdCacheStats stats = env_->GetFdCacheStats();
+  ASSERT_LT(0, stats.capacity);
+  ASSERT_LT(stats.capacity, kReadOnlyFileLimit);
+  ASSERT_EQ(stats.capacity, stats.open_fds);
+  ASSERT_LT(before.evictions, stats.evictions);
+
+  char scratch[kFileSize];
+  Slice result;
+  auto check_read = [&](int i) {
+    const uint64_t offset = i % 100;
+    ASSERT_LSMDB_OK(files[i]->Read(offset, 100, &result, scratch));
+    ASSERT_EQ(contents[i].substr(offset, 100), result.ToString());
+  };
+
+  // The most recently opened file is still open.
+  const FdCacheStats before_hits = env_->GetFdCacheStats();
+  for (int i = 0; i < 100; ++i) {
+    check_read(kFiles - 1);
+  }
+  stats = env_->GetFdCacheStats();
+  ASSERT_EQ(before_hits.hits + 100, stats.hits);
+  ASSERT_EQ(before_hits.misses, stats.misses);
+
+  // Going round all files reopens the cold ones, without ever keeping
+  // more than the capacity open.
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < kFiles; ++i) {
+      check_read(i);
+      ASSERT_LE(env_->GetFdCacheStats().open_fds, stats.capacity);
+    }
+  }
+  FdCacheStats after = env_->GetFdCacheStats();
+  ASSERT_LT(stats.misses, after.misses);
+  ASSERT_LT(stats.evictions, after.evictions);
+  ASSERT_EQ(before.uncached, after.uncached);
+
+  // Concurrent reads of the cached files.
+  std::vector<std::thread> threads;
+  std::atomic<int> failures(0);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      Random rnd(301 + t);
+      char buf[kFileSize];
+      for (int j = 0; j < 1000; ++j) {
+        const int i = rnd.Uniform(kFiles);
+        Slice data;
+        if (!files[i]->Read(0, kFileSize, &data, buf).ok() ||
+            data != Slice(contents[i])) {
+          failures.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(0, failures.load());
+
+  for (int i = 0; i < kFiles; ++i) {
+    delete files[i];
+    ASSERT_LSMDB_OK(env_->RemoveFile(paths[i]));
+  }
+  ASSERT_EQ(0, env_->GetFdCacheStats().open_fds);
+}
+
+TEST_F(EnvPosixTest, ThreadPoolSize) {
+  ThreadPoolOptions options;
+  options.threads = 4;
+  env_->SetThreadPoolOptions(Env::kLow, options);
+
+  // All four items run at the same time.
+  Rendezvous rendezvous;
+  for (int i = 0; i < 4; ++i) {
+    env_->Schedule(
+        [](void* arg) { static_cast<Rendezvous*>(arg)->ArriveAndWait(); },
+        &rendezvous, Env::kLow);
+  }
+  rendezvous.WaitForArrivals(4);
+  ASSERT_EQ(4, env_->GetThreadPoolStats(Env::kLow).threads);
+  rendezvous.Release();
+
+  // Retire the extra threads, which happens once they are idle.
+  env_->SetThreadPoolOptions(Env::kLow, ThreadPoolOptions());
+  while (env_->GetThreadPoolStats(Env::kLow).threads > 1) {
+    env_->SleepForMicroseconds(1000);
+  }
+}
+
+TEST_F(EnvPosixTest, Unschedule) {
+  const ThreadPoolStats before = env_->GetThreadPoolStats(Env::kHigh);
+
+  // Keep the single thread of the pool busy.
+  Rendezvous rendezvous;
+  env_->Schedule(
+      [](void* arg) { static_cast<Rendezvous*>(arg)->ArriveAndWait(); },
+      &rendezvous, Env::kHigh);
+  rendezvous.WaitForArrivals(1);
+
+  std::atomic<int> untagged_runs(0);
+  std::atomic<int> tagged_runs(0);
+  int tag;
+  auto increment = [](void* arg) {
+    static_cast<std::atomic<int>*>(arg)->fetch_add(1);
+  };
+  for (int i = 0; i < 5; ++i) {
+    env_->Schedule(increment, &tagged_runs, Env::kHigh, &tag);
+    env_->Schedule(increment, &untagged_runs, Env::kHigh);
+  }
+  ASSERT_EQ(10, env_->GetThreadPoolStats(Env::kHigh).queue_length);
+  // Work of the other pool is not affected.
+  ASSERT_EQ(0, env_->Unschedule(&tag, Env::kLow));
+  ASSERT_EQ(5, env_->Unschedule(&tag, Env::kHigh));
+  ASSERT_EQ(0, env_->Unschedule(&tag, Env::kHigh));
+  ASSERT_EQ(5, env_->GetThreadPoolStats(Env::kHigh).queue_length);
+
+  env_->SleepForMicroseconds(10000);
+  rendezvous.Release();
+  while (untagged_runs.load() < 5) {
+    env_->SleepForMicroseconds(1000);
+  }
+  ASSERT_EQ(0, tagged_runs.load());
+
+  const ThreadPoolStats stats = env_->GetThreadPoolStats(Env::kHigh);
+  ASSERT_EQ(before.scheduled + 11, stats.scheduled);
+  ASSERT_EQ(before.unscheduled + 5, stats.unscheduled);
+  ASSERT_LE(before.run + 5, stats.run);
+  ASSERT_LE(10, stats.max_queue_length);
+  // The items waited for the first one to finish.
+  ASSERT_LE(10000, stats.max_wait_micros);
+  ASSERT_LE(before.total_wait_micros + 5 * 10000, stats.total_wait_micros);
+}
+
+#if defined(__linux__)
+TEST_F(EnvPosixTest, ThreadPoolCpusAndNice) {
+  ThreadPoolOptions options;
+  options.cpus = {0};
+  options.nice = 5;
+  env_->SetThreadPoolOptions(Env::kHigh, options);
+
+  struct ThreadState {
+    Rendezvous done;
+    int cpu = -1;
+    int nice = 0;
+  } state;
+  env_->Schedule(
+      [](void* arg) {
+        ThreadState* state = static_cast<ThreadState*>(arg);
+        state->cpu = ::sched_getcpu();
+        errno = 0;
+        state->nice = ::getpriority(
+            PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)));
+        state->done.ArriveAndWait();
+      },
+      &state, Env::kHigh);
+  state.done.WaitForArrivals(1);
+  state.done.Release();
+  ASSERT_EQ(0, state.cpu);
+  ASSERT_EQ(5, state.nice);
+
+  // Lowering the nice value again needs privileges, which the test may
+  // not have, so only the CPUs are reset, to those the thread inherited.
+  options.cpus.clear();
+  env_->SetThreadPoolOptions(Env::kHigh, options);
+  struct MaskState {
+    Rendezvous done;
+    cpu_set_t cpus;
+  } mask_state;
+  env_->Schedule(
+      [](void* arg) {
+        MaskState* state = static_cast<MaskState*>(arg);
+        ::sched_getaffinity(0, sizeof(state->cpus), &state->cpus);
+        state->done.ArriveAndWait();
+      },
+      &mask_state, Env::kHigh);
+  mask_state.done.WaitForArrivals(1);
+  mask_state.done.Release();
+  cpu_set_t process_cpus;
+  ASSERT_EQ(0, ::sched_getaffinity(0, sizeof(process_cpus), &process_cpus));
+  ASSERT_TRUE(CPU_EQUAL(&process_cpus, &mask_state.cpus));
+}
+#endif  // defined(__linux__)
+
+TEST_F(EnvPosixTest, PollWithoutReads) {
+  std::vector<ReadRequest*> completed;
+  ASSERT_LSMDB_OK(env_->PollReads(10, &completed));
+  ASSERT_TRUE(completed.empty());
+}
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  // All tests use the same Env, so the limit has to be set before the
+  // first one runs.
+  lsmdb::EnvPosixTest::SetFileLimit(lsmdb::kReadOnlyFileLimit);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -5,6 +5,8 @@
 #ifndef STORAGE_LSMDB_UTIL_ENV_POSIX_TEST_HELPER_H_
 #define STORAGE_LSMDB_UTIL_ENV_POSIX_TEST_HELPER_H_
 
+#include <cstdint>
+
 namespace lsmdb {
 
 class EnvPosixTest;
@@ -22,6 +24,13 @@ private:
   // via mmap.
   // Must be called before creating an Env.
   static void SetReadOnlyMMapLimit(int limit);
+
+  // Whether RandomAccessFile::ReadAsync() may use io_uring. Reads that
+  // are already in flight are not affected.
+  static void SetUseIoUring(bool use);
+
+  // Return the number of directory fsyncs issued so far.
+  static uint64_t GetDirSyncCount();
 };
 
 } // namespace lsmdb
@@ -0,0 +1,215 @@
+//
+// Created by 刘文景 on 2021/4/18.
+//
+
+#include "util/executor.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include "util/mutexlock.h"
+
+namespace lsmdb {
+
+namespace {
+
+// Identifies the worker thread running on the current thread, if any.
+thread_local Executor* current_executor = nullptr;
+thread_local int current_worker = -1;
+
+}  // namespace
+
+Executor::Executor(int num_threads)
+    : next_worker_(0),
+      queued_(0),
+      sleepers_(0),
+      sleep_cv_(&sleep_mutex_),
+      shutting_down_(false) {
+  num_threads = std::max(num_threads, 1);
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  // Workers may steal from each other as soon as they start, so start
+  // them once all deques exist.
+  for (int i = 0; i < num_threads; ++i) {
+    workers_[i]->thread = std::thread(&Executor::WorkerMain, this, i);
+  }
+}
+
+Executor::~Executor() {
+  {
+    MutexLock l(&sleep_mutex_);
+    shutting_down_ = true;
+    sleep_cv_.SignalAll();
+  }
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+  assert(queued_.load() == 0);
+}
+
+void Executor::Submit(std::function<void()> task) {
+  Push(Task{std::move(task), nullptr});
+}
+
+void Executor::ParallelFor(size_t begin, size_t end, size_t grain,
+                           const std::function<void(size_t)>& body) {
+  if (begin >= end) {
+    return;
+  }
+  const size_t n = end - begin;
+  grain = std::max<size_t>(grain, 1);
+  // A few tasks per thread balance the load without much overhead.
+  const size_t max_tasks = static_cast<size_t>(num_threads()) * 4;
+  const size_t num_tasks = std::max<size_t>(
+      1, std::min((n + grain - 1) / grain, max_tasks));
+  const size_t step = (n + num_tasks - 1) / num_tasks;
+
+  TaskGroup group(this);
+  for (size_t start = begin; start < end; start += step) {
+    const size_t limit = std::min(start + step, end);
+    group.Run([&body, start, limit]() {
+      for (size_t i = start; i < limit; ++i) {
+        body(i);
+      }
+    });
+  }
+  group.Wait();
+}
+
+void Executor::Push(Task task) {
+  Worker* worker;
+  if (current_executor == this) {
+    worker = workers_[current_worker].get();
+  } else {
+    worker = workers_[next_worker_.fetch_add(1, std::memory_order_relaxed) %
+                      workers_.size()]
+                 .get();
+  }
+  {
+    MutexLock l(&worker->mutex);
+    worker->tasks.push_back(std::move(task));
+  }
+  // Pairs with WaitForWork(): either the sleeper sees the new task, or
+  // this thread sees the sleeper.
+  queued_.fetch_add(1);
+  if (sleepers_.load() > 0) {
+    WakeUp(false);
+  }
+}
+
+bool Executor::TakeTask(Task* task) {
+  const int n = num_threads();
+  int first;
+  if (current_executor == this) {
+    Worker* own = workers_[current_worker].get();
+    MutexLock l(&own->mutex);
+    if (!own->tasks.empty()) {
+      *task = std::move(own->tasks.back());
+      own->tasks.pop_back();
+      queued_.fetch_sub(1);
+      return true;
+    }
+    first = current_worker + 1;
+  } else {
+    first = static_cast<int>(next_worker_.load(std::memory_order_relaxed) %
+                             workers_.size());
+  }
+
+  // Pushes count their task after queueing it, so this can be briefly
+  // negative.
+  if (queued_.load() <= 0) {
+    return false;
+  }
+  for (int i = 0; i < n; ++i) {
+    Worker* victim = workers_[(first + i) % n].get();
+    MutexLock l(&victim->mutex);
+    if (!victim->tasks.empty()) {
+      *task = std::move(victim->tasks.front());
+      victim->tasks.pop_front();
+      queued_.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Executor::RunOneTask() {
+  Task task;
+  if (!TakeTask(&task)) {
+    return false;
+  }
+  task.func();
+  if (task.group != nullptr) {
+    task.group->TaskDone();
+  }
+  return true;
+}
+
+void Executor::WaitForWork(const std::function<bool()>& done) {
+  MutexLock l(&sleep_mutex_);
+  sleepers_.fetch_add(1);
+  while (queued_.load() <= 0 && !shutting_down_ && !done()) {
+    sleep_cv_.Wait();
+  }
+  sleepers_.fetch_sub(1);
+}
+
+void Executor::WakeUp(bool all) {
+  MutexLock l(&sleep_mutex_);
+  if (all) {
+    sleep_cv_.SignalAll();
+  } else {
+    sleep_cv_.Signal();
+  }
+}
+
+void Executor::WorkerMain(int index) {
+  current_executor = this;
+  current_worker = index;
+  while (true) {
+    if (RunOneTask()) {
+      continue;
+    }
+    {
+      MutexLock l(&sleep_mutex_);
+      if (shutting_down_ && queued_.load() <= 0) {
+        break;
+      }
+    }
+    WaitForWork([]() { return false; });
+  }
+  current_executor = nullptr;
+  current_worker = -1;
+}
+
+TaskGroup::TaskGroup(Executor* executor)
+    : executor_(executor), outstanding_(0) {}
+
+TaskGroup::~TaskGroup() { assert(outstanding_.load() == 0); }
+
+void TaskGroup::Run(std::function<void()> task) {
+  outstanding_.fetch_add(1);
+  executor_->Push(Executor::Task{std::move(task), this});
+}
+
+void TaskGroup::Wait() {
+  while (outstanding_.load() > 0) {
+    if (executor_->RunOneTask()) {
+      continue;
+    }
+    executor_->WaitForWork([this]() { return outstanding_.load() == 0; });
+  }
+}
+
+void TaskGroup::TaskDone() {
+  // The group may be destroyed as soon as outstanding_ drops to zero.
+  Executor* const executor = executor_;
+  if (outstanding_.fetch_sub(1) == 1) {
+    // The waiter may be asleep in WaitForWork().
+    executor->WakeUp(true);
+  }
+}
+
+}  // namespace lsmdb
@@ -0,0 +1,130 @@
+//
+// Created by 刘文景 on 2021/4/18.
+//
+// A work-stealing executor for short, fine-grained tasks, e.g. verifying
+// the checksums of many blocks or loading index partitions in parallel.
+// Coarse background work such as compactions belongs to Env::Schedule().
+//
+// Example:
+//   Executor executor(8);
+//   std::vector<Status> statuses(blocks.size());
+//   executor.ParallelFor(0, blocks.size(), 16, [&](size_t i) {
+//     statuses[i] = VerifyBlock(blocks[i]);
+//   });
+//
+// Tasks can not throw, so they report failures through state they share
+// with their submitter, like "statuses" above.
+
+#ifndef STORAGE_LSMDB_UTIL_EXECUTOR_H_
+#define STORAGE_LSMDB_UTIL_EXECUTOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/noncopyable.h"
+
+namespace lsmdb {
+
+class TaskGroup;
+
+// Every worker thread owns a deque of tasks. A worker pushes the tasks it
+// submits to the back of its own deque and pops them from there, which
+// keeps related work on one core, and steals from the front of the other
+// deques when its own is empty. Tasks submitted by other threads are
+// spread over the deques round-robin.
+class Executor : public noncopyable {
+ public:
+  // Start "num_threads" worker threads, at least one.
+  explicit Executor(int num_threads);
+
+  // Run the tasks that are still queued, then stop the workers.
+  ~Executor();
+
+  int num_threads() const { return static_cast<int>(workers_.size()); }
+
+  // Run "task" on one of the worker threads.
+  void Submit(std::function<void()> task);
+
+  // Call "body(i)" for every i in [begin, end), split into tasks of at
+  // least "grain" iterations, and return once all of them returned. The
+  // calling thread runs tasks too while it waits.
+  void ParallelFor(size_t begin, size_t end, size_t grain,
+                   const std::function<void(size_t)>& body);
+
+ private:
+  friend class TaskGroup;
+
+  struct Task {
+    std::function<void()> func;
+    TaskGroup* group;  // nullptr if the task does not belong to a group.
+  };
+
+  struct Worker {
+    port::Mutex mutex;
+    std::deque<Task> tasks GUARDED_BY(mutex);
+    std::thread thread;
+  };
+
+  void Push(Task task);
+
+  // Pop a task of the calling thread's deque, or steal one. Returns false
+  // if every deque is empty.
+  bool TakeTask(Task* task);
+
+  // Take and run one task. Returns false if there was none.
+  bool RunOneTask();
+
+  // Block until a task is queued, the executor shuts down or "done()"
+  // returns true.
+  void WaitForWork(const std::function<bool()>& done);
+
+  // Wake up the threads in WaitForWork().
+  void WakeUp(bool all);
+
+  void WorkerMain(int index);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<uint64_t> next_worker_;  // For round-robin submission.
+  std::atomic<int64_t> queued_;        // Tasks in all deques.
+  std::atomic<int> sleepers_;          // Threads in WaitForWork().
+
+  port::Mutex sleep_mutex_;
+  port::CondVar sleep_cv_ GUARDED_BY(sleep_mutex_);
+  bool shutting_down_ GUARDED_BY(sleep_mutex_);
+};
+
+// A set of tasks run by an Executor that can be waited for together.
+class TaskGroup : public noncopyable {
+ public:
+  explicit TaskGroup(Executor* executor);
+
+  // REQUIRES: Wait() returned after the last call to Run().
+  ~TaskGroup();
+
+  // Run "task" on the executor as part of this group.
+  void Run(std::function<void()> task);
+
+  // Wait until every task of the group returned, running queued tasks of
+  // the executor in the meantime. Tasks may run further tasks in the
+  // group while it is waited for.
+  void Wait();
+
+ private:
+  friend class Executor;
+
+  void TaskDone();
+
+  Executor* const executor_;
+  std::atomic<int64_t> outstanding_;
+};
+
+}  // namespace lsmdb
+
+#endif  // STORAGE_LSMDB_UTIL_EXECUTOR_H_
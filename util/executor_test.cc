@@ -0,0 +1,122 @@
+//
+// Created by 刘文景 on 2021/4/18.
+//
+
+#include "util/executor.h"
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "util/mutexlock.h"
+
+namespace lsmdb {
+
+TEST(ExecutorTest, Submit) {
+  std::atomic<int> runs(0);
+  {
+    Executor executor(4);
+    ASSERT_EQ(4, executor.num_threads());
+    for (int i = 0; i < 1000; ++i) {
+      executor.Submit([&runs]() { runs.fetch_add(1); });
+    }
+    // The destructor runs the tasks that are still queued.
+  }
+  ASSERT_EQ(1000, runs.load());
+}
+
+TEST(ExecutorTest, ParallelFor) {
+  Executor executor(4);
+  const size_t kGrains[] = {0, 1, 7, 1000, 100000};
+  for (size_t grain : kGrains) {
+    std::vector<int> visits(10000, 0);
+    executor.ParallelFor(0, visits.size(), grain,
+                         [&visits](size_t i) { visits[i]++; });
+    for (size_t i = 0; i < visits.size(); ++i) {
+      ASSERT_EQ(1, visits[i]) << "index " << i << " grain " << grain;
+    }
+  }
+
+  // Empty and shifted ranges.
+  int calls = 0;
+  executor.ParallelFor(5, 5, 1, [&calls](size_t) { calls++; });
+  ASSERT_EQ(0, calls);
+  std::atomic<size_t> sum(0);
+  executor.ParallelFor(100, 200, 1, [&sum](size_t i) { sum.fetch_add(i); });
+  ASSERT_EQ(14950, sum.load());
+}
+
+// Sum [begin, end) by splitting the range in nested task groups.
+static uint64_t NestedSum(Executor* executor, uint64_t begin, uint64_t end) {
+  if (end - begin <= 16) {
+    uint64_t sum = 0;
+    for (uint64_t i = begin; i < end; ++i) {
+      sum += i;
+    }
+    return sum;
+  }
+  const uint64_t middle = begin + (end - begin) / 2;
+  uint64_t left = 0;
+  uint64_t right = 0;
+  TaskGroup group(executor);
+  group.Run([&]() { left = NestedSum(executor, begin, middle); });
+  group.Run([&]() { right = NestedSum(executor, middle, end); });
+  group.Wait();
+  return left + right;
+}
+
+TEST(ExecutorTest, NestedTaskGroups) {
+  // Every worker ends up waiting for a group, so the waiters have to run
+  // the queued tasks themselves.
+  for (int threads = 1; threads <= 4; ++threads) {
+    Executor executor(threads);
+    ASSERT_EQ(100000ull * 99999 / 2, NestedSum(&executor, 0, 100000));
+  }
+}
+
+TEST(ExecutorTest, ConcurrentCallers) {
+  Executor executor(2);
+  std::vector<std::thread> callers;
+  std::atomic<int> runs(0);
+  for (int i = 0; i < 4; ++i) {
+    callers.emplace_back([&executor, &runs]() {
+      for (int j = 0; j < 100; ++j) {
+        executor.ParallelFor(0, 100, 1,
+                             [&runs](size_t) { runs.fetch_add(1); });
+      }
+    });
+  }
+  for (std::thread& caller : callers) {
+    caller.join();
+  }
+  ASSERT_EQ(4 * 100 * 100, runs.load());
+}
+
+TEST(ExecutorTest, Stealing) {
+  Executor executor(4);
+  port::Mutex mutex;
+  std::set<std::thread::id> threads;
+  TaskGroup group(&executor);
+  // All tasks are pushed to the deque of the worker running the first
+  // one, and the idle workers steal them.
+  group.Run([&]() {
+    for (int i = 0; i < 100; ++i) {
+      group.Run([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        MutexLock l(&mutex);
+        threads.insert(std::this_thread::get_id());
+      });
+    }
+  });
+  group.Wait();
+  ASSERT_LT(1, threads.size());
+}
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
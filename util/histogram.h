@@ -0,0 +1,52 @@
+//
+// Created by 刘文景 on 2021/4/15.
+//
+
+#ifndef STORAGE_LSMDB_UTIL_HISTOGRAM_H_
+#define STORAGE_LSMDB_UTIL_HISTOGRAM_H_
+
+#include <string>
+
+namespace lsmdb {
+
+// Collects values (typically latencies in micros) into exponentially
+// growing buckets. Not thread-safe, use one instance per thread and
+// Merge() them.
+class Histogram {
+ public:
+  Histogram() { Clear(); }
+  ~Histogram() = default;
+
+  void Clear();
+  void Add(double value);
+  void Merge(const Histogram& other);
+
+  std::string ToString() const;
+
+  double Num() const { return num_; }
+  double Sum() const { return sum_; }
+  double Min() const { return min_; }
+  double Max() const { return max_; }
+  double Median() const;
+  // Estimate the value below which "p" percent of the values fall.
+  double Percentile(double p) const;
+  double Average() const;
+  double StandardDeviation() const;
+
+ private:
+  enum { kNumBuckets = 154 };
+
+  static const double kBucketLimit[kNumBuckets];
+
+  double min_;
+  double max_;
+  double num_;
+  double sum_;
+  double sum_squares_;
+
+  double buckets_[kNumBuckets];
+};
+
+}  // namespace lsmdb
+
+#endif  // STORAGE_LSMDB_UTIL_HISTOGRAM_H_
@@ -0,0 +1,515 @@
+//
+// Created by 刘文景 on 2021/4/13.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lsmdb/env.h"
+#include "lsmdb/secondary_cache.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/coding.h"
+#include "util/hash.h"
+#include "util/logging.h"
+#include "util/mutexlock.h"
+
+namespace lsmdb {
+
+namespace {
+
+// Every entry is stored as one record:
+//   header_checksum: fixed32   -- covers the rest of the header and the key
+//   key_length:      fixed32
+//   data_length:     fixed32
+//   data_checksum:   fixed32
+//   key:             char[key_length]
+//   data:            char[data_length]
+// An erased key is recorded as a tombstone: a record whose data_length is
+// kTombstone and that carries no data.
+constexpr size_t kHeaderSize = 4 + 4 + 4 + 4;
+constexpr uint32_t kTombstone = 0xffffffffu;
+constexpr uint32_t kChecksumSeed = 0xbc9f1d34;
+
+std::string CacheFileName(const std::string& path, uint64_t number) {
+  char buf[100];
+  std::snprintf(buf, sizeof(buf), "/%06llu.pcache",
+                static_cast<unsigned long long>(number));
+  return path + buf;
+}
+
+// Returns true if "filename" was produced by CacheFileName() and stores
+// its number in *number.
+bool ParseCacheFileName(const std::string& filename, uint64_t* number) {
+  Slice rest(filename);
+  return ConsumeDecimalNumber(&rest, number) && rest == Slice(".pcache");
+}
+
+uint32_t HeaderChecksum(const char* record) {
+  // The key directly follows the header.
+  const uint32_t key_length = DecodeFixed32(record + 4);
+  return Hash(record + 4, kHeaderSize - 4 + key_length, kChecksumSeed);
+}
+
+// A file that is no longer appended to. Shared with in-flight lookups
+// so that recycling the file does not pull it from under them.
+struct CacheFile {
+  CacheFile(uint64_t number, uint64_t size) : number(number), size(size) {}
+
+  const uint64_t number;
+  const uint64_t size;
+  std::unique_ptr<RandomAccessFile> reader;
+};
+
+class PersistentSecondaryCache : public SecondaryCache {
+ public:
+  explicit PersistentSecondaryCache(const PersistentCacheOptions& options)
+      : options_(options),
+        env_(options.env),
+        active_number_(0),
+        total_size_(0) {}
+
+  ~PersistentSecondaryCache() override {
+    if (active_file_ != nullptr) {
+      // Ignoring any potential errors, the next Open() drops torn records.
+      active_file_->Close();
+    }
+  }
+
+  Status Open() LOCKS_EXCLUDED(mutex_);
+
+  Status Insert(const Slice& key, const Slice& data) override;
+  bool Lookup(const Slice& key, std::string* data) override;
+
+  void Erase(const Slice& key) override;
+
+  size_t TotalCharge() const override {
+    MutexLock lock(&mutex_);
+    return static_cast<size_t>(total_size_);
+  }
+
+  SecondaryCacheStats GetStats() const override {
+    MutexLock lock(&mutex_);
+    return stats_;
+  }
+
+ private:
+  // Position of a record inside a cache file.
+  struct Location {
+    uint64_t file_number;
+    uint64_t offset;
+    uint32_t size;
+    // Handed out by Lookup(). The entry stays indexed while the record is
+    // in a live file, so that Erase() knows that it needs a tombstone.
+    bool taken;
+  };
+
+  // Reads the records of an existing file into index_.
+  Status RecoverFile(uint64_t number) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Starts a new file to append to.
+  Status NewActiveFile() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Closes the active file, makes it readable and starts a new one.
+  Status SealActiveFile() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Deletes the oldest files until total_size_ fits into the capacity.
+  void RecycleFiles(uint64_t incoming) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Makes room for appending "size" bytes to the active file, starting a
+  // new file and recycling old ones as needed.
+  Status PrepareAppend(size_t size) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Appends the tombstones queued by Erase() to the active file.
+  void WriteTombstones() LOCKS_EXCLUDED(mutex_, write_mutex_);
+  // Opens a reader for a file that is no longer appended to.
+  Status OpenSealedFile(uint64_t number, uint64_t size)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  static bool DecodeRecord(const Slice& record, const Slice& key,
+                           std::string* data);
+
+  const PersistentCacheOptions options_;
+  Env* const env_;
+
+  // Serializes appends to the active file, and is acquired before mutex_.
+  // Tombstones are written holding only this one, so that erases do not
+  // block lookups.
+  port::Mutex write_mutex_;
+  mutable port::Mutex mutex_;
+  std::unordered_map<std::string, Location> index_ GUARDED_BY(mutex_);
+  // Readable files, ordered from oldest to newest.
+  std::map<uint64_t, std::shared_ptr<CacheFile>> files_ GUARDED_BY(mutex_);
+  uint64_t active_number_ GUARDED_BY(mutex_);
+  // Replaced and appended to only with write_mutex_ held as well.
+  std::unique_ptr<WritableFile> active_file_ GUARDED_BY(mutex_);
+  // Copy of the active file's contents, used to serve its lookups.
+  std::string active_data_ GUARDED_BY(mutex_);
+  // Bytes in all files, including the active one.
+  uint64_t total_size_ GUARDED_BY(mutex_);
+  // Tombstones of erased entries, not written yet.
+  std::string pending_tombstones_ GUARDED_BY(mutex_);
+  SecondaryCacheStats stats_ GUARDED_BY(mutex_);
+};
+
+Status PersistentSecondaryCache::Open() {
+  MutexLock lock(&mutex_);
+  // The directory may already exist.
+  env_->CreateDir(options_.path);
+
+  std::vector<std::string> children;
+  Status s = env_->GetChildren(options_.path, &children);
+  if (!s.ok()) {
+    return s;
+  }
+  std::vector<uint64_t> numbers;
+  for (const std::string& child : children) {
+    uint64_t number;
+    if (ParseCacheFileName(child, &number)) {
+      numbers.push_back(number);
+    }
+  }
+  // Recover in creation order so that newer records win.
+  std::sort(numbers.begin(), numbers.end());
+  for (uint64_t number : numbers) {
+    s = RecoverFile(number);
+    if (!s.ok()) {
+      return s;
+    }
+    active_number_ = number;
+  }
+  RecycleFiles(0);
+  return NewActiveFile();
+}
+
+Status PersistentSecondaryCache::RecoverFile(uint64_t number) {
+  const std::string fname = CacheFileName(options_.path, number);
+  uint64_t file_size;
+  Status s = env_->GetFileSize(fname, &file_size);
+  if (s.ok()) {
+    s = OpenSealedFile(number, file_size);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  SequentialFile* file;
+  s = env_->NewSequentialFile(fname, &file);
+  if (!s.ok()) {
+    return s;
+  }
+  std::unique_ptr<SequentialFile> reader(file);
+
+  uint64_t offset = 0;
+  std::string scratch;
+  while (offset + kHeaderSize <= file_size) {
+    char header[kHeaderSize];
+    Slice result;
+    s = reader->Read(kHeaderSize, &result, header);
+    if (!s.ok() || result.size() != kHeaderSize) {
+      break;
+    }
+    const uint32_t key_length = DecodeFixed32(result.data() + 4);
+    const uint32_t data_length = DecodeFixed32(result.data() + 8);
+    const bool tombstone = data_length == kTombstone;
+    const uint64_t record_size = kHeaderSize +
+                                 static_cast<uint64_t>(key_length) +
+                                 (tombstone ? 0 : data_length);
+    if (offset + record_size > file_size) {
+      // A record torn by a crash, the rest of the file is unusable.
+      break;
+    }
+    scratch.assign(result.data(), result.size());
+    scratch.resize(kHeaderSize + key_length);
+    s = reader->Read(key_length, &result, &scratch[kHeaderSize]);
+    if (!s.ok() || result.size() != key_length) {
+      break;
+    }
+    if (result.data() != &scratch[kHeaderSize]) {
+      std::memcpy(&scratch[kHeaderSize], result.data(), key_length);
+    }
+    if (HeaderChecksum(scratch.data()) != DecodeFixed32(scratch.data())) {
+      break;
+    }
+    if (tombstone) {
+      // The key was erased after the records before this one.
+      index_.erase(scratch.substr(kHeaderSize));
+      offset += record_size;
+      continue;
+    }
+    // The data checksum is verified by Lookup().
+    s = reader->Skip(data_length);
+    if (!s.ok()) {
+      break;
+    }
+    index_[scratch.substr(kHeaderSize)] =
+        Location{number, offset, static_cast<uint32_t>(record_size), false};
+    offset += record_size;
+  }
+  // A damaged file still occupies its full size until it is recycled.
+  total_size_ += file_size;
+  return Status::OK();
+}
+
+Status PersistentSecondaryCache::OpenSealedFile(uint64_t number,
+                                                uint64_t size) {
+  RandomAccessFile* file;
+  Status s =
+      env_->NewRandomAccessFile(CacheFileName(options_.path, number), &file);
+  if (s.ok()) {
+    auto cache_file = std::make_shared<CacheFile>(number, size);
+    cache_file->reader.reset(file);
+    files_[number] = std::move(cache_file);
+  }
+  return s;
+}
+
+Status PersistentSecondaryCache::NewActiveFile() {
+  ++active_number_;
+  WritableFile* file;
+  Status s =
+      env_->NewWritableFile(CacheFileName(options_.path, active_number_), &file);
+  if (s.ok()) {
+    active_file_.reset(file);
+    active_data_.clear();
+  }
+  return s;
+}
+
+Status PersistentSecondaryCache::SealActiveFile() {
+  Status s = active_file_->Close();
+  active_file_.reset();
+  if (s.ok()) {
+    s = OpenSealedFile(active_number_, active_data_.size());
+  }
+  if (!s.ok()) {
+    // The records of the file can not be read anymore.
+    env_->RemoveFile(CacheFileName(options_.path, active_number_));
+    total_size_ -= active_data_.size();
+    for (auto iter = index_.begin(); iter != index_.end();) {
+      if (iter->second.file_number == active_number_) {
+        iter = index_.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+  Status new_file_status = NewActiveFile();
+  return s.ok() ? new_file_status : s;
+}
+
+void PersistentSecondaryCache::RecycleFiles(uint64_t incoming) {
+  while (total_size_ + incoming > options_.capacity && !files_.empty()) {
+    auto oldest = files_.begin();
+    const uint64_t number = oldest->first;
+    total_size_ -= oldest->second->size;
+    // Lookups still holding the file keep it open until they finish.
+    files_.erase(oldest);
+    env_->RemoveFile(CacheFileName(options_.path, number));
+    // Recycling is rare, so scanning the index beats keeping a list of
+    // keys for every file.
+    for (auto iter = index_.begin(); iter != index_.end();) {
+      if (iter->second.file_number == number) {
+        iter = index_.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+}
+
+Status PersistentSecondaryCache::Insert(const Slice& key, const Slice& data) {
+  std::string record;
+  record.resize(kHeaderSize);
+  EncodeFixed32(&record[4], static_cast<uint32_t>(key.size()));
+  EncodeFixed32(&record[8], static_cast<uint32_t>(data.size()));
+  EncodeFixed32(&record[12], Hash(data.data(), data.size(), kChecksumSeed));
+  record.append(key.data(), key.size());
+  EncodeFixed32(&record[0], HeaderChecksum(record.data()));
+  record.append(data.data(), data.size());
+
+  MutexLock write_lock(&write_mutex_);
+  MutexLock lock(&mutex_);
+  const uint64_t start = env_->NowMicros();
+  if (record.size() > options_.capacity) {
+    return Status::InvalidArgument("entry is larger than the cache capacity");
+  }
+  Status s = PrepareAppend(record.size());
+  if (s.ok()) {
+    s = active_file_->Append(record);
+  }
+  if (s.ok()) {
+    // Make the record durable across restarts of this process.
+    s = active_file_->Flush();
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  index_[key.ToString()] =
+      Location{active_number_, active_data_.size(),
+               static_cast<uint32_t>(record.size()), false};
+  active_data_.append(record);
+  total_size_ += record.size();
+
+  stats_.inserts++;
+  stats_.bytes_inserted += data.size();
+  stats_.bytes_stored += record.size();
+  stats_.insert_micros += env_->NowMicros() - start;
+  return s;
+}
+
+void PersistentSecondaryCache::Erase(const Slice& key) {
+  {
+    MutexLock lock(&mutex_);
+    auto iter = index_.find(key.ToString());
+    if (iter == index_.end()) {
+      // No live file holds a record of the key.
+      return;
+    }
+    index_.erase(iter);
+    // Without a tombstone the next Open() would bring the record back.
+    std::string& record = pending_tombstones_;
+    const size_t header = record.size();
+    record.resize(header + kHeaderSize);
+    EncodeFixed32(&record[header + 4], static_cast<uint32_t>(key.size()));
+    EncodeFixed32(&record[header + 8], kTombstone);
+    EncodeFixed32(&record[header + 12], 0);
+    record.append(key.data(), key.size());
+    EncodeFixed32(&record[header], HeaderChecksum(&record[header]));
+  }
+  WriteTombstones();
+}
+
+void PersistentSecondaryCache::WriteTombstones() {
+  MutexLock write_lock(&write_mutex_);
+  std::string batch;
+  WritableFile* file;
+  {
+    MutexLock lock(&mutex_);
+    if (pending_tombstones_.empty()) {
+      // Written along with those of a concurrent Erase().
+      return;
+    }
+    batch.swap(pending_tombstones_);
+    if (!PrepareAppend(batch.size()).ok()) {
+      // Ignoring the error, the entries are at worst served stale after a
+      // restart.
+      return;
+    }
+    file = active_file_.get();
+  }
+
+  // Write without holding the mutex so that lookups go on meanwhile.
+  // write_mutex_ keeps the active file from changing.
+  Status s = file->Append(batch);
+  if (s.ok()) {
+    s = file->Flush();
+  }
+
+  MutexLock lock(&mutex_);
+  if (s.ok()) {
+    active_data_.append(batch);
+    total_size_ += batch.size();
+  }
+}
+
+Status PersistentSecondaryCache::PrepareAppend(size_t size) {
+  Status s;
+  if (active_file_ == nullptr) {
+    // A previous error left the cache without a file to append to.
+    s = NewActiveFile();
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  if (!active_data_.empty() &&
+      active_data_.size() + size > options_.file_size) {
+    s = SealActiveFile();
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  RecycleFiles(size);
+  return s;
+}
+
+bool PersistentSecondaryCache::Lookup(const Slice& key, std::string* data) {
+  std::shared_ptr<CacheFile> file;
+  Location location;
+  uint64_t start;
+  {
+    MutexLock lock(&mutex_);
+    stats_.lookups++;
+    start = env_->NowMicros();
+    auto iter = index_.find(key.ToString());
+    if (iter == index_.end() || iter->second.taken) {
+      return false;
+    }
+    location = iter->second;
+    // The caller promotes the entry, the record itself stays in the file
+    // until the file is recycled.
+    iter->second.taken = true;
+    if (location.file_number == active_number_) {
+      bool ok = DecodeRecord(
+          Slice(active_data_.data() + location.offset, location.size), key,
+          data);
+      stats_.hits += ok ? 1 : 0;
+      stats_.lookup_micros += env_->NowMicros() - start;
+      return ok;
+    }
+    auto file_iter = files_.find(location.file_number);
+    assert(file_iter != files_.end());
+    file = file_iter->second;
+  }
+
+  // Read without holding the mutex so lookups do not wait on each other.
+  std::string scratch(location.size, '\0');
+  Slice record;
+  Status s = file->reader->Read(location.offset, location.size, &record,
+                                &scratch[0]);
+  bool ok = s.ok() && record.size() == location.size &&
+            DecodeRecord(record, key, data);
+
+  MutexLock lock(&mutex_);
+  stats_.hits += ok ? 1 : 0;
+  stats_.lookup_micros += env_->NowMicros() - start;
+  return ok;
+}
+
+bool PersistentSecondaryCache::DecodeRecord(const Slice& record,
+                                            const Slice& key,
+                                            std::string* data) {
+  const char* p = record.data();
+  const uint32_t key_length = DecodeFixed32(p + 4);
+  const uint32_t data_length = DecodeFixed32(p + 8);
+  if (kHeaderSize + static_cast<uint64_t>(key_length) + data_length !=
+          record.size() ||
+      HeaderChecksum(p) != DecodeFixed32(p) ||
+      Slice(p + kHeaderSize, key_length) != key) {
+    return false;
+  }
+  const char* contents = p + kHeaderSize + key_length;
+  if (Hash(contents, data_length, kChecksumSeed) != DecodeFixed32(p + 12)) {
+    return false;
+  }
+  data->assign(contents, data_length);
+  return true;
+}
+
+}  // namespace
+
+Status NewPersistentSecondaryCache(const PersistentCacheOptions& options,
+                                   std::shared_ptr<SecondaryCache>* result) {
+  result->reset();
+  if (options.env == nullptr || options.path.empty()) {
+    return Status::InvalidArgument("persistent cache needs an env and a path");
+  }
+  auto cache = std::make_shared<PersistentSecondaryCache>(options);
+  Status s = cache->Open();
+  if (s.ok()) {
+    *result = std::move(cache);
+  }
+  return s;
+}
+
+}  // namespace lsmdb
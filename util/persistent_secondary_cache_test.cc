@@ -0,0 +1,183 @@
+//
+// Created by 刘文景 on 2021/4/13.
+//
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "helpers/memenv/memenv.h"
+#include "lsmdb/env.h"
+#include "lsmdb/secondary_cache.h"
+#include "util/test_util.h"
+
+namespace lsmdb {
+
+class PersistentSecondaryCacheTest : public testing::Test {
+ public:
+  PersistentSecondaryCacheTest() : env_(NewMemEnv(Env::Default())) {
+    options_.env = env_.get();
+    options_.path = "/cache";
+    options_.capacity = 64 * 1024;
+    options_.file_size = 4 * 1024;
+  }
+
+  void Reopen() {
+    cache_.reset();
+    ASSERT_LSMDB_OK(NewPersistentSecondaryCache(options_, &cache_));
+  }
+
+  static std::string Key(int i) { return "key" + std::to_string(i); }
+
+  static std::string Value(int i) {
+    return std::string(100 + i % 50, static_cast<char>('a' + i % 26));
+  }
+
+  int NumFiles() {
+    std::vector<std::string> children;
+    EXPECT_LSMDB_OK(env_->GetChildren(options_.path, &children));
+    return static_cast<int>(children.size());
+  }
+
+  std::unique_ptr<Env> env_;
+  PersistentCacheOptions options_;
+  std::shared_ptr<SecondaryCache> cache_;
+};
+
+TEST_F(PersistentSecondaryCacheTest, InsertAndLookup) {
+  Reopen();
+  std::string data;
+  ASSERT_TRUE(!cache_->Lookup(Key(0), &data));
+  // Enough entries to fill several files.
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_LSMDB_OK(cache_->Insert(Key(i), Value(i)));
+  }
+  ASSERT_GT(NumFiles(), 1);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(cache_->Lookup(Key(i), &data));
+    ASSERT_EQ(Value(i), data);
+    // Found entries are handed over to the caller.
+    ASSERT_TRUE(!cache_->Lookup(Key(i), &data));
+  }
+  SecondaryCacheStats stats = cache_->GetStats();
+  ASSERT_EQ(100, stats.inserts);
+  ASSERT_EQ(100, stats.hits);
+  ASSERT_EQ(201, stats.lookups);
+}
+
+TEST_F(PersistentSecondaryCacheTest, Erase) {
+  Reopen();
+  std::string data;
+  ASSERT_LSMDB_OK(cache_->Insert(Key(1), Value(1)));
+  cache_->Erase(Key(1));
+  ASSERT_TRUE(!cache_->Lookup(Key(1), &data));
+}
+
+TEST_F(PersistentSecondaryCacheTest, EraseOfMissingKeyWritesNothing) {
+  Reopen();
+  ASSERT_LSMDB_OK(cache_->Insert(Key(1), Value(1)));
+  const size_t charge = cache_->TotalCharge();
+  cache_->Erase(Key(2));
+  ASSERT_EQ(charge, cache_->TotalCharge());
+  // A tombstone is only needed while a file holds a record of the key.
+  cache_->Erase(Key(1));
+  ASSERT_GT(cache_->TotalCharge(), charge);
+  const size_t erased_charge = cache_->TotalCharge();
+  cache_->Erase(Key(1));
+  ASSERT_EQ(erased_charge, cache_->TotalCharge());
+}
+
+TEST_F(PersistentSecondaryCacheTest, EraseSurvivesRecovery) {
+  Reopen();
+  std::string data;
+  ASSERT_LSMDB_OK(cache_->Insert(Key(1), Value(1)));
+  ASSERT_LSMDB_OK(cache_->Insert(Key(2), Value(2)));
+  ASSERT_LSMDB_OK(cache_->Insert(Key(3), Value(3)));
+  cache_->Erase(Key(1));
+  // Erasing an entry that was already looked up must also stick.
+  ASSERT_TRUE(cache_->Lookup(Key(2), &data));
+  cache_->Erase(Key(2));
+  // A key inserted again after its erase is recovered.
+  cache_->Erase(Key(3));
+  ASSERT_LSMDB_OK(cache_->Insert(Key(3), "new value"));
+
+  Reopen();
+  ASSERT_TRUE(!cache_->Lookup(Key(1), &data));
+  ASSERT_TRUE(!cache_->Lookup(Key(2), &data));
+  ASSERT_TRUE(cache_->Lookup(Key(3), &data));
+  ASSERT_EQ("new value", data);
+}
+
+TEST_F(PersistentSecondaryCacheTest, FilesAreRecycled) {
+  Reopen();
+  std::string data;
+  const int kNum = 2000;
+  for (int i = 0; i < kNum; ++i) {
+    ASSERT_LSMDB_OK(cache_->Insert(Key(i), Value(i)));
+    ASSERT_LE(cache_->TotalCharge(), options_.capacity);
+  }
+  ASSERT_LE(NumFiles(), options_.capacity / options_.file_size + 1);
+  // The oldest entries went away with their files, the newest are kept.
+  ASSERT_TRUE(!cache_->Lookup(Key(0), &data));
+  ASSERT_TRUE(cache_->Lookup(Key(kNum - 1), &data));
+  ASSERT_EQ(Value(kNum - 1), data);
+}
+
+TEST_F(PersistentSecondaryCacheTest, Recovery) {
+  Reopen();
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_LSMDB_OK(cache_->Insert(Key(i), Value(i)));
+  }
+  // Overwritten entries recover with their newest data.
+  ASSERT_LSMDB_OK(cache_->Insert(Key(7), "new value"));
+
+  Reopen();
+  std::string data;
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(cache_->Lookup(Key(i), &data));
+    ASSERT_EQ(i == 7 ? std::string("new value") : Value(i), data);
+  }
+}
+
+TEST_F(PersistentSecondaryCacheTest, TornRecordIsIgnored) {
+  Reopen();
+  ASSERT_LSMDB_OK(cache_->Insert(Key(1), Value(1)));
+  ASSERT_LSMDB_OK(cache_->Insert(Key(2), Value(2)));
+  cache_.reset();
+
+  // Append half a record to the newest file.
+  std::vector<std::string> children;
+  ASSERT_LSMDB_OK(env_->GetChildren(options_.path, &children));
+  std::string newest;
+  for (const std::string& child : children) {
+    newest = std::max(newest, child);
+  }
+  WritableFile* file;
+  ASSERT_LSMDB_OK(
+      env_->NewAppendableFile(options_.path + "/" + newest, &file));
+  ASSERT_LSMDB_OK(file->Append(std::string(10, '\xff')));
+  ASSERT_LSMDB_OK(file->Close());
+  delete file;
+
+  Reopen();
+  std::string data;
+  ASSERT_TRUE(cache_->Lookup(Key(1), &data));
+  ASSERT_EQ(Value(1), data);
+  ASSERT_TRUE(cache_->Lookup(Key(2), &data));
+  ASSERT_EQ(Value(2), data);
+}
+
+TEST_F(PersistentSecondaryCacheTest, InvalidOptions) {
+  options_.env = nullptr;
+  ASSERT_TRUE(NewPersistentSecondaryCache(options_, &cache_)
+                  .IsInvalidArgument());
+  ASSERT_TRUE(cache_ == nullptr);
+}
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,221 @@
+//
+// Created by 刘文景 on 2021/4/17.
+//
+
+#include "lsmdb/rate_limiter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+
+namespace lsmdb {
+
+RateLimiter::~RateLimiter() = default;
+
+namespace {
+
+constexpr int kNumPriorities = 2;
+
+// Number of refill periods between two adjustments of an auto-tuned rate.
+constexpr int kTunePeriods = 10;
+
+uint64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Tokens are bytes. They are added once per refill period by one of the
+// waiting threads, the leader, which then hands them out to the queued
+// requests in priority order and wakes everybody up. Requests that get
+// less than they asked for stay at the front of their queue.
+class GenericRateLimiter : public RateLimiter {
+ public:
+  explicit GenericRateLimiter(const RateLimiterOptions& options)
+      : refill_period_micros_(std::max<int64_t>(options.refill_period_micros,
+                                                1)),
+        fairness_(std::max(options.fairness, 1)),
+        auto_tuned_(options.auto_tuned),
+        target_latency_micros_(options.target_latency_micros),
+        cv_(&mutex_),
+        max_bytes_per_second_(options.bytes_per_second),
+        available_bytes_(0),
+        next_refill_micros_(NowMicros()),
+        leader_waiting_(false),
+        rnd_(301),
+        periods_since_tune_(0),
+        throttled_since_tune_(false),
+        latency_sum_(0),
+        latency_count_(0) {
+    SetRate(options.bytes_per_second);
+  }
+
+  ~GenericRateLimiter() override = default;
+
+  void Request(uint64_t bytes, Priority priority) override {
+    assert(priority >= 0 && priority < kNumPriorities);
+    if (bytes == 0) {
+      return;
+    }
+    MutexLock l(&mutex_);
+    stats_.requests[priority]++;
+    stats_.bytes[priority] += bytes;
+    if (queue_[kLow].empty() && queue_[kHigh].empty()) {
+      const uint64_t granted = std::min(bytes, available_bytes_);
+      available_bytes_ -= granted;
+      bytes -= granted;
+      if (bytes == 0) {
+        return;
+      }
+    }
+
+    stats_.throttled_requests[priority]++;
+    throttled_since_tune_ = true;
+    const uint64_t start = NowMicros();
+    PendingRequest req(bytes);
+    queue_[priority].push_back(&req);
+    while (!req.granted) {
+      if (leader_waiting_) {
+        cv_.Wait();
+        continue;
+      }
+      leader_waiting_ = true;
+      const uint64_t now = NowMicros();
+      if (now < next_refill_micros_) {
+        cv_.TimedWait(next_refill_micros_ - now);
+      }
+      leader_waiting_ = false;
+      if (NowMicros() >= next_refill_micros_) {
+        Refill();
+      }
+      // Let the granted requests return and another waiter lead.
+      cv_.SignalAll();
+    }
+    stats_.throttled_micros[priority] += NowMicros() - start;
+  }
+
+  void RecordLatency(uint64_t micros) override {
+    latency_sum_.fetch_add(micros, std::memory_order_relaxed);
+    latency_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void SetBytesPerSecond(int64_t bytes_per_second) override {
+    MutexLock l(&mutex_);
+    max_bytes_per_second_ = bytes_per_second;
+    SetRate(bytes_per_second);
+  }
+
+  int64_t GetBytesPerSecond() const override {
+    MutexLock l(&mutex_);
+    return bytes_per_second_;
+  }
+
+  RateLimiterStats GetStats() const override {
+    MutexLock l(&mutex_);
+    return stats_;
+  }
+
+ private:
+  struct PendingRequest {
+    explicit PendingRequest(uint64_t bytes) : bytes(bytes), granted(false) {}
+
+    uint64_t bytes;  // Still to be granted.
+    bool granted;
+  };
+
+  void SetRate(int64_t bytes_per_second) EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    assert(bytes_per_second > 0);
+    bytes_per_second_ = bytes_per_second;
+    refill_bytes_ = std::max<uint64_t>(
+        1, bytes_per_second * refill_period_micros_ / 1000000);
+  }
+
+  void Refill() EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    next_refill_micros_ = NowMicros() + refill_period_micros_;
+    // Unused bytes do not accumulate beyond one period's worth.
+    available_bytes_ = std::min(available_bytes_ + refill_bytes_,
+                                refill_bytes_);
+    if (rnd_.OneIn(fairness_)) {
+      Grant(&queue_[kLow]);
+      Grant(&queue_[kHigh]);
+    } else {
+      Grant(&queue_[kHigh]);
+      Grant(&queue_[kLow]);
+    }
+    if (auto_tuned_ && ++periods_since_tune_ == kTunePeriods) {
+      Tune();
+    }
+  }
+
+  void Grant(std::deque<PendingRequest*>* queue)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    while (!queue->empty() && available_bytes_ > 0) {
+      PendingRequest* req = queue->front();
+      if (req->bytes > available_bytes_) {
+        req->bytes -= available_bytes_;
+        available_bytes_ = 0;
+        break;
+      }
+      available_bytes_ -= req->bytes;
+      req->granted = true;
+      queue->pop_front();
+    }
+  }
+
+  void Tune() EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    periods_since_tune_ = 0;
+    const uint64_t count = latency_count_.exchange(0);
+    const uint64_t sum = latency_sum_.exchange(0);
+    const bool throttled = throttled_since_tune_;
+    throttled_since_tune_ = false;
+    if (count == 0) {
+      return;
+    }
+    const uint64_t average = sum / count;
+    const int64_t min_rate = std::max<int64_t>(max_bytes_per_second_ / 20, 1);
+    if (average > target_latency_micros_) {
+      SetRate(std::max(bytes_per_second_ - bytes_per_second_ / 4, min_rate));
+    } else if (average < target_latency_micros_ / 2 && throttled) {
+      SetRate(std::min(bytes_per_second_ + std::max<int64_t>(
+                                               bytes_per_second_ / 4, 1),
+                       max_bytes_per_second_));
+    }
+  }
+
+  const int64_t refill_period_micros_;
+  const int fairness_;
+  const bool auto_tuned_;
+  const uint64_t target_latency_micros_;
+
+  mutable port::Mutex mutex_;
+  port::CondVar cv_ GUARDED_BY(mutex_);
+  int64_t max_bytes_per_second_ GUARDED_BY(mutex_);
+  int64_t bytes_per_second_ GUARDED_BY(mutex_);
+  uint64_t refill_bytes_ GUARDED_BY(mutex_);
+  uint64_t available_bytes_ GUARDED_BY(mutex_);
+  uint64_t next_refill_micros_ GUARDED_BY(mutex_);
+  bool leader_waiting_ GUARDED_BY(mutex_);
+  std::deque<PendingRequest*> queue_[kNumPriorities] GUARDED_BY(mutex_);
+  Random rnd_ GUARDED_BY(mutex_);
+  int periods_since_tune_ GUARDED_BY(mutex_);
+  bool throttled_since_tune_ GUARDED_BY(mutex_);
+  RateLimiterStats stats_ GUARDED_BY(mutex_);
+
+  std::atomic<uint64_t> latency_sum_;
+  std::atomic<uint64_t> latency_count_;
+};
+
+}  // namespace
+
+std::shared_ptr<RateLimiter> NewRateLimiter(
+    const RateLimiterOptions& options) {
+  return std::make_shared<GenericRateLimiter>(options);
+}
+
+}  // namespace lsmdb
@@ -0,0 +1,147 @@
+//
+// Created by 刘文景 on 2021/4/17.
+//
+
+#include "lsmdb/rate_limiter.h"
+
+#include <atomic>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "lsmdb/env.h"
+
+namespace lsmdb {
+
+class RateLimiterTest : public testing::Test {
+ public:
+  RateLimiterTest() : env_(Env::Default()) {}
+
+  // Request "bytes" in pieces of "request_size" and return the time it
+  // took in microseconds.
+  uint64_t RequestAll(RateLimiter* limiter, uint64_t bytes,
+                      uint64_t request_size) {
+    const uint64_t start = env_->NowMicros();
+    for (uint64_t requested = 0; requested < bytes;
+         requested += request_size) {
+      limiter->Request(request_size, RateLimiter::kLow);
+    }
+    return env_->NowMicros() - start;
+  }
+
+  // Run a high- and a low-priority thread that keep requesting
+  // "request_size" bytes for "micros" microseconds and return the stats of
+  // "limiter".
+  static RateLimiterStats Compete(RateLimiter* limiter, uint64_t request_size,
+                                  uint64_t micros) {
+    std::atomic<bool> done(false);
+    auto requester = [&](RateLimiter::Priority priority) {
+      while (!done.load()) {
+        limiter->Request(request_size, priority);
+      }
+    };
+    std::thread high(requester, RateLimiter::kHigh);
+    std::thread low(requester, RateLimiter::kLow);
+    std::this_thread::sleep_for(std::chrono::microseconds(micros));
+    done.store(true);
+    high.join();
+    low.join();
+    return limiter->GetStats();
+  }
+
+  Env* env_;
+};
+
+TEST_F(RateLimiterTest, Rate) {
+  RateLimiterOptions options;
+  options.bytes_per_second = 1 << 20;
+  options.refill_period_micros = 10 * 1000;
+  std::shared_ptr<RateLimiter> limiter = NewRateLimiter(options);
+
+  // 300KB at 1MB/s, less the first period that is granted right away.
+  const uint64_t micros = RequestAll(limiter.get(), 300 << 10, 1 << 10);
+  ASSERT_GE(micros, 250 * 1000);
+  ASSERT_LE(micros, 1000 * 1000);
+
+  const RateLimiterStats stats = limiter->GetStats();
+  ASSERT_EQ(300, stats.requests[RateLimiter::kLow]);
+  ASSERT_EQ(300 << 10, stats.bytes[RateLimiter::kLow]);
+  ASSERT_LT(0, stats.throttled_requests[RateLimiter::kLow]);
+  ASSERT_LE(200 * 1000, stats.throttled_micros[RateLimiter::kLow]);
+  ASSERT_EQ(0, stats.requests[RateLimiter::kHigh]);
+}
+
+TEST_F(RateLimiterTest, RequestLargerThanRefill) {
+  RateLimiterOptions options;
+  options.bytes_per_second = 1 << 20;
+  options.refill_period_micros = 10 * 1000;
+  std::shared_ptr<RateLimiter> limiter = NewRateLimiter(options);
+
+  // Ten times the bytes of a refill period.
+  const uint64_t micros = RequestAll(limiter.get(), 100 << 10, 100 << 10);
+  ASSERT_GE(micros, 80 * 1000);
+  ASSERT_LE(micros, 1000 * 1000);
+}
+
+TEST_F(RateLimiterTest, SetBytesPerSecond) {
+  RateLimiterOptions options;
+  options.bytes_per_second = 1 << 20;
+  options.refill_period_micros = 10 * 1000;
+  std::shared_ptr<RateLimiter> limiter = NewRateLimiter(options);
+  ASSERT_EQ(1 << 20, limiter->GetBytesPerSecond());
+
+  limiter->SetBytesPerSecond(4 << 20);
+  ASSERT_EQ(4 << 20, limiter->GetBytesPerSecond());
+  const uint64_t micros = RequestAll(limiter.get(), 400 << 10, 1 << 10);
+  ASSERT_GE(micros, 70 * 1000);
+  ASSERT_LE(micros, 300 * 1000);
+}
+
+TEST_F(RateLimiterTest, Priorities) {
+  RateLimiterOptions options;
+  options.bytes_per_second = 1 << 20;
+  options.refill_period_micros = 10 * 1000;
+  options.fairness = 1 << 20;
+  std::shared_ptr<RateLimiter> limiter = NewRateLimiter(options);
+  // Every request takes most of a refill period's bytes, so the threads
+  // keep waiting for each other.
+  RateLimiterStats stats = Compete(limiter.get(), 10 << 10, 300 * 1000);
+  ASSERT_GT(stats.bytes[RateLimiter::kHigh],
+            2 * stats.bytes[RateLimiter::kLow]);
+
+  // Every refill serves the low-priority requests first.
+  options.fairness = 1;
+  limiter = NewRateLimiter(options);
+  stats = Compete(limiter.get(), 10 << 10, 300 * 1000);
+  ASSERT_GT(stats.bytes[RateLimiter::kLow],
+            2 * stats.bytes[RateLimiter::kHigh]);
+}
+
+TEST_F(RateLimiterTest, AutoTune) {
+  RateLimiterOptions options;
+  options.bytes_per_second = 10 << 20;
+  options.refill_period_micros = 1000;
+  options.auto_tuned = true;
+  options.target_latency_micros = 1000;
+  std::shared_ptr<RateLimiter> limiter = NewRateLimiter(options);
+
+  // Slow I/O lowers the rate down to its minimum.
+  while (limiter->GetBytesPerSecond() > (10 << 20) / 20) {
+    limiter->RecordLatency(5000);
+    limiter->Request(10 << 10, RateLimiter::kLow);
+  }
+  ASSERT_EQ((10 << 20) / 20, limiter->GetBytesPerSecond());
+
+  // Fast I/O raises it back while requests have to wait.
+  while (limiter->GetBytesPerSecond() < (10 << 20)) {
+    limiter->RecordLatency(10);
+    limiter->Request(10 << 10, RateLimiter::kLow);
+  }
+  ASSERT_EQ(10 << 20, limiter->GetBytesPerSecond());
+}
+
+}  // namespace lsmdb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -66,6 +66,9 @@ std::string Status::ToString() const {
       case kIOError:
         type = "IO error: ";
         break;
+      case kIncomplete:
+        type = "Incomplete: ";
+        break;
       default:
         std::snprintf(tmp, sizeof(tmp),
                       "Unknown code(%d): ", static_cast<int>(code()));